@@ -0,0 +1,107 @@
+/* arcrc.c -- AccurateRip (v1/v2) and CRC32 checksums of audio tracks
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Checksums are updated with the audio data as it is written, so they
+ * match the data in the output files. AccurateRip checksums skip the
+ * first five blocks of the first track and the last five blocks of the
+ * last track (minus one sample), as the AccurateRip database does.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define AR_SKIP  (5*RAWBLOCKSIZE/4)   /* samples in five blocks */
+
+static uint32 crc32_table[256];
+static int crc32_table_ok = 0;
+
+static void crc32_init()
+{
+  uint32 c;
+  int i, j;
+
+  for (i=0;i<256;i++) {
+    c=i;
+    for (j=0;j<8;j++) c=((c&1) ? (c>>1)^0xedb88320UL : (c>>1));
+    crc32_table[i]=c;
+  }
+  crc32_table_ok=1;
+}
+
+
+/* 'samples' is length of the track in (stereo) samples, 'first' and
+   'last' tell if this is the first or last audio track of the disc */
+void audio_crc_init(audio_crc_type *c, long samples, int first, int last)
+{
+  if (!crc32_table_ok) crc32_init();
+  c->ar1=c->ar2=0;
+  c->crc32=0xffffffffUL;
+  c->pos=0;
+  c->check_from=(first ? AR_SKIP : 1);
+  c->check_to=(last ? samples-AR_SKIP : samples);
+}
+
+/* update checksums with 'len' bytes of CD-DA data (little endian) */
+void audio_crc_update(audio_crc_type *c, const unsigned char *buf, long len)
+{
+  uint32 crc = c->crc32, s, m, a0, a1, b0, b1, p00, p01, p10, mid, lo, hi;
+  long i;
+
+  for (i=0;i<len;i++)
+    crc=(crc>>8)^crc32_table[(crc^buf[i])&0xff];
+  c->crc32=crc;
+
+  for (i=0;i+3<len;i+=4) {
+    m=++c->pos;
+    if ((long)m < c->check_from || (long)m > c->check_to) continue;
+    s=(uint32)buf[i] | ((uint32)buf[i+1]<<8) | ((uint32)buf[i+2]<<16) |
+      ((uint32)buf[i+3]<<24);
+
+    /* 32x32 -> 64 bit multiplication using 16 bit halves */
+    a0=s&0xffff; a1=(s>>16)&0xffff;
+    b0=m&0xffff; b1=(m>>16)&0xffff;
+    p00=a0*b0; p01=a0*b1; p10=a1*b0;
+    mid=(p00>>16)+(p01&0xffff)+(p10&0xffff);
+    lo=((p00&0xffff) | (mid<<16))&0xffffffffUL;
+    hi=(a1*b1+(p01>>16)+(p10>>16)+(mid>>16))&0xffffffffUL;
+
+    c->ar1=(c->ar1+lo)&0xffffffffUL;
+    c->ar2=(c->ar2+lo+hi)&0xffffffffUL;
+  }
+}
+
+void audio_crc_csv_header(FILE *f)
+{
+  fprintf(f,"Track,Start,Length,AccurateRip v1,AccurateRip v2,CRC32\n");
+}
+
+void audio_crc_csv_line(FILE *f, int track, int start, int length,
+			audio_crc_type *c)
+{
+  fprintf(f,"%d,%d,%d,%08lx,%08lx,%08lx\n",track,start,length,
+	  (unsigned long)c->ar1,(unsigned long)c->ar2,
+	  (unsigned long)(c->crc32^0xffffffffUL)&0xffffffffUL);
+}
+
+/* print checksums of a track to stderr */
+void audio_crc_print(int track, audio_crc_type *c)
+{
+  fprintf(stderr,"Track %02d: AccurateRip v1 %08lx, v2 %08lx, CRC32 %08lx\n",
+	  track,(unsigned long)c->ar1,(unsigned long)c->ar2,
+	  (unsigned long)(c->crc32^0xffffffffUL)&0xffffffffUL);
+}
@@ -0,0 +1,463 @@
+/* audio.c -- reading CD-DA tracks into WAV/AIFF/AIFF-C files
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Audio tracks are read with READ CD (2352 bytes of 16bit stereo
+ * samples per block), so this works on any MMC drive without the
+ * vendor specific density codes. Sound files are written directly,
+ * header is written first with zero sizes and updated when the file
+ * is closed.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef IRIX
+#include <dmedia/audiofile.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* 44100.0 as 80bit IEEE 754 extended precision number (for AIFF) */
+static unsigned char aiff_rate[10] = { 0x40,0x0e,0xac,0x44,0,0,0,0,0,0 };
+
+static unsigned char *put_be32(unsigned char *p, unsigned long v)
+{
+  p[0]=(v>>24)&0xff; p[1]=(v>>16)&0xff; p[2]=(v>>8)&0xff; p[3]=v&0xff;
+  return p+4;
+}
+
+static unsigned char *put_be16(unsigned char *p, unsigned int v)
+{
+  p[0]=(v>>8)&0xff; p[1]=v&0xff;
+  return p+2;
+}
+
+static unsigned char *put_le32(unsigned char *p, unsigned long v)
+{
+  p[0]=v&0xff; p[1]=(v>>8)&0xff; p[2]=(v>>16)&0xff; p[3]=(v>>24)&0xff;
+  return p+4;
+}
+
+static unsigned char *put_le16(unsigned char *p, unsigned int v)
+{
+  p[0]=v&0xff; p[1]=(v>>8)&0xff;
+  return p+2;
+}
+
+static unsigned char *put_id(unsigned char *p, const char *id)
+{
+  memcpy(p,id,4);
+  return p+4;
+}
+
+
+/* swap bytes of 16bit samples (CD-DA is little endian, AIFF big endian),
+   two samples are swapped at a time using 32bit words. 'buf' must be
+   aligned for 32bit access */
+void swab16(unsigned char *buf, long len)
+{
+  uint32 *w = (uint32*)buf, x;
+  long i, n = len/4;
+  unsigned char t;
+
+  for (i=0;i<n;i++) {
+    x=w[i];
+    w[i]=((x&0x00ff00ffUL)<<8) | ((x>>8)&0x00ff00ffUL);
+  }
+  if (len&2) {
+    t=buf[n*4]; buf[n*4]=buf[n*4+1]; buf[n*4+1]=t;
+  }
+}
+
+
+const char *audio_format_name(int format)
+{
+  switch (format) {
+  case AF_FILE_AIFF:  return "AIFF";
+  case AF_FILE_AIFFC: return "AIFF-C";
+  case AF_FILE_WAVE:  return "WAV";
+  }
+  return "unknown";
+}
+
+
+/* write sound file header for 'frames' sample frames, returns 0 if ok */
+static int audio_write_header(audio_file_type *af)
+{
+  unsigned char h[128], *p = h;
+  unsigned long datalen = af->frames*4;
+
+  switch (af->format) {
+  case AF_FILE_WAVE:
+    p=put_id(p,"RIFF"); p=put_le32(p,36+datalen); p=put_id(p,"WAVE");
+    p=put_id(p,"fmt "); p=put_le32(p,16);
+    p=put_le16(p,1);                /* PCM */
+    p=put_le16(p,2);                /* channels */
+    p=put_le32(p,44100);            /* sample rate */
+    p=put_le32(p,44100*4);          /* bytes per second */
+    p=put_le16(p,4);                /* block align */
+    p=put_le16(p,16);               /* bits per sample */
+    p=put_id(p,"data"); p=put_le32(p,datalen);
+    break;
+
+  case AF_FILE_AIFF:
+    p=put_id(p,"FORM"); p=put_be32(p,46+datalen); p=put_id(p,"AIFF");
+    p=put_id(p,"COMM"); p=put_be32(p,18);
+    p=put_be16(p,2); p=put_be32(p,af->frames); p=put_be16(p,16);
+    memcpy(p,aiff_rate,10); p+=10;
+    p=put_id(p,"SSND"); p=put_be32(p,8+datalen);
+    p=put_be32(p,0); p=put_be32(p,0);
+    break;
+
+  case AF_FILE_AIFFC:
+    p=put_id(p,"FORM"); p=put_be32(p,78+datalen); p=put_id(p,"AIFC");
+    p=put_id(p,"FVER"); p=put_be32(p,4); p=put_be32(p,0xa2805140UL);
+    p=put_id(p,"COMM"); p=put_be32(p,38);
+    p=put_be16(p,2); p=put_be32(p,af->frames); p=put_be16(p,16);
+    memcpy(p,aiff_rate,10); p+=10;
+    p=put_id(p,"NONE");
+    *p++=14; memcpy(p,"not compressed",14); p+=14; *p++=0;
+    p=put_id(p,"SSND"); p=put_be32(p,8+datalen);
+    p=put_be32(p,0); p=put_be32(p,0);
+    break;
+
+  default:
+    return -1;
+  }
+
+  if (fwrite(h,p-h,1,af->f)!=1) return -1;
+  return 0;
+}
+
+
+audio_file_type *audio_open(const char *name, int format)
+{
+  audio_file_type *af;
+
+  af=(audio_file_type*)malloc(sizeof(audio_file_type));
+  if (!af) return NULL;
+  af->format=format;
+  af->frames=0;
+  if (!(af->f=fopen(name,"w"))) {
+    free(af);
+    return NULL;
+  }
+  if (audio_write_header(af)) {
+    fclose(af->f);
+    free(af);
+    return NULL;
+  }
+  return af;
+}
+
+/* write 'len' bytes of CD-DA data to the sound file,
+   (data in 'buf' is byte swapped in place if needed) */
+int audio_write(audio_file_type *af, unsigned char *buf, long len)
+{
+  if (af->format != AF_FILE_WAVE) swab16(buf,len);
+  if (len>0 && fwrite(buf,len,1,af->f)!=1) return -1;
+  af->frames+=len/4;
+  return 0;
+}
+
+/* update sizes in the header and close the file */
+int audio_close(audio_file_type *af)
+{
+  int r = 0;
+
+  if (!af) return 0;
+  if (fseek(af->f,0,SEEK_SET)==0) r=audio_write_header(af);
+  if (fclose(af->f)) r=-1;
+  free(af);
+  return r;
+}
+
+
+/* read blocks one by one after a failed read, unreadable blocks
+   are filled with zeros (silence) */
+static int read_audio_retry(int lba, int n, unsigned char *buf)
+{
+  int i, len, bad = 0;
+
+  for (i=0;i<n;i++) {
+    len=RAWBLOCKSIZE;
+    if (read_cd(lba+i,1,READCD_USERDATA,READCD_SUB_NONE,
+		buf+i*RAWBLOCKSIZE,&len) || len<RAWBLOCKSIZE) {
+      memset(buf+i*RAWBLOCKSIZE,0,RAWBLOCKSIZE);
+      bad++;
+    }
+  }
+  return bad;
+}
+
+/* error counters of C2 mode */
+static int c2_sectors, q_errors, c2_fixed, c2_unfixed;
+
+/* number of C2 error bits and bad Q CRC in a block read with C2 
+   pointers and raw subchannel data */
+static int sector_errors(unsigned char *s, int *qbad)
+{
+  unsigned char q[12], *c2 = s+RAWBLOCKSIZE, b;
+  int i, errors = 0;
+
+  for (i=0;i<C2BLOCKSIZE;i++)
+    for (b=c2[i]; b; b&=b-1) errors++;
+  subq_from_raw(s+RAWBLOCKSIZE+C2BLOCKSIZE,q);
+  *qbad=(subq_check(q) != 0);
+  return errors+*qbad;
+}
+
+/* read blocks with C2 error pointers and subchannel data, blocks with
+   C2 errors or bad Q CRC are re-read (up to C2_RETRIES times). audio
+   data is returned packed (2352 bytes per block) */
+static int read_audio_c2(int lba, int n, unsigned char *buf)
+{
+  int bsize = RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE;
+  unsigned char tmp[RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE];
+  unsigned char failed[RAWREADBLOCKS];
+  int i, t, len, qbad, best, e, bad = 0;
+
+  memset(failed,0,sizeof(failed));
+  len=n*bsize;
+  if (read_cd(lba,n,READCD_USERDATA|READCD_C2,READCD_SUB_RAW,buf,&len) ||
+      len<n*bsize) {
+    for (i=0;i<n;i++) {
+      len=bsize;
+      if (read_cd(lba+i,1,READCD_USERDATA|READCD_C2,READCD_SUB_RAW,
+		  buf+i*bsize,&len) || len<bsize) {
+	memset(buf+i*bsize,0,bsize);
+	failed[i]=1;
+	bad++;
+      }
+    }
+  }
+
+  for (i=0;i<n;i++) {
+    if (failed[i] || !(best=sector_errors(buf+i*bsize,&qbad))) continue;
+    if (best > qbad) c2_sectors++;
+    if (qbad) q_errors++;
+
+    for (t=0; t<C2_RETRIES && best>0; t++) {
+      len=bsize;
+      if (read_cd(lba+i,1,READCD_USERDATA|READCD_C2,READCD_SUB_RAW,
+		  tmp,&len) || len<bsize) continue;
+      if ((e=sector_errors(tmp,&qbad)) < best) {
+	memcpy(buf+i*bsize,tmp,bsize);
+	best=e;
+      }
+    }
+    if (best > 0) c2_unfixed++;
+    else c2_fixed++;
+  }
+
+  for (i=1;i<n;i++) memmove(buf+i*RAWBLOCKSIZE,buf+i*bsize,RAWBLOCKSIZE);
+  return bad;
+}
+
+static int read_audio(int lba, int n, unsigned char *buf, int flags)
+{
+  int len = n*RAWBLOCKSIZE;
+
+  if (flags&AUDIO_C2) return read_audio_c2(lba,n,buf);
+  if (read_cd(lba,n,READCD_USERDATA,READCD_SUB_NONE,buf,&len) ||
+      len<n*RAWBLOCKSIZE)
+    return read_audio_retry(lba,n,buf);
+  return 0;
+}
+
+
+/* find 'key' (last JITTER_KEY samples written) from 'buf' near its
+   expected offset 'off'. offsets closest to the expected one are tried
+   first, samples are compared as 32bit words (one stereo sample) and
+   only candidates with matching first sample are compared completely.
+   returns 0 and sets *shift (in bytes) if found */
+static int jitter_align(unsigned char *buf, int len, unsigned char *key,
+			int off, int *shift)
+{
+  uint32 first, *w;
+  int i, d, o;
+
+  memcpy(&first,key,4);
+  for (i=0;i<=2*JITTER_MAX;i++) {
+    d=((i&1) ? -((i+1)/2) : i/2)*4;
+    o=off+d;
+    if (o < 0 || o+JITTER_KEY*4 > len) continue;
+    w=(uint32*)(buf+o);
+    if (*w==first && !memcmp(buf+o,key,JITTER_KEY*4)) {
+      *shift=d;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/* write checksums of a track to '<basename>.csv' */
+static void write_crc_csv(const char *name, int track, int start, int count,
+			  audio_crc_type *crc)
+{
+  char *base, *csvname;
+  FILE *f;
+
+  base=track_basename(name);
+  if (!(csvname=(char*)malloc(strlen(base)+8))) die("No memory");
+  sprintf(csvname,"%s.csv",base);
+  if (!(f=fopen(csvname,"w"))) die("cannot open file '%s'",csvname);
+  audio_crc_csv_header(f);
+  audio_crc_csv_line(f,track,start,count,crc);
+  fclose(f);
+  fprintf(stderr,"Checksums written to: %s\n",csvname);
+  free(csvname);
+  free(base);
+}
+
+
+/* read audio track (blocks 'start'...'start+count-1') into sound file
+   'name' (if name is NULL only MD5 of the audio data is calculated).
+   with AUDIO_JITTER each read overlaps the previous one by
+   JITTER_OVERLAP blocks, and the new data is aligned to the data
+   already written. with AUDIO_C2 blocks with C2 errors or bad
+   subchannel Q CRC are re-read. returns number of unreadable blocks */
+int rip_audio_track(int track, int start, int count, const char *name,
+		    int format, int md5_mode, int flags)
+{
+  audio_file_type *af = NULL;
+  audio_crc_type crc;
+  unsigned char *buffer, key[JITTER_KEY*4];
+  char digest[16], digest_text[33];
+  MD5_CTX md5;
+  int lba, n, off, shift, try, bad = 0, unaligned = 0;
+  long pos = 0, total, len;
+  int start_time, cur_time, kbps;
+
+  buffer=(unsigned char*)malloc(RAWREADBLOCKS*
+				(RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE));
+  if (!buffer) die("No memory");
+
+  if (flags&AUDIO_C2) {
+    n=RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE;
+    if (read_cd(start,1,READCD_USERDATA|READCD_C2,READCD_SUB_RAW,
+		buffer,&n) || n<RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE) {
+      warn("drive cannot return C2 error pointers, C2 checking disabled.");
+      flags&=~AUDIO_C2;
+    }
+    c2_sectors=q_errors=c2_fixed=c2_unfixed=0;
+  }
+
+  if (name && !(af=audio_open(name,format)))
+    die("cannot open output file '%s'",name);
+
+  total=(long)count*RAWBLOCKSIZE;
+  fprintf(stderr,"Reading audio track (%ldMb)...\n",total/(1024*1024));
+  if (md5_mode) MD5Init(&md5);
+  if (flags&AUDIO_ACCURATERIP)
+    audio_crc_init(&crc,total/4,flags&AUDIO_FIRST,flags&AUDIO_LAST);
+  start_time=(int)time(NULL);
+
+  while (pos < total) {
+    if (!(flags&AUDIO_JITTER) || pos==0) {
+      lba=start+pos/RAWBLOCKSIZE;
+      n=(start+count-lba > RAWREADBLOCKS ? RAWREADBLOCKS : start+count-lba);
+      bad+=read_audio(lba,n,buffer,flags);
+      off=0;
+      len=(long)n*RAWBLOCKSIZE;
+    } else {
+      /* overlapping read, align new data to the end of previous data */
+      lba=start+pos/RAWBLOCKSIZE-JITTER_OVERLAP;
+      if (lba < start) lba=start;
+      n=RAWREADBLOCKS;
+      if (lba+n > start+count) n=start+count-lba;
+      off=pos-(long)(lba-start)*RAWBLOCKSIZE-JITTER_KEY*4;
+      for (try=0; ; try++) {
+	bad+=read_audio(lba,n,buffer,flags);
+	if (jitter_align(buffer,n*RAWBLOCKSIZE,key,off,&shift)==0) break;
+	if (try >= JITTER_RETRIES) {
+	  unaligned++;
+	  shift=0;
+	  break;
+	}
+      }
+      off+=shift+JITTER_KEY*4;
+      len=(long)n*RAWBLOCKSIZE-off;
+      if (len <= 0) break;  /* no new data (at end of track) */
+    }
+    if (len > total-pos) len=total-pos;
+
+    /* remember end of data for aligning next read */
+    if (len >= JITTER_KEY*4) {
+      memcpy(key,buffer+off+len-JITTER_KEY*4,JITTER_KEY*4);
+    } else {
+      memmove(key,key+len,JITTER_KEY*4-len);
+      memcpy(key+JITTER_KEY*4-len,buffer+off,len);
+    }
+
+    if (md5_mode) MD5Update(&md5,buffer+off,len);
+    if (flags&AUDIO_ACCURATERIP) audio_crc_update(&crc,buffer+off,len);
+    if (af && audio_write(af,buffer+off,len))
+      die("error writing to file '%s'",name);
+
+    if ((pos/RAWBLOCKSIZE)/512 != ((pos+len)/RAWBLOCKSIZE)/512) {
+      cur_time=(int)time(NULL);
+      kbps=((cur_time-start_time)>0 ?
+	    ((pos+len)/1024)/(cur_time-start_time) : 0);
+      fprintf(stderr,"%3ldM of %dM read. (%d kb/s)         \r",
+	      (pos+len)/RAWBLOCKSIZE/512,count/512,kbps);
+    }
+    pos+=len;
+  }
+  fprintf(stderr,"\n");
+
+  if (pos < total) {
+    /* drive returned data too early at the end of track, pad
+       missing samples with silence */
+    len=total-pos;
+    memset(buffer,0,len);
+    if (md5_mode) MD5Update(&md5,buffer,len);
+    if (flags&AUDIO_ACCURATERIP) audio_crc_update(&crc,buffer,len);
+    if (af && audio_write(af,buffer,len))
+      die("error writing to file '%s'",name);
+    fprintf(stderr,"%ld sample(s) missing at end of track.\n",len/4);
+  }
+
+  if (audio_close(af)) die("error writing to file '%s'",name);
+  if (bad > 0)
+    fprintf(stderr,"%d unreadable block(s) (filled with silence).\n",bad);
+  if (unaligned > 0)
+    fprintf(stderr,"%d read(s) could not be aligned (jitter).\n",unaligned);
+  if (flags&AUDIO_C2) {
+    fprintf(stderr,"C2 errors in %d block(s), Q CRC errors in %d block(s).\n",
+	    c2_sectors,q_errors);
+    if (c2_fixed+c2_unfixed > 0)
+      fprintf(stderr,"%d block(s) fixed by re-reading, %d block(s) still "
+	      "with errors.\n",c2_fixed,c2_unfixed);
+  }
+
+  if (md5_mode) {
+    MD5Final((unsigned char*)digest,&md5);
+    md2str((unsigned char*)digest,digest_text);
+    fprintf(stderr,"MD5 (audio data) = %s\n",digest_text);
+  }
+
+  if (flags&AUDIO_ACCURATERIP) {
+    audio_crc_print(track,&crc);
+    if (name) write_crc_csv(name,track,start,count,&crc);
+  }
+
+  free(buffer);
+  return bad+unaligned;
+}
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# $Id$
+#
+# bench.sh -- benchmarks of readiso against a simulated drive (make bench)
+#
+# usage: bench.sh <readiso-bench> [scenario ...]
+#
+# Scenarios (all by default):
+#   cd650      650 MB CD image, 48x drive
+#   dvd47      4.7 GB DVD image, 16x drive
+#   scratched  700 MB CD with unreadable areas (dumped, errors zero filled)
+#   dumps      2000 small ranges scattered over a DVD (--dump=@file)
+#   multi4     four 650 MB CDs read at once (-o), drives queue only 2
+#              commands so that the event loop has to wait for them
+#
+# Drive times are scaled with BENCH_TIME (default 0.01, drive 100 times
+# faster than the real one), so the results mostly measure the host side.
+# Images go to BENCH_OUT (default /dev/null, BENCH_OUT.N with several
+# drives).
+#
+
+BENCH=${1:-./readiso-bench}
+[ $# -gt 0 ] && shift
+SCENARIOS=${*:-"cd650 dvd47 scratched dumps multi4"}
+TIME=${BENCH_TIME:-0.01}
+OUT=${BENCH_OUT:-/dev/null}
+TMP=${TMPDIR:-/tmp}/readiso-bench.$$
+FAILED=0
+
+CD="media=cd,speed=7.2,seek=80,overhead=0.3,time=$TIME"
+DVD="media=dvd,speed=22,seek=100,overhead=0.3,time=$TIME"
+
+if [ ! -x "$BENCH" ]; then
+  echo "bench.sh: $BENCH not found" >&2
+  exit 1
+fi
+mkdir -p $TMP || exit 1
+trap 'rm -rf $TMP' 0 1 2 15
+
+# image names of several drives (-o) must differ, so /dev/null is linked
+if [ "$OUT" = /dev/null ]; then
+  for i in 0 1 2 3; do ln -s /dev/null $TMP/null.$i; done
+  MULTI=$TMP/null.%d
+else
+  MULTI=$OUT.%d
+fi
+
+awk 'BEGIN { srand(1); for (i=0;i<2000;i++) printf "%d,16\n", 18+int(rand()*2295000) }' > $TMP/ranges
+
+printf "%-10s %9s %8s %8s %8s %9s %9s\n" \
+  scenario MB seconds MB/s "cpu s" "cpu s/GB" "rss kB"
+
+for s in $SCENARIOS; do
+  case $s in
+    cd650)
+      set -- -d "sim:blocks=332800,$CD" -m $OUT ;;
+    dvd47)
+      set -- -d "sim:blocks=2295104,$DVD" -m $OUT ;;
+    scratched)
+      set -- -d "sim:blocks=358400,$CD,retry=500,bad=50000-50063/120000-120015/200000-200255/300000-300003" \
+	--dump=0,358400 $OUT ;;
+    dumps)
+      set -- -d "sim:blocks=2295104,$DVD" --dump=@$TMP/ranges $OUT ;;
+    multi4)
+      set -- -d "sim:blocks=332800,$CD,queue=2" -d "sim:blocks=332800,$CD,queue=2" \
+	-d "sim:blocks=332800,$CD,queue=2" -d "sim:blocks=332800,$CD,queue=2" \
+	-o $MULTI ;;
+    *)
+      echo "bench.sh: unknown scenario '$s'" >&2
+      FAILED=1
+      continue ;;
+  esac
+
+  # drive profiles (~/.readiso-drives) are neither used nor written
+  if ! $BENCH --no-profiles "$@" > $TMP/out 2>&1; then
+    echo "$s: FAILED"
+    cat $TMP/out
+    FAILED=1
+    continue
+  fi
+  # bench: <bytes> bytes in <s> s, <MB/s> MB/s, cpu <s> s (<s/GB> s/GB),
+  # peak rss <kB> kB, ...
+  sed -n 's/[(,]//g; s/^bench: //p' $TMP/out | \
+    awk -v s=$s '{ printf "%-10s %9.1f %8s %8s %8s %9s %9s\n",
+		   s, $1/1048576, $4, $6, $9, $11, $15 }'
+done
+
+exit $FAILED
@@ -0,0 +1,131 @@
+/* blockmap.c -- sorted lists of block ranges
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+block_map_type *blockmap_new()
+{
+  block_map_type *map;
+
+  map=(block_map_type*)malloc(sizeof(block_map_type));
+  if (!map) return NULL;
+  memset(map,0,sizeof(block_map_type));
+  return map;
+}
+
+void blockmap_free(block_map_type *map)
+{
+  if (!map) return;
+  free(map->ranges);
+  free(map);
+}
+
+
+/* add range of blocks to the map (ranges may overlap and be added in
+   any order, blockmap_normalize() sorts and merges them) */
+int blockmap_add(block_map_type *map, int start, int count)
+{
+  block_range_type *r;
+
+  if (count<=0) return 0;
+  if (map->count >= map->alloc) {
+    int n = (map->alloc ? map->alloc*2 : 64);
+    r=(block_range_type*)realloc(map->ranges,n*sizeof(block_range_type));
+    if (!r) return -1;
+    map->ranges=r;
+    map->alloc=n;
+  }
+
+  /* merge with previous range right away if possible */
+  if (map->count > 0) {
+    r=&map->ranges[map->count-1];
+    if (start >= r->start && start <= r->start+r->count) {
+      if (start+count > r->start+r->count) r->count=start+count-r->start;
+      return 0;
+    }
+  }
+
+  r=&map->ranges[map->count++];
+  r->start=start;
+  r->count=count;
+  map->sorted=0;
+  return 0;
+}
+
+
+static int range_cmp(const void *a, const void *b)
+{
+  const block_range_type *x = (const block_range_type*)a;
+  const block_range_type *y = (const block_range_type*)b;
+
+  if (x->start != y->start) return (x->start < y->start ? -1 : 1);
+  return (x->count < y->count ? -1 : (x->count > y->count));
+}
+
+/* sort ranges and merge ranges closer than 'gap' blocks to each other */
+void blockmap_normalize(block_map_type *map, int gap)
+{
+  int i,j;
+
+  if (map->count < 1) return;
+  qsort(map->ranges,map->count,sizeof(block_range_type),range_cmp);
+
+  for (i=0,j=1; j<map->count; j++) {
+    block_range_type *r = &map->ranges[i];
+    block_range_type *n = &map->ranges[j];
+
+    if (n->start <= r->start+r->count+gap) {
+      if (n->start+n->count > r->start+r->count)
+	r->count=n->start+n->count-r->start;
+    } else {
+      map->ranges[++i]=*n;
+    }
+  }
+  map->count=i+1;
+  map->sorted=1;
+}
+
+
+/* returns first block >= 'block' that is in the map, or -1 if none.
+   map must be normalized */
+int blockmap_next(block_map_type *map, int block)
+{
+  int lo = 0, hi = map->count-1, mid;
+
+  /* binary search for last range starting at or before block */
+  while (lo <= hi) {
+    mid=(lo+hi)/2;
+    if (map->ranges[mid].start <= block) lo=mid+1;
+    else hi=mid-1;
+  }
+  if (hi >= 0 && block < map->ranges[hi].start+map->ranges[hi].count)
+    return block;
+  if (hi+1 < map->count) return map->ranges[hi+1].start;
+  return -1;
+}
+
+/* returns number of blocks in the map */
+long blockmap_blocks(block_map_type *map)
+{
+  long total = 0;
+  int i;
+
+  for (i=0;i<map->count;i++) total+=map->ranges[i].count;
+  return total;
+}
@@ -0,0 +1,211 @@
+/* cache.c -- LRU cache of data blocks read with READ(10)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Blocks are kept in a fixed number of slots, which are found with a
+ * hash table and recycled in least recently used order. When reads
+ * follow each other sequentially, misses are read with read-ahead
+ * (up to MAXREADBLOCKS blocks at a time) so that the following reads
+ * are served from the cache. Only 2048 byte data blocks are cached,
+ * the cache is flushed when the drive block size is changed.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+typedef struct cache_entry_type_ {
+  int lba;              /* block in the slot (-1 = unused) */
+  int hnext;            /* next slot in the hash chain */
+  int prev, next;       /* LRU list (head is the most recently used) */
+} cache_entry_type;
+
+static cache_entry_type *cache_ent = NULL;
+static unsigned char *cache_data = NULL;
+static int *cache_hash = NULL;
+static int cache_slots = 0, cache_hmask = 0;
+static int cache_head = -1, cache_tail = -1;
+static int cache_bsize = 0;
+static int cache_last = -1;     /* block after the previous read */
+static int cache_seq = 0;       /* number of sequential reads in a row */
+static long cache_hits = 0, cache_misses = 0, cache_ahead = 0;
+
+#define HASH(lba) ((unsigned)(lba)*2654435761UL & cache_hmask)
+
+
+static void lru_unlink(int i)
+{
+  cache_entry_type *e = &cache_ent[i];
+
+  if (e->prev >= 0) cache_ent[e->prev].next=e->next;
+  else cache_head=e->next;
+  if (e->next >= 0) cache_ent[e->next].prev=e->prev;
+  else cache_tail=e->prev;
+}
+
+static void lru_push(int i)
+{
+  cache_entry_type *e = &cache_ent[i];
+
+  e->prev=-1;
+  e->next=cache_head;
+  if (cache_head >= 0) cache_ent[cache_head].prev=i;
+  cache_head=i;
+  if (cache_tail < 0) cache_tail=i;
+}
+
+static void hash_remove(int i)
+{
+  int *p = &cache_hash[HASH(cache_ent[i].lba)];
+
+  while (*p >= 0 && *p != i) p=&cache_ent[*p].hnext;
+  if (*p == i) *p=cache_ent[i].hnext;
+}
+
+static int cache_lookup(int lba)
+{
+  int i = cache_hash[HASH(lba)];
+
+  while (i >= 0 && cache_ent[i].lba != lba) i=cache_ent[i].hnext;
+  return i;
+}
+
+/* store a block in the cache (replacing the least recently used one) */
+static void cache_store(int lba, unsigned char *data)
+{
+  int i, h;
+
+  if ((i=cache_lookup(lba)) < 0) {
+    i=cache_tail;
+    if (cache_ent[i].lba >= 0) hash_remove(i);
+    h=HASH(lba);
+    cache_ent[i].lba=lba;
+    cache_ent[i].hnext=cache_hash[h];
+    cache_hash[h]=i;
+  }
+  lru_unlink(i);
+  lru_push(i);
+  memcpy(cache_data+(long)i*BLOCKSIZE,data,BLOCKSIZE);
+}
+
+
+/* allocate cache of 'mb' megabytes, returns 0 if successful */
+int cache_init(int mb)
+{
+  int h;
+
+  cache_slots=mb*(1024*1024/BLOCKSIZE);
+  if (cache_slots < 1) return -1;
+  for (h=1; h < cache_slots*2; h<<=1);
+  cache_hmask=h-1;
+
+  cache_ent=(cache_entry_type*)malloc(cache_slots*sizeof(cache_entry_type));
+  cache_data=(unsigned char*)malloc((long)cache_slots*BLOCKSIZE);
+  cache_hash=(int*)malloc(h*sizeof(int));
+  if (!cache_ent || !cache_data || !cache_hash) {
+    free(cache_ent); free(cache_data); free(cache_hash);
+    cache_ent=NULL; cache_data=NULL; cache_hash=NULL;
+    cache_slots=0;
+    return -1;
+  }
+  cache_flush();
+  return 0;
+}
+
+/* forget all cached blocks */
+void cache_flush()
+{
+  int i;
+
+  if (!cache_slots) return;
+  for (i=0;i<=cache_hmask;i++) cache_hash[i]=-1;
+  cache_head=cache_tail=-1;
+  for (i=0;i<cache_slots;i++) {
+    cache_ent[i].lba=-1;
+    cache_ent[i].hnext=-1;
+    lru_push(i);
+  }
+  cache_last=-1;
+  cache_seq=0;
+}
+
+/* tell the cache current block size of the drive */
+void cache_set_block_size(int bsize)
+{
+  if (bsize != cache_bsize) cache_flush();
+  cache_bsize=bsize;
+}
+
+/* returns 1 if reads of 'bytes' bytes can go through the cache */
+int cache_active(int bytes)
+{
+  return (cache_slots > 0 && cache_bsize == BLOCKSIZE && bytes >= BLOCKSIZE);
+}
+
+
+/* read 'len' blocks (like read_10()) using the cache */
+int cache_read(int lba, int len, unsigned char *buf, int *buflen)
+{
+  static unsigned char ahead[MAXREADBLOCKS*BLOCKSIZE];
+  int i, n, got, result, max = (buflen ? *buflen : 0);
+
+  if (len*BLOCKSIZE > max) len=max/BLOCKSIZE;
+
+  /* all blocks in the cache? */
+  for (i=0;i<len;i++) if (cache_lookup(lba+i) < 0) break;
+  cache_seq=(lba == cache_last ? cache_seq+1 : 0);
+  cache_last=lba+len;
+
+  if (i >= len) {
+    for (i=0;i<len;i++) {
+      n=cache_lookup(lba+i);
+      memcpy(buf+i*BLOCKSIZE,cache_data+(long)n*BLOCKSIZE,BLOCKSIZE);
+      lru_unlink(n);
+      lru_push(n);
+    }
+    cache_hits+=len;
+    *buflen=len*BLOCKSIZE;
+    return 0;
+  }
+  cache_misses+=len;
+
+  /* sequential reads: read ahead (if it fails, read without it) */
+  if (cache_seq >= CACHE_SEQ_READS && len < MAXREADBLOCKS) {
+    got=MAXREADBLOCKS*BLOCKSIZE;
+    if (!read_10_drive(lba,MAXREADBLOCKS,ahead,&got,1) &&
+	got == MAXREADBLOCKS*BLOCKSIZE) {
+      for (i=0;i<MAXREADBLOCKS;i++) cache_store(lba+i,ahead+i*BLOCKSIZE);
+      memcpy(buf,ahead,len*BLOCKSIZE);
+      cache_ahead+=MAXREADBLOCKS-len;
+      *buflen=len*BLOCKSIZE;
+      return 0;
+    }
+  }
+
+  got=len*BLOCKSIZE;
+  result=read_10_drive(lba,len,buf,&got,0);
+  if (!result)
+    for (i=0;i<got/BLOCKSIZE;i++) cache_store(lba+i,buf+i*BLOCKSIZE);
+  *buflen=got;
+  return result;
+}
+
+void cache_report()
+{
+  if (!cache_slots) return;
+  fprintf(stderr,"Cache: %d blocks, %ld hits, %ld misses, %ld blocks read "
+	  "ahead.\n",cache_slots,cache_hits,cache_misses,cache_ahead);
+}
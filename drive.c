@@ -0,0 +1,445 @@
+/* drive.c -- scsi (MMC) commands used to access the drive
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ * 
+ * This file may be copied under the terms and conditions 
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+char *md2str(unsigned char *digest, char *s)
+{
+  int i;
+  char buf[16],*r;
+
+  if (!digest) return NULL;
+  if (!s) {
+    s=(char*)malloc(33);
+    if (!s) return NULL;
+  }
+
+  r=s;
+  for (i = 0; i < 16; i++) {
+    sprintf (buf,"%02x", digest[i]);
+    *(s++)=buf[0];
+    *(s++)=buf[1];
+  }
+  *s=0;
+
+  return r;
+}
+
+
+void die(char *format, ...)
+{
+  va_list args;
+
+  fprintf(stderr, PRGNAME ": ");
+  va_start(args,format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr,"\n");
+  fflush(stderr);
+  exit(1);
+}
+
+void warn(char *format, ...)
+{
+  va_list args;
+
+  fprintf(stderr, PRGNAME ": ");
+  va_start(args,format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr,"\n");
+  fflush(stderr);
+}
+
+
+int inquiry(char *manufacturer, char *model, char *revision) {
+  int i, result;
+  unsigned char bytes[255];
+  int replylen = sizeof(bytes);
+
+  manufacturer[0]=model[0]=revision[0]=0;
+
+  result = scsi_request("inquiry",bytes,&replylen,6,0,SCSIR_READ,
+			INQUIRY, /* 0 */
+			0,0,0,255,0);
+
+  if (result) return -1;
+
+  for(i=35;i>32;i--) if(bytes[i]!=' ') break;
+  bytes[i+1]=0;
+  strncpy(revision,(const char*)&bytes[32],5);
+
+  for(i=31;i>16;i--) if(bytes[i]!=' ') break;
+  bytes[i+1]=0;
+  strncpy(model,(const char*)&bytes[16],17);
+
+  for(i=15;i>8;i--) if(bytes[i]!=' ') break;
+  bytes[i+1]=0;
+  strncpy(manufacturer,(const char*)&bytes[8],9);
+
+  return bytes[0];
+}
+
+
+int mode_sense(unsigned char *buf, int *buflen)
+{
+  int len = *buflen;
+  if (len >255) len=255;
+  return scsi_request("mode_sense(6)",buf,buflen,6,0,SCSIR_READ|SCSIR_QUIET,
+		      MODESENSE,0,0x01,0,len,0);
+}
+
+int mode_sense10(unsigned char *buf, int *buflen)
+{
+  int len = *buflen;
+  if (len >65000) len=65000;
+  return scsi_request("mode_sense(10)",buf,buflen,10,0,SCSIR_READ,
+		      MODESENSE10,0,0x01,0,0,0,0,B2(len),0);
+}
+
+int read_capacity(int *lba, int *bsize)
+{
+  unsigned char buf[256];
+  int r,len = 255;
+  if (!lba || !bsize) return -1;
+
+  
+  r = scsi_request("read_capacity",buf,&len,10,0,SCSIR_READ,
+		   READCAPACITY,0,B4(0),0,0,0x00,0);
+
+  if (r) return r;
+  *lba=V4(&buf[0]);
+  *bsize=V4(&buf[4]);
+  /* fprintf(stderr,"readcapacity: lba=%d bsize=%d\n",*lba,*bsize); */
+  return 0;
+}
+
+/* READ CAPACITY(16), for media with more blocks than READ CAPACITY
+   can report */
+int read_capacity16(int64 *lba, int *bsize)
+{
+  unsigned char buf[32];
+  int r,len = sizeof(buf);
+  if (!lba || !bsize) return -1;
+
+  r = scsi_request("read_capacity(16)",buf,&len,16,0,SCSIR_READ|SCSIR_QUIET,
+		   SERVICEIN,READCAPACITY16,B4(0),B4(0),B4(sizeof(buf)),0,0);
+
+  if (r || len < 12) return (r ? r : -1);
+  *lba=((int64)(unsigned)V4(&buf[0])<<32) | (unsigned)V4(&buf[4]);
+  *bsize=V4(&buf[8]);
+  return 0;
+}
+
+
+/* returns number of blocks on the disc (or -1), READ CAPACITY(16) is
+   used if the disc is too large for READ CAPACITY */
+int64 disc_capacity()
+{
+  int64 lba64;
+  int lba,bsize;
+
+  if (read_capacity(&lba,&bsize)) return -1;
+  if (lba != -1) return (int64)(unsigned)lba+1;
+  if (read_capacity16(&lba64,&bsize)) return -1;
+  return lba64+1;
+}
+
+
+/* GET CONFIGURATION (MMC), returns current media profile in 'profile'
+   (0 = no media or not known) */
+int get_configuration(int *profile)
+{
+  unsigned char buf[8];
+  int r,len = sizeof(buf);
+
+  *profile=0;
+  r = scsi_request("get_configuration",buf,&len,10,0,SCSIR_READ|SCSIR_QUIET,
+		   GETCONFIG,0x02,B2(0),0,0,0,B2(sizeof(buf)),0);
+  if (r || len < 8) return (r ? r : -1);
+  *profile=V2(&buf[6]);
+  return 0;
+}
+
+static struct {
+  int profile;
+  int class;
+  char *name;
+} media_profiles[] = {
+  { 0x08, MEDIA_CD,  "CD-ROM" },
+  { 0x09, MEDIA_CD,  "CD-R" },
+  { 0x0a, MEDIA_CD,  "CD-RW" },
+  { 0x10, MEDIA_DVD, "DVD-ROM" },
+  { 0x11, MEDIA_DVD, "DVD-R" },
+  { 0x12, MEDIA_DVD, "DVD-RAM" },
+  { 0x13, MEDIA_DVD, "DVD-RW (restricted overwrite)" },
+  { 0x14, MEDIA_DVD, "DVD-RW (sequential)" },
+  { 0x15, MEDIA_DVD, "DVD-R DL" },
+  { 0x16, MEDIA_DVD, "DVD-R DL (layer jump)" },
+  { 0x1a, MEDIA_DVD, "DVD+RW" },
+  { 0x1b, MEDIA_DVD, "DVD+R" },
+  { 0x2a, MEDIA_DVD, "DVD+RW DL" },
+  { 0x2b, MEDIA_DVD, "DVD+R DL" },
+  { 0x40, MEDIA_BD,  "BD-ROM" },
+  { 0x41, MEDIA_BD,  "BD-R (SRM)" },
+  { 0x42, MEDIA_BD,  "BD-R (RRM)" },
+  { 0x43, MEDIA_BD,  "BD-RE" },
+  { 0x50, MEDIA_DVD, "HD DVD-ROM" },
+  { 0x51, MEDIA_DVD, "HD DVD-R" },
+  { 0x52, MEDIA_DVD, "HD DVD-RAM" },
+  { 0, MEDIA_UNKNOWN, NULL }
+};
+
+char *media_profile_name(int profile)
+{
+  int i;
+
+  for (i=0;media_profiles[i].name;i++)
+    if (media_profiles[i].profile == profile) return media_profiles[i].name;
+  return "unknown";
+}
+
+/* returns media class (MEDIA_xxx) of media profile */
+int media_class(int profile)
+{
+  int i;
+
+  for (i=0;media_profiles[i].name;i++)
+    if (media_profiles[i].profile == profile) return media_profiles[i].class;
+  return MEDIA_UNKNOWN;
+}
+
+/* returns number of data blocks to read with one command */
+int media_read_blocks(int class)
+{
+  int n = READBLOCKS;
+
+  if (class == MEDIA_DVD && n < DVD_READBLOCKS) n=DVD_READBLOCKS;
+  if (class == MEDIA_BD && n < BD_READBLOCKS) n=BD_READBLOCKS;
+  return (n > MAXTRANSFER ? MAXTRANSFER : n);
+}
+
+
+/* returns current block size of the drive. if '*cmd' is zero, the
+   commands are tried in turn and '*cmd' is set to the one that worked
+   (BSIZE_xxx), otherwise only '*cmd' is used */
+int get_block_size_cmd(int *cmd)
+{
+  unsigned char buf[255];
+  int len,lba=0,bsize=0;
+
+  if (*cmd == 0) read_capacity(&lba,&bsize);
+
+  len=255;
+  if ((*cmd == 0 || *cmd == BSIZE_MODE_SENSE) &&
+      mode_sense(buf,&len)==0 && buf[3]>=8) {
+    *cmd=BSIZE_MODE_SENSE;
+    return V3(&buf[4+5]);
+  }
+
+  if ((*cmd == 0 || *cmd == BSIZE_MODE_SENSE10) &&
+      mode_sense10(buf,&len)==0 && V2(&buf[6])>=8) {
+    *cmd=BSIZE_MODE_SENSE10;
+    return V3(&buf[8+5]);
+  }
+
+  if ((*cmd == 0 || *cmd == BSIZE_READ_CAPACITY) &&
+      read_capacity(&lba,&bsize)==0) {
+    *cmd=BSIZE_READ_CAPACITY;
+    return bsize;
+  }
+
+  return -1;
+}
+
+int get_block_size()
+{
+  int cmd = 0;
+
+  return get_block_size_cmd(&cmd);
+}
+
+
+
+int start_stop(int start)
+{
+  return scsi_request((start?"start_unit":"stop_unit"),0,0,6,0,SCSIR_WRITE,
+		      STOPUNIT,0,0,0,(start?1:0),0);
+}
+
+
+int set_removable(int removable)
+{
+  return scsi_request("set_removable",0,0,6,0,SCSIR_WRITE,
+		      REMOVAL,0,0,0,(removable?0:1),0);
+}
+
+
+int test_ready()
+{
+  return scsi_request("test_unit_ready",0,0,6,0,SCSIR_WRITE|SCSIR_QUIET,
+		      TESTREADY,0,0,0,0,0);
+}
+
+
+int read_toc(unsigned char *buf, int *buflen, int mode)
+{
+  int result;
+  int len,i,o;
+
+
+  result=scsi_request("read_toc",buf,buflen,10,0,SCSIR_READ,
+		      READTOC,0,0,0,0,0,
+		      0,
+		      B2(*buflen),
+		      0);
+
+  if (result || !mode) return result;
+
+  len=V2(&buf[0]); 
+  printf("\nTracks: %d \t (first=%02d last=%02d)\n",
+	(buf[3]-buf[2])+1,buf[2],buf[3]);
+  
+  for (i=0;i<((len-2)/8)-1;i++) {
+    o=4+i*8; /* offset to track descriptor */
+    printf("Track %02d: %s (adr/ctrl=%02xh) begin=%06d end=%06d  "
+           "length<=%06d\n",
+	   i+1,(buf[o+1]&DATA_TRACK?"data ":"audio"),buf[o+1],V4(&buf[o+4]),
+	   V4(&buf[o+4+8]),V4(&buf[o+4+8])-V4(&buf[o+4]) );
+
+  }
+
+  return result;
+}
+
+
+static int read_12_mode = 0;
+
+/* use READ(12) instead of READ(10) (DVD and BD drives) */
+void set_read_12(int on)
+{
+  read_12_mode=on;
+}
+
+static int read_10_cmd(int lba, int len, unsigned char *buf, int *buflen, 
+		       int quiet)
+{
+  if (read_12_mode)
+    return scsi_request("read_12",buf,buflen,12,0,
+			SCSIR_READ|(quiet?SCSIR_QUIET:0),
+			READ12, 0,
+			B4(lba),
+			B4(len),
+			0, 0);
+
+  return scsi_request("read_10",buf,buflen,10,0,
+		      SCSIR_READ|(quiet?SCSIR_QUIET:0),
+		      READ10, 0,
+		      B4(lba),
+		      0,
+		      B2(len),
+		      0);
+
+}
+
+/* READ(10) directly from the drive, errors are not reported if
+   'quiet' is set */
+int read_10_drive(int lba, int len, unsigned char *buf, int *buflen, 
+		  int quiet)
+{
+  double t, end;
+  int r;
+
+  if (!timeline_active()) return read_10_cmd(lba,len,buf,buflen,quiet);
+  t=timeline_now();
+  r=read_10_cmd(lba,len,buf,buflen,quiet);
+  end=timeline_now();
+  timeline_record(lba,len,(buflen && !r ? *buflen : 0),end-t,end);
+  return r;
+}
+
+int read_10(int lba, int len, unsigned char *buf, int *buflen)
+{
+  if (buflen && cache_active(*buflen)) 
+    return cache_read(lba,len,buf,buflen);
+  return read_10_drive(lba,len,buf,buflen,0);
+}
+
+
+static int read_cd_cmd(int lba, int len, int flags, int subch, 
+		       unsigned char *buf, int *buflen)
+{
+  return scsi_request("read_cd",buf,buflen,12,0,SCSIR_READ,
+		      READCD, 0,
+		      B4(lba),
+		      B3(len),
+		      flags,
+		      subch,
+		      0);
+}
+
+/* READ CD (MMC), 'flags' selects the main channel fields returned
+   and 'subch' the subchannel data (READCD_xxx) */
+int read_cd(int lba, int len, int flags, int subch, 
+	    unsigned char *buf, int *buflen)
+{
+  double t, end;
+  int r;
+
+  if (!timeline_active())
+    return read_cd_cmd(lba,len,flags,subch,buf,buflen);
+  t=timeline_now();
+  r=read_cd_cmd(lba,len,flags,subch,buf,buflen);
+  end=timeline_now();
+  timeline_record(lba,len,(buflen && !r ? *buflen : 0),end-t,end);
+  return r;
+}
+
+/* read full (session) TOC, returns raw TOC entries (format 0010b) */
+int read_full_toc(unsigned char *buf, int *buflen)
+{
+  return scsi_request("read_full_toc",buf,buflen,10,0,SCSIR_READ|SCSIR_QUIET,
+		      READTOC,0x02,0x02,0,0,0,
+		      1,
+		      B2(*buflen),
+		      0);
+}
+
+
+int mode_select(int bsize, int density)
+{
+  int r;
+
+  r=scsi_request("mode_select",0,0,6,12,SCSIR_WRITE,
+		 MODESELECT,0x10,0,0,12,0,
+		 0,0,0,8,
+		 density,B3(0),0,B3(bsize) );
+  cache_set_block_size(r ? 0 : bsize);
+  return r;
+}
+
+/* SET CD SPEED, 'kbps' is read speed in kB/s (0xffff = maximum) */
+int set_speed(int kbps)
+{
+  return scsi_request("set_cd_speed",0,0,12,0,SCSIR_WRITE|SCSIR_QUIET,
+		      SETCDSPEED,0,
+		      B2(kbps),
+		      B2(0xffff),
+		      0,0,0,0,0,0);
+}
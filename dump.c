@@ -0,0 +1,147 @@
+/* dump.c -- dumping (copying) lists of sector ranges
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Ranges given with --dump are collected to a block map, sorted and
+ * merged, and then read in batches of DUMP_BATCH blocks through the read
+ * scheduler (which also merges ranges separated by small gaps). Data of
+ * the ranges is written to the output file in LBA order. Progress is
+ * printed at most once every DUMP_PROGRESS seconds.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* parse one "lba,n" pair, returns pointer after it (or NULL on error) */
+static const char *parse_range(const char *s, block_map_type *map)
+{
+  char *end;
+  long lba, n;
+
+  lba=strtol(s,&end,10);
+  if (end==s || lba < 0) return NULL;
+  s=end;
+  while (*s==' ' || *s=='\t') s++;
+  if (*s==',') s++;
+  n=strtol(s,&end,10);
+  if (end==s || n < 1) return NULL;
+  if (blockmap_add(map,(int)lba,(int)n)) die("No memory");
+  return end;
+}
+
+/* read ranges from a file, one "lba,n" (or "lba n") per line,
+   lines starting with '#' are ignored */
+static int dump_read_list(const char *name, block_map_type *map)
+{
+  char line[256];
+  const char *s;
+  FILE *f;
+  int lineno = 0;
+
+  if (!(f=fopen(name,"r"))) die("cannot open file '%s'",name);
+  while (fgets(line,sizeof(line),f)) {
+    lineno++;
+    for (s=line; isspace((unsigned char)*s); s++);
+    if (!*s || *s=='#') continue;
+    if (!(s=parse_range(s,map))) {
+      warn("%s: invalid range on line %d",name,lineno);
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+/* parse --dump argument: "lba,n[:lba,n...]" or "@file" */
+int dump_parse_ranges(const char *arg, block_map_type *map)
+{
+  const char *s = arg;
+
+  if (*s=='@') return dump_read_list(s+1,map);
+
+  while (*s) {
+    if (!(s=parse_range(s,map))) return -1;
+    if (*s==':') s++;
+    else if (*s) return -1;
+  }
+  return (map->count > 0 ? 0 : -1);
+}
+
+
+/* dump blocks in 'map' to 'out' ('bsize' bytes per block). if 'parse' is
+   not NULL it is called for every block read. unreadable blocks are
+   filled with zeros, returns number of unreadable blocks */
+int dump_ranges(block_map_type *map, int bsize, FILE *out,
+		void (*parse)(unsigned char *block))
+{
+  read_sched_type *sched;
+  read_request_type *req;
+  unsigned char *buffer;
+  long total, done = 0;
+  int r, i, lba, stop, n, used, bad = 0;
+  int start_time, last_time, cur_time, kbps;
+
+  blockmap_normalize(map,0);
+  total=blockmap_blocks(map);
+  fprintf(stderr,"Dumping %ld sector(s) in %d range(s)\n",total,map->count);
+
+  buffer=(unsigned char*)malloc(DUMP_BATCH*bsize);
+  if (!buffer || !(sched=sched_new(bsize))) die("No memory");
+  start_time=last_time=(int)time(NULL);
+
+  r=0;
+  lba=(map->count > 0 ? map->ranges[0].start : 0);
+  while (r < map->count) {
+    /* collect up to DUMP_BATCH blocks of ranges to one batch */
+    sched_reset(sched);
+    for (used=0; used < DUMP_BATCH && r < map->count; used+=n) {
+      stop=map->ranges[r].start+map->ranges[r].count;
+      n=(stop-lba > DUMP_BATCH-used ? DUMP_BATCH-used : stop-lba);
+      if (sched_add(sched,lba,n,buffer+used*bsize) < 0) die("No memory");
+      lba+=n;
+      if (lba >= stop && ++r < map->count) lba=map->ranges[r].start;
+    }
+
+    bad+=sched_run(sched);
+    for (i=0;i<sched->count;i++) {
+      req=&sched->reqs[i];
+      if (req->bad) warn("%d unreadable sector(s) in LBA=%d-%d",req->bad,
+			 req->lba,req->lba+req->count-1);
+    }
+    if (parse) for (i=0;i<used;i++) parse(buffer+i*bsize);
+    fwrite(buffer,bsize,used,out);
+    done+=used;
+
+    cur_time=(int)time(NULL);
+    if (cur_time-last_time >= DUMP_PROGRESS) {
+      kbps=(done*bsize/1024)/(cur_time-start_time);
+      fprintf(stderr,"%ld of %ld sectors dumped. (%d kb/s)         \r",
+	      done,total,kbps);
+      last_time=cur_time;
+    }
+  }
+
+  fprintf(stderr,"%ld of %ld sectors dumped.                      \n",
+	  done,total);
+  if (bad) fprintf(stderr,"%d unreadable sector(s) filled with zeros.\n",bad);
+  sched_free(sched);
+  free(buffer);
+  return bad;
+}
@@ -0,0 +1,316 @@
+/* edc.c -- EDC check and ECC repair of raw Mode 1 and Mode 2 Form 1 sectors
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Layout of a Mode 1 sector (ECMA-130):
+ *
+ *      0  sync (12 bytes)
+ *     12  header (4 bytes: minute, second, frame, mode)
+ *     16  user data (2048 bytes)
+ *   2064  EDC (CRC32 of bytes 0-2063)
+ *   2068  zero (8 bytes)
+ *   2076  P parity (172 bytes), RS(26,24) over 86 columns
+ *   2248  Q parity (104 bytes), RS(45,43) over 52 diagonals
+ *
+ * Mode 2 Form 1 (XA) sectors have an 8 byte subheader at 16, user data
+ * at 24 and the EDC (of bytes 16-2071) at 2072. P and Q parity are in the
+ * same place, but computed with the header set to zero. Other sectors
+ * (Mode 0, Mode 2 Form 2) have no user data protected by EDC/ECC.
+ *
+ * P and Q codewords can each correct one erroneous byte, so they are
+ * applied alternately as long as something gets corrected and the EDC
+ * does not match.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define ECC_DATA     12     /* offset of the data covered by ECC */
+#define ECC_P_OFF  2064     /* offset of P parity from ECC_DATA */
+#define ECC_Q_OFF  2236     /* offset of Q parity from ECC_DATA */
+#define ECC_PASSES   8      /* max. P/Q correction rounds */
+
+static unsigned char gf_exp[512], gf_log[256];
+static uint32 edc_table[4][256];
+static int edc_tables_ok = 0;
+
+/* statistics of read_data_ecc() */
+static int ecc_sectors, ecc_bad, ecc_repaired, ecc_reread, ecc_failed;
+static int ecc_plain;
+
+
+static void edc_init()
+{
+  uint32 c;
+  int i, j, x;
+
+  /* EDC polynomial x^32+x^31+x^16+x^15+x^4+x^3+x+1 (reversed) */
+  for (i=0;i<256;i++) {
+    c=i;
+    for (j=0;j<8;j++) c=((c&1) ? (c>>1)^0xd8018001UL : (c>>1));
+    edc_table[0][i]=c;
+  }
+  for (i=0;i<256;i++) {
+    c=edc_table[0][i];
+    for (j=1;j<4;j++) {
+      c=(c>>8)^edc_table[0][c&0xff];
+      edc_table[j][i]=c;
+    }
+  }
+
+  /* GF(2^8) with polynomial x^8+x^4+x^3+x^2+1 */
+  for (i=0,x=1;i<255;i++) {
+    gf_exp[i]=x;
+    gf_log[x]=i;
+    x<<=1;
+    if (x&0x100) x^=0x11d;
+  }
+  for (i=255;i<512;i++) gf_exp[i]=gf_exp[i-255];
+  edc_tables_ok=1;
+}
+
+
+/* EDC (CRC32) of 'len' bytes, processed four bytes at a time */
+uint32 edc_compute(const unsigned char *buf, int len)
+{
+  uint32 crc = 0;
+
+  if (!edc_tables_ok) edc_init();
+  for (; len >= 4; len-=4, buf+=4) {
+    crc^=(uint32)buf[0] | ((uint32)buf[1]<<8) | ((uint32)buf[2]<<16) |
+         ((uint32)buf[3]<<24);
+    crc=edc_table[3][crc&0xff] ^ edc_table[2][(crc>>8)&0xff] ^
+        edc_table[1][(crc>>16)&0xff] ^ edc_table[0][(crc>>24)&0xff];
+  }
+  while (len-- > 0)
+    crc=(crc>>8)^edc_table[0][(crc^*buf++)&0xff];
+  return crc;
+}
+
+/* returns offset of the user data (2048 bytes) in a raw sector: 16 for
+   Mode 1 and 24 for Mode 2 Form 1 sectors, 0 if the data of the sector
+   is not protected with EDC/ECC */
+int edc_data_offset(const unsigned char *sector)
+{
+  if (sector[15] == 1) return 16;
+  /* subheader is recorded twice, form 2 bit is in the submode byte */
+  if (sector[15] == 2 && !memcmp(sector+16,sector+20,4) &&
+      !(sector[18]&0x20)) return 24;
+  return 0;
+}
+
+/* returns 0 if EDC of a sector with user data at offset 'o' is correct */
+static int edc_check_at(const unsigned char *sector, int o)
+{
+  const unsigned char *e;
+  uint32 edc;
+
+  if (o == 16) edc=edc_compute(sector,2064);
+  else if (o == 24) edc=edc_compute(sector+16,2056);
+  else return -1;
+  e=sector+o+BLOCKSIZE;
+  return ((edc&0xff) != e[0] || ((edc>>8)&0xff) != e[1] ||
+	  ((edc>>16)&0xff) != e[2] || ((edc>>24)&0xff) != e[3]);
+}
+
+/* returns 0 if EDC of a Mode 1 or Mode 2 Form 1 sector is correct */
+int edc_check_sector(const unsigned char *sector)
+{
+  return edc_check_at(sector,edc_data_offset(sector));
+}
+
+
+/* check codeword (bytes at offsets 'pos[0..n-1]' of 'd', last two are
+   parity), returns 0 if ok, 1 if one byte was corrected and -1 if
+   there are more errors than can be corrected */
+static int ecc_fix_codeword(unsigned char *d, int *pos, int n)
+{
+  int i, s0 = 0, s1 = 0, e;
+
+  for (i=0;i<n;i++) {
+    s0^=d[pos[i]];
+    if (d[pos[i]]) s1^=gf_exp[gf_log[d[pos[i]]]+n-1-i];
+  }
+  if (!s0 && !s1) return 0;
+  if (!s0 || !s1) return -1;
+
+  e=n-1-((gf_log[s1]-gf_log[s0]+255)%255);
+  if (e < 0 || e >= n) return -1;
+  d[pos[e]]^=s0;
+  return 1;
+}
+
+/* P (pass 0) or Q (pass 1) codewords, returns number of corrected bytes
+   or -1 if there are uncorrectable codewords */
+static int ecc_fix_pass(unsigned char *d, int q)
+{
+  int pos[45], j, m, i, r, fixed = 0, failed = 0;
+
+  for (j=0; j<(q ? 52 : 86); j++) {
+    if (q) {
+      i=(j>>1)*86+(j&1);
+      for (m=0;m<43;m++) {
+	pos[m]=i;
+	if ((i+=88) >= ECC_Q_OFF) i-=ECC_Q_OFF;
+      }
+      pos[43]=ECC_Q_OFF+j;
+      pos[44]=ECC_Q_OFF+52+j;
+      r=ecc_fix_codeword(d,pos,45);
+    } else {
+      for (m=0;m<26;m++) pos[m]=j+86*m;
+      r=ecc_fix_codeword(d,pos,26);
+    }
+    if (r > 0) fixed++;
+    if (r < 0) failed++;
+  }
+  return (failed && !fixed ? -1 : fixed);
+}
+
+/* try to repair Mode 1 or Mode 2 Form 1 sector with ECC, returns 0 if
+   the sector is ok (EDC matches) afterwards */
+int ecc_repair_sector(unsigned char *sector)
+{
+  unsigned char *d = sector+ECC_DATA, header[4];
+  int i, p, q, o, result = -1;
+
+  if (!(o=edc_data_offset(sector))) return -1;
+  if (!edc_tables_ok) edc_init();
+  /* Mode 2 parity is computed with the header set to zero */
+  memcpy(header,sector+12,4);
+  if (o == 24) memset(sector+12,0,4);
+  for (i=0;i<ECC_PASSES;i++) {
+    p=ecc_fix_pass(d,0);
+    q=ecc_fix_pass(d,1);
+    if (!edc_check_at(sector,o)) {
+      result=0;
+      break;
+    }
+    if (p <= 0 && q <= 0) break;
+  }
+  if (o == 24) memcpy(sector+12,header,4);
+  return result;
+}
+
+
+/* check (and repair) a raw sector, returns 0 if user data is ok */
+static int check_sector(unsigned char *s)
+{
+  if (!edc_check_sector(s)) return 0;
+  ecc_bad++;
+  if (!ecc_repair_sector(s)) {
+    ecc_repaired++;
+    return 0;
+  }
+  return -1;
+}
+
+/* read 'n' data blocks as raw sectors, EDC is checked and sectors with
+   errors are repaired with ECC, or re-read (up to ECC_RETRIES times) if
+   they cannot be repaired. sectors without EDC/ECC are read again with
+   READ(10). user data (2048 bytes per block) is returned in 'buf',
+   '*buflen' is set to length of the data read.
+   if 'flagged' is not NULL, blocks that cannot be read or repaired are
+   not re-read but added to it (and reading continues past them) */
+int read_data_ecc(int lba, int n, unsigned char *buf, int *buflen,
+		  block_map_type *flagged)
+{
+  unsigned char raw[RAWREADBLOCKS*RAWBLOCKSIZE], *s;
+  int i, j, t, o, len, done = 0, result = 0;
+  char bad[RAWREADBLOCKS];
+
+  while (done < n) {
+    j=(n-done > RAWREADBLOCKS ? RAWREADBLOCKS : n-done);
+    len=j*RAWBLOCKSIZE;
+    memset(bad,0,sizeof(bad));
+    /* reply length is not reliable when the read failed */
+    if (read_cd(lba+done,j,READCD_RAW,READCD_SUB_NONE,raw,&len)) len=0;
+    if (len<j*RAWBLOCKSIZE) {
+      if (flagged) {
+	/* read blocks one at a time to find out which ones are bad */
+	for (i=0;i<j;i++) {
+	  len=RAWBLOCKSIZE;
+	  if (read_cd(lba+done+i,1,READCD_RAW,READCD_SUB_NONE,
+		      raw+i*RAWBLOCKSIZE,&len) || len<RAWBLOCKSIZE) {
+	    memset(raw+i*RAWBLOCKSIZE,0,RAWBLOCKSIZE);
+	    bad[i]=1;
+	  }
+	}
+      } else {
+	result=-1;
+	j=len/RAWBLOCKSIZE;
+      }
+    }
+
+    for (i=0;i<j;i++) {
+      s=raw+i*RAWBLOCKSIZE;
+      ecc_sectors++;
+      if (!bad[i] && !edc_data_offset(s)) {
+	/* nothing to check, use the data the drive returns */
+	ecc_plain++;
+	len=BLOCKSIZE;
+	if (read_10(lba+done+i,1,buf+(done+i)*BLOCKSIZE,&len) ||
+	    len<BLOCKSIZE) {
+	  memset(buf+(done+i)*BLOCKSIZE,0,BLOCKSIZE);
+	  ecc_failed++;
+	  if (flagged) blockmap_add(flagged,lba+done+i,1);
+	  else warn("cannot read block LBA=%d",lba+done+i);
+	}
+	continue;
+      }
+      if (bad[i] || check_sector(s)) {
+	if (flagged) {
+	  ecc_failed++;
+	  blockmap_add(flagged,lba+done+i,1);
+	} else {
+	  for (t=0;t<ECC_RETRIES;t++) {
+	    len=RAWBLOCKSIZE;
+	    ecc_reread++;
+	    if (read_cd(lba+done+i,1,READCD_RAW,READCD_SUB_NONE,s,&len) ||
+		len<RAWBLOCKSIZE) continue;
+	    if (!edc_check_sector(s) || !ecc_repair_sector(s)) break;
+	  }
+	  if (t >= ECC_RETRIES) {
+	    ecc_failed++;
+	    warn("uncorrectable errors in block LBA=%d",lba+done+i);
+	  }
+	}
+      }
+      o=edc_data_offset(s);
+      memcpy(buf+(done+i)*BLOCKSIZE,s+(o ? o : 16),BLOCKSIZE);
+    }
+    done+=j;
+    if (result) break;
+  }
+
+  if (buflen) *buflen=done*BLOCKSIZE;
+  return result;
+}
+
+void ecc_report()
+{
+  fprintf(stderr,"%d block(s) checked, %d with EDC errors: %d repaired with "
+	  "ECC, %d re-read(s), %d uncorrectable.\n",ecc_sectors,ecc_bad,
+	  ecc_repaired,ecc_reread,ecc_failed);
+  if (ecc_plain)
+    fprintf(stderr,"%d block(s) without EDC/ECC (Mode 0 or Mode 2 Form 2) "
+	    "read with READ(10).\n",ecc_plain);
+}
+
+int ecc_failed_blocks()
+{
+  return ecc_failed;
+}
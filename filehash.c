@@ -0,0 +1,239 @@
+/* filehash.c -- per-file digests computed while reading the image
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* The index holds every file of the image and the extents (block ranges)
+ * they occupy. Extents are sorted by block number, so while the image is
+ * read sequentially we only need to walk forward in the extent table and
+ * feed each piece of data to the digests of the file that owns it.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+file_index_type *fileindex_new()
+{
+  file_index_type *idx;
+
+  idx=(file_index_type*)malloc(sizeof(file_index_type));
+  if (!idx) return NULL;
+  memset(idx,0,sizeof(file_index_type));
+  return idx;
+}
+
+void fileindex_free(file_index_type *idx)
+{
+  int i;
+
+  if (!idx) return;
+  for (i=0;i<idx->file_count;i++) free(idx->files[i].name);
+  free(idx->files);
+  free(idx->extents);
+  free(idx);
+}
+
+
+static void file_final(file_entry_type *f)
+{
+  MD5Final(f->md5_digest,&f->md5);
+  SHA256Final(f->sha256_digest,&f->sha256);
+  f->status=FILE_COMPLETE;
+}
+
+
+/* add new file to the index, returns index to the file table (or -1) */
+int fileindex_add_file(file_index_type *idx, const char *name, int64 size)
+{
+  file_entry_type *f;
+
+  if (idx->file_count >= idx->file_alloc) {
+    int n = (idx->file_alloc ? idx->file_alloc*2 : 256);
+    f=(file_entry_type*)realloc(idx->files,n*sizeof(file_entry_type));
+    if (!f) return -1;
+    idx->files=f;
+    idx->file_alloc=n;
+  }
+
+  f=&idx->files[idx->file_count];
+  memset(f,0,sizeof(file_entry_type));
+  if (!(f->name=strdup(name))) return -1;
+  f->size=size;
+  MD5Init(&f->md5);
+  SHA256Init(&f->sha256);
+  if (size==0) file_final(f);
+
+  return idx->file_count++;
+}
+
+/* add an extent (part of file data) for a file already in the index */
+int fileindex_add_extent(file_index_type *idx, int file, int lba, int boff,
+			 int64 offset, int64 len)
+{
+  file_extent_type *e;
+
+  if (len<=0) return 0;
+  if (idx->extent_count >= idx->extent_alloc) {
+    int n = (idx->extent_alloc ? idx->extent_alloc*2 : 256);
+    e=(file_extent_type*)realloc(idx->extents,n*sizeof(file_extent_type));
+    if (!e) return -1;
+    idx->extents=e;
+    idx->extent_alloc=n;
+  }
+
+  e=&idx->extents[idx->extent_count++];
+  e->lba=lba;
+  e->boff=boff;
+  e->offset=offset;
+  e->len=len;
+  e->fed=0;
+  e->file=file;
+  return 0;
+}
+
+
+static int extent_cmp(const void *a, const void *b)
+{
+  const file_extent_type *x = (const file_extent_type*)a;
+  const file_extent_type *y = (const file_extent_type*)b;
+
+  if (x->lba != y->lba) return (x->lba < y->lba ? -1 : 1);
+  if (x->file != y->file) return (x->file < y->file ? -1 : 1);
+  return (x->offset < y->offset ? -1 : (x->offset > y->offset));
+}
+
+/* sort extents by block number, must be called before fileindex_feed() */
+void fileindex_sort(file_index_type *idx)
+{
+  if (idx->extent_count > 1)
+    qsort(idx->extents,idx->extent_count,sizeof(file_extent_type),
+	  extent_cmp);
+  idx->next=0;
+}
+
+/* clear digests of all files, so that image data can be fed again */
+void fileindex_reset(file_index_type *idx)
+{
+  file_entry_type *f;
+  int i;
+
+  for (i=0;i<idx->file_count;i++) {
+    f=&idx->files[i];
+    f->done=0;
+    f->status=FILE_PENDING;
+    MD5Init(&f->md5);
+    SHA256Init(&f->sha256);
+    if (f->size==0) file_final(f);
+  }
+  for (i=0;i<idx->extent_count;i++) idx->extents[i].fed=0;
+  idx->next=0;
+}
+
+
+/* feed 'blocks' blocks of image data, starting from image block 'block'
+   to the digests of the files that own them */
+void fileindex_feed(file_index_type *idx, int block,
+		    unsigned char *buf, int blocks)
+{
+  file_extent_type *e;
+  file_entry_type *f;
+  int64 pos, first, last, n;
+  int i;
+
+  if (!idx || blocks<1) return;
+  first=(int64)block*BLOCKSIZE;
+  last=(int64)(block+blocks)*BLOCKSIZE;
+
+  for (i=idx->next; i<idx->extent_count; i++) {
+    e=&idx->extents[i];
+    if (e->lba >= block+blocks) break;
+    if (e->fed >= e->len) continue;
+
+    f=&idx->files[e->file];
+    pos=(int64)e->lba*BLOCKSIZE+e->boff+e->fed;
+    if (pos < first || f->done != e->offset+e->fed) {
+      /* we have missed some data of this file */
+      if (f->status==FILE_PENDING) f->status=FILE_BROKEN;
+      e->fed=e->len;
+      continue;
+    }
+
+    n=e->len-e->fed;
+    if (n > last-pos) n=last-pos;
+    if (f->status==FILE_PENDING) {
+      MD5Update(&f->md5,buf+(pos-first),n);
+      SHA256Update(&f->sha256,buf+(pos-first),n);
+    }
+    e->fed+=n;
+    f->done+=n;
+    if (f->done >= f->size && f->status==FILE_PENDING) file_final(f);
+  }
+
+  while (idx->next < idx->extent_count &&
+	 idx->extents[idx->next].fed >= idx->extents[idx->next].len)
+    idx->next++;
+}
+
+
+static void digest2str(unsigned char *digest, int len, char *s)
+{
+  int i;
+
+  for (i=0;i<len;i++) sprintf(&s[i*2],"%02x",digest[i]);
+}
+
+/* write manifest of file digests (in BSD style format, which is
+   understood by md5sum/sha256sum -c), returns number of incomplete files */
+int fileindex_write(file_index_type *idx, FILE *f)
+{
+  char buf[65];
+  int i, bad = 0;
+
+  for (i=0;i<idx->file_count;i++) {
+    file_entry_type *e = &idx->files[i];
+
+    if (e->status!=FILE_COMPLETE) {
+      fprintf(f,"# incomplete: %s (%lld of %lld bytes)\n",e->name,
+	      e->done,e->size);
+      bad++;
+      continue;
+    }
+    digest2str(e->md5_digest,16,buf);
+    fprintf(f,"MD5 (%s) = %s\n",e->name,buf);
+    digest2str(e->sha256_digest,32,buf);
+    fprintf(f,"SHA256 (%s) = %s\n",e->name,buf);
+  }
+
+  return bad;
+}
+
+/* print list of files in the index */
+void fileindex_list(file_index_type *idx, FILE *f)
+{
+  int i,j,lba;
+
+  fprintf(f,"%10s %8s  %s\n","Size","LBA","Name");
+  for (i=0;i<idx->file_count;i++) {
+    for (lba=-1,j=0;j<idx->extent_count;j++)
+      if (idx->extents[j].file==i && idx->extents[j].offset==0) {
+	lba=idx->extents[j].lba;
+	break;
+      }
+    fprintf(f,"%10lld %8d  %s\n",idx->files[i].size,lba,
+	    idx->files[i].name);
+  }
+  fprintf(f,"%d file(s)\n",idx->file_count);
+}
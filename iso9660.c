@@ -0,0 +1,252 @@
+/* iso9660.c -- ISO9660 directory tree walking
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* get file name from directory record, Rock Ridge (NM) name is used
+   if present, otherwise ISO9660 name is used without version number */
+static void iso_get_name(unsigned char *dr, char *name, int namelen)
+{
+  int len = dr[ISO_DR_NAMELEN];
+  int i, o, l, found = 0;
+  unsigned char *su;
+
+  name[0]=0;
+
+  /* Rock Ridge alternate name */
+  o=ISO_DR_NAME+len+((len&1)?0:1);
+  su=dr+o;
+  while (o+4 <= dr[ISO_DR_LEN]) {
+    l=su[2];
+    if (l<4 || o+l > dr[ISO_DR_LEN]) break;
+    if (su[0]=='N' && su[1]=='M' && l>5 && !(su[4]&0x06)) {
+      i=strlen(name);
+      if (i+(l-5) >= namelen) break;
+      memcpy(name+i,su+5,l-5);
+      name[i+l-5]=0;
+      found=1;
+      if (!(su[4]&0x01)) break;  /* no CONTINUE flag */
+    }
+    o+=l;
+    su+=l;
+  }
+  if (found) return;
+
+  if (len >= namelen) len=namelen-1;
+  memcpy(name,dr+ISO_DR_NAME,len);
+  name[len]=0;
+  for (i=0;i<len;i++) if (name[i]==';') { name[i]=0; break; }
+  i=strlen(name);
+  if (i>1 && name[i-1]=='.') name[i-1]=0;
+}
+
+
+/* returns next directory record in 'buf' ('blocks' blocks) or NULL,
+   '*pos' is the offset of the next record (start with 0) */
+static unsigned char *iso_next_dr(unsigned char *buf, int blocks, int *pos)
+{
+  unsigned char *dr;
+  int i = *pos/BLOCKSIZE, o = *pos%BLOCKSIZE;
+
+  while (i < blocks) {
+    dr=buf+i*BLOCKSIZE+o;
+    if (dr[ISO_DR_LEN]==0 || o+dr[ISO_DR_LEN] > BLOCKSIZE ||
+	dr[ISO_DR_LEN] < ISO_DR_NAME+dr[ISO_DR_NAMELEN]) {
+      i++;  /* rest of the block is unused */
+      o=0;
+      continue;
+    }
+    *pos=i*BLOCKSIZE+o+dr[ISO_DR_LEN];
+    return dr;
+  }
+  return NULL;
+}
+
+/* returns 1 if 'dr' is a subdirectory of directory at 'lba' */
+static int iso_subdir(unsigned char *dr, int lba)
+{
+  /* skip '.' and '..' */
+  if (dr[ISO_DR_NAMELEN]==1 && (dr[ISO_DR_NAME]==0 || dr[ISO_DR_NAME]==1))
+    return 0;
+  return ((dr[ISO_DR_FLAGS]&ISO_FLAG_DIR) && ISONUM(&dr[ISO_DR_EXTENT])!=lba);
+}
+
+
+/* walk directory at 'lba', 'data' is the directory contents if they
+   have already been read (or NULL). contents of all subdirectories
+   are read with one scheduler batch before descending into them */
+static int iso_walk_dir(file_index_type *idx, block_map_type *used, 
+			int start, int imagesize, int lba, long size, 
+			unsigned char *data, const char *path, int depth)
+{
+  read_sched_type *sched;
+  unsigned char *buf, *dr, **sub;
+  char name[256], *fullname;
+  int blocks, i, n, r, pos, sublba, subblocks, file = -1;
+  long fsize;
+  int64 foffset = 0;
+  int multi = 0;
+  char lastname[256];
+
+  if (depth > ISO_MAX_DEPTH) {
+    warn("directory tree too deep: %s",path);
+    return -1;
+  }
+
+  blocks=(size+BLOCKSIZE-1)/BLOCKSIZE;
+  if (lba < 0 || lba+blocks > imagesize) {
+    warn("directory outside of image: %s",path);
+    return -1;
+  }
+
+  if (used) blockmap_add(used,lba,blocks);
+  buf=data;
+  if (!buf) {
+    if (!(buf=(unsigned char*)malloc(blocks*BLOCKSIZE))) die("No memory");
+    for (i=0;i<blocks;i++) {
+      n=BLOCKSIZE;
+      if (read_10(start+lba+i,1,buf+i*BLOCKSIZE,&n) || n<BLOCKSIZE) {
+	warn("cannot read directory: %s",path);
+	free(buf);
+	return -1;
+      }
+    }
+  }
+
+  /* read subdirectories (the ones that look valid) */
+  for (pos=0,n=0; (dr=iso_next_dr(buf,blocks,&pos)); )
+    if (iso_subdir(dr,lba)) n++;
+  sub=(unsigned char**)calloc(n+1,sizeof(unsigned char*));
+  fullname=(char*)malloc(strlen(path)+sizeof(name)+2);
+  if (!sub || !fullname || !(sched=sched_new(BLOCKSIZE))) die("No memory");
+
+  for (pos=0,i=0; (dr=iso_next_dr(buf,blocks,&pos)); ) {
+    if (!iso_subdir(dr,lba)) continue;
+    sublba=ISONUM(&dr[ISO_DR_EXTENT]);
+    subblocks=(ISONUM(&dr[ISO_DR_SIZE])+BLOCKSIZE-1)/BLOCKSIZE;
+    if (depth < ISO_MAX_DEPTH && subblocks > 0 && sublba >= 0 &&
+	sublba+subblocks <= imagesize) {
+      if (!(sub[i]=(unsigned char*)malloc(subblocks*BLOCKSIZE)))
+	die("No memory");
+      sched_add(sched,start+sublba,subblocks,sub[i]);
+    }
+    i++;
+  }
+  sched_run(sched);
+  for (i=0,r=0;i<n;i++) {
+    if (sub[i] && sched->reqs[r++].bad) {  /* iso_walk_dir() tries again */
+      free(sub[i]);
+      sub[i]=NULL;
+    }
+  }
+  sched_free(sched);
+
+  lastname[0]=0;
+  for (pos=0,i=0; (dr=iso_next_dr(buf,blocks,&pos)); ) {
+    /* skip '.' and '..' */
+    if (dr[ISO_DR_NAMELEN]==1 && (dr[ISO_DR_NAME]==0 || dr[ISO_DR_NAME]==1))
+      continue;
+
+    iso_get_name(dr,name,sizeof(name));
+    sprintf(fullname,"%s%s%s",path,(path[0]?"/":""),name);
+    fsize=ISONUM(&dr[ISO_DR_SIZE]);
+
+    if (dr[ISO_DR_FLAGS]&ISO_FLAG_DIR) {
+      if (iso_subdir(dr,lba)) {
+	iso_walk_dir(idx,used,start,imagesize,ISONUM(&dr[ISO_DR_EXTENT]),
+		     fsize,sub[i],fullname,depth+1);
+	free(sub[i++]);
+      }
+      multi=0;
+      continue;
+    }
+
+    if (!idx) continue;
+
+    /* continuation of a multi-extent file */
+    if (multi && !strcmp(name,lastname)) {
+      idx->files[file].size+=fsize;
+    } else {
+      file=fileindex_add_file(idx,fullname,fsize);
+      if (file<0) die("No memory");
+      foffset=0;
+    }
+    if (fileindex_add_extent(idx,file,ISONUM(&dr[ISO_DR_EXTENT]),0,
+			     foffset,fsize)) die("No memory");
+    foffset+=fsize;
+
+    multi=(dr[ISO_DR_FLAGS]&ISO_FLAG_MULTIEXT);
+    if (multi) strcpy(lastname,name);
+  }
+
+  if (!data) free(buf);
+  free(sub);
+  free(fullname);
+  return 0;
+}
+
+
+/* build index of all files on the ISO9660 image, returns number of
+   files found or -1 if the root directory cannot be read */
+int iso_build_file_index(iso_primary_descriptor_type *ipd, int start,
+			 int imagesize, file_index_type *idx)
+{
+  unsigned char *root = ipd->root_directory_record;
+
+  if (iso_walk_dir(idx,NULL,start,imagesize,ISONUM(&root[ISO_DR_EXTENT]),
+		   ISONUM(&root[ISO_DR_SIZE]),NULL,"",0)) return -1;
+  fileindex_sort(idx);
+  return idx->file_count;
+}
+
+
+/* add blocks used by ISO9660 volume descriptors, path tables and 
+   directories (of primary and supplementary descriptors) to 'used' */
+int iso_used_blocks(int start, int imagesize, block_map_type *used)
+{
+  iso_primary_descriptor_type vd;
+  unsigned char *root;
+  int i, len, ptblocks;
+
+  blockmap_add(used,0,16);  /* system area */
+
+  for (i=16;i<16+ISO_MAX_VD;i++) {
+    len=BLOCKSIZE;
+    if (read_10(start+i,1,(unsigned char*)&vd,&len) || len<BLOCKSIZE) 
+      return -1;
+    if (memcmp(vd.id,"CD001",5)) return -1;
+    blockmap_add(used,i,1);
+    if (vd.type[0]==255) return 0;  /* volume descriptor set terminator */
+    if (vd.type[0]!=1 && vd.type[0]!=2) continue;
+
+    ptblocks=(ISONUM(vd.path_table_size)+BLOCKSIZE-1)/BLOCKSIZE;
+    blockmap_add(used,ISONUM(vd.type_l_path_table),ptblocks);
+    if (ISONUM(vd.opt_type_l_path_table))
+      blockmap_add(used,ISONUM(vd.opt_type_l_path_table),ptblocks);
+    blockmap_add(used,V4(vd.type_m_path_table),ptblocks);
+    if (V4(vd.opt_type_m_path_table))
+      blockmap_add(used,V4(vd.opt_type_m_path_table),ptblocks);
+
+    root=vd.root_directory_record;
+    iso_walk_dir(NULL,used,start,imagesize,ISONUM(&root[ISO_DR_EXTENT]),
+		 ISONUM(&root[ISO_DR_SIZE]),NULL,"",0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,246 @@
+/* latency.c -- latency histograms of scsi commands (--latency)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* The backends (scsi_linux.c, scsi_irix.c) time every command when
+ * latencies are recorded, and the time is added to the histogram of
+ * the command (opcode). Histograms are log-linear: values below
+ * 2*LAT_SUB microseconds have buckets of their own, above that every
+ * power of two is divided into LAT_SUB buckets, so the error of a
+ * value is at most 1/LAT_SUB (about 6%). Histograms are allocated when
+ * a command is first seen. The time spent in commands is compared
+ * with the wall clock time, which tells if the drive or the host is
+ * slowing reading down. The report is written when the program exits
+ * (also after die()), so failed runs are reported too.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define LAT_SUB      16      /* buckets per power of two */
+#define LAT_BUCKETS  512     /* covers over an hour (in microseconds) */
+
+typedef struct latency_hist_type_ {
+  unsigned long count;
+  unsigned long errors;
+  double sum;           /* seconds */
+  double max;
+  unsigned long bucket[LAT_BUCKETS];
+} latency_hist_type;
+
+static latency_hist_type *lat_hist[256];
+static int lat_active = 0;
+static double lat_t0;
+static int lat_text = 0;
+static FILE *lat_json = NULL;
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static struct {
+  int opcode;
+  char *name;
+} lat_names[] = {
+  { TESTREADY,    "TEST UNIT READY" },
+  { INQUIRY,      "INQUIRY" },
+  { MODESELECT,   "MODE SELECT(6)" },
+  { MODESENSE,    "MODE SENSE(6)" },
+  { STOPUNIT,     "START STOP UNIT" },
+  { REMOVAL,      "PREVENT ALLOW REMOVAL" },
+  { READCAPACITY, "READ CAPACITY" },
+  { READ10,       "READ(10)" },
+  { READTOC,      "READ TOC" },
+  { GETCONFIG,    "GET CONFIGURATION" },
+  { MODESELECT10, "MODE SELECT(10)" },
+  { MODESENSE10,  "MODE SENSE(10)" },
+  { SERVICEIN,    "READ CAPACITY(16)" },
+  { READ12,       "READ(12)" },
+  { SETCDSPEED,   "SET CD SPEED" },
+  { READCD,       "READ CD" },
+  { -1, NULL }
+};
+
+
+static const char *lat_name(int opcode)
+{
+  static char buf[8];
+  int i;
+
+  for (i=0;lat_names[i].name;i++)
+    if (lat_names[i].opcode == opcode) return lat_names[i].name;
+  sprintf(buf,"0x%02x",opcode);
+  return buf;
+}
+
+static int lat_bucket(unsigned long us)
+{
+  int e = 0;
+
+  while (us >= 2*LAT_SUB) {
+    us>>=1;
+    e++;
+  }
+  e=e*LAT_SUB+(int)us;
+  return (e < LAT_BUCKETS ? e : LAT_BUCKETS-1);
+}
+
+/* returns highest value (microseconds) of bucket 'b' */
+static double lat_bucket_max(int b)
+{
+  int e;
+
+  if (b < 2*LAT_SUB) return b;
+  e=b/LAT_SUB-1;
+  return (double)((unsigned long)(b-e*LAT_SUB+1)<<e)-1;
+}
+
+
+static void latency_exit()
+{
+  fflush(stdout);
+  if (lat_text) latency_report(stderr);
+  if (lat_json) {
+    latency_report_json(lat_json);
+    fclose(lat_json);
+    lat_json=NULL;
+  }
+}
+
+/* start recording latencies, at exit a report is printed to stderr
+   if 'text' is set and written to file 'json_name' (if not NULL) */
+int latency_enable(int text, const char *json_name)
+{
+  if (json_name && !(lat_json=fopen(json_name,"w"))) return -1;
+  lat_text=text;
+  if (!lat_active) atexit(latency_exit);
+  lat_active=1;
+  lat_t0=timeline_now();
+  return 0;
+}
+
+int latency_active()
+{
+  return lat_active;
+}
+
+/* returns start time of a command (0 if latencies are not recorded) */
+double latency_start()
+{
+  return (lat_active ? timeline_now() : 0);
+}
+
+/* record command 'opcode' started at 'start' (see latency_start()) */
+void latency_record(int opcode, double start, int failed)
+{
+  latency_hist_type *h;
+  double t;
+
+  if (!lat_active) return;
+  t=timeline_now()-start;
+  if (t < 0) t=0;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&lat_lock);
+#endif
+  if (!(h=lat_hist[opcode&0xff])) {
+    h=(latency_hist_type*)malloc(sizeof(latency_hist_type));
+    if (h) memset(h,0,sizeof(latency_hist_type));
+    lat_hist[opcode&0xff]=h;
+  }
+  if (h) {
+    h->count++;
+    if (failed) h->errors++;
+    h->sum+=t;
+    if (t > h->max) h->max=t;
+    h->bucket[lat_bucket((unsigned long)(t*1e6))]++;
+  }
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&lat_lock);
+#endif
+}
+
+
+/* returns percentile 'p' (0..1) of histogram in milliseconds */
+static double lat_percentile(latency_hist_type *h, double p)
+{
+  unsigned long rank, n = 0;
+  double v;
+  int i;
+
+  rank=(unsigned long)(p*h->count+0.999999);
+  if (rank < 1) rank=1;
+  for (i=0;i<LAT_BUCKETS;i++) {
+    n+=h->bucket[i];
+    if (n >= rank) break;
+  }
+  v=lat_bucket_max(i)/1000.0;
+  return (v > h->max*1000 ? h->max*1000 : v);
+}
+
+
+/* print latencies of all commands seen */
+void latency_report(FILE *f)
+{
+  latency_hist_type *h;
+  double busy = 0, wall;
+  int i;
+
+  if (!lat_active) return;
+  wall=timeline_now()-lat_t0;
+  fprintf(f,"Command latencies (ms):\n"
+	  "Command                  count errors     avg     p50     p90"
+	  "     p99    p999      max\n");
+  for (i=0;i<256;i++) {
+    if (!(h=lat_hist[i])) continue;
+    fprintf(f,"%-22s %7lu %6lu %7.2f %7.2f %7.2f %7.2f %7.2f %8.2f\n",
+	    lat_name(i),h->count,h->errors,h->sum*1000/h->count,
+	    lat_percentile(h,0.5),lat_percentile(h,0.9),
+	    lat_percentile(h,0.99),lat_percentile(h,0.999),h->max*1000);
+    busy+=h->sum;
+  }
+  if (wall > 0)
+    fprintf(f,"%.2f s of %.2f s spent in commands (%.0f%%)\n",busy,wall,
+	    busy*100/wall);
+}
+
+/* write latencies as JSON */
+void latency_report_json(FILE *f)
+{
+  latency_hist_type *h;
+  double busy = 0;
+  int i, first = 1;
+
+  if (!lat_active) return;
+  fprintf(f,"{\n  \"commands\": [");
+  for (i=0;i<256;i++) {
+    if (!(h=lat_hist[i])) continue;
+    fprintf(f,"%s\n    { \"opcode\": %d, \"name\": \"%s\", \"count\": %lu, "
+	    "\"errors\": %lu,\n      \"avg_ms\": %.3f, \"p50_ms\": %.3f, "
+	    "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f, "
+	    "\"max_ms\": %.3f }",(first ? "" : ","),i,lat_name(i),h->count,
+	    h->errors,h->sum*1000/h->count,lat_percentile(h,0.5),
+	    lat_percentile(h,0.9),lat_percentile(h,0.99),
+	    lat_percentile(h,0.999),h->max*1000);
+    busy+=h->sum;
+    first=0;
+  }
+  fprintf(f,"\n  ],\n  \"busy_s\": %.3f,\n  \"wall_s\": %.3f\n}\n",busy,
+	  timeline_now()-lat_t0);
+}
@@ -0,0 +1,326 @@
+/* libreadiso.c -- readiso library (see libreadiso.h)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* A context owns its device handle (see scsi.c), and every function
+ * makes it the current device of the calling thread before sending
+ * commands, so contexts can be used from any thread. Errors are returned
+ * (readiso_error()), the library code never calls die().
+ *
+ * Settings of drive.c and the block cache, timeline, session recording
+ * and staging (cache.c, timeline.c, record.c, stage.c) are still process
+ * wide. They are off unless the readiso program turns them on, so
+ * contexts of a library user are not affected by them.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "readiso.h"
+#include "libreadiso.h"
+
+
+struct readiso_ctx_ {
+  scsi_device_type *dev;
+  char vendor[9], model[17], rev[5];
+  unsigned char toc[1024];
+  int tracks;           /* number of tracks in the TOC (0 = not read) */
+  MD5_CTX md5;
+  char error[128];
+};
+
+
+static int ctx_fail(readiso_ctx *ctx, const char *msg)
+{
+  strncpy(ctx->error,msg,sizeof(ctx->error)-1);
+  ctx->error[sizeof(ctx->error)-1]=0;
+  return -1;
+}
+
+/* make device of the context current device of the calling thread */
+static int ctx_select(readiso_ctx *ctx)
+{
+  if (!ctx->dev) return ctx_fail(ctx,"device not open");
+  scsi_select(ctx->dev);
+  return 0;
+}
+
+
+readiso_ctx *readiso_new(void)
+{
+  readiso_ctx *ctx;
+
+  if (!(ctx=(readiso_ctx*)malloc(sizeof(readiso_ctx)))) return NULL;
+  memset(ctx,0,sizeof(readiso_ctx));
+  return ctx;
+}
+
+void readiso_free(readiso_ctx *ctx)
+{
+  if (!ctx) return;
+  readiso_close(ctx);
+  free(ctx);
+}
+
+const char *readiso_error(readiso_ctx *ctx)
+{
+  return ctx->error;
+}
+
+
+/* open device and set it up for reading data blocks */
+int readiso_open(readiso_ctx *ctx, const char *dev)
+{
+  int type;
+
+  readiso_close(ctx);
+  if (!(ctx->dev=scsi_dev_open(dev))) return ctx_fail(ctx,"cannot open device");
+  scsi_select(ctx->dev);
+
+  if ((type=inquiry(ctx->vendor,ctx->model,ctx->rev)) < 0) {
+    readiso_close(ctx);
+    return ctx_fail(ctx,"error accessing scsi device");
+  }
+  if ((type&0x1f) != 0x5) {
+    readiso_close(ctx);
+    return ctx_fail(ctx,"device doesn't seem to be a CD-ROM");
+  }
+
+  test_ready();
+  if (test_ready()!=0) {
+    sleep(2);
+    if (test_ready()!=0) {
+      readiso_close(ctx);
+      return ctx_fail(ctx,"device not ready");
+    }
+  }
+
+  /* the disc is stopped only if the drive does not take the block size
+     while spinning (as readiso does without a drive profile) */
+  if (get_block_size() != BLOCKSIZE) {
+    mode_select(BLOCKSIZE,0x00);
+    if (get_block_size() != BLOCKSIZE) {
+      start_stop(0);
+      mode_select(BLOCKSIZE,0x00);
+      start_stop(1);
+    }
+    if (get_block_size() != BLOCKSIZE) {
+      readiso_close(ctx);
+      return ctx_fail(ctx,"cannot set drive block size");
+    }
+  }
+  return 0;
+}
+
+void readiso_close(readiso_ctx *ctx)
+{
+  if (!ctx->dev) return;
+  scsi_select(ctx->dev);
+  start_stop(0);
+  scsi_select(NULL);
+  scsi_dev_close(ctx->dev);
+  ctx->dev=NULL;
+  ctx->tracks=0;
+}
+
+/* device handle of the context (for multi.c) */
+scsi_device_type *readiso_device(readiso_ctx *ctx)
+{
+  return ctx->dev;
+}
+
+void readiso_drive_info(readiso_ctx *ctx, char *vendor, char *model,
+			char *revision)
+{
+  if (vendor) strcpy(vendor,ctx->vendor);
+  if (model) strcpy(model,ctx->model);
+  if (revision) strcpy(revision,ctx->rev);
+}
+
+
+/* read TOC, returns number of tracks */
+int readiso_read_toc(readiso_ctx *ctx)
+{
+  int len = sizeof(ctx->toc);
+
+  ctx->tracks=0;
+  if (ctx_select(ctx)) return -1;
+  if (read_toc(ctx->toc,&len,0) || len < 12)
+    return ctx_fail(ctx,"cannot read TOC");
+  ctx->tracks=ctx->toc[3]-ctx->toc[2]+1;
+  return ctx->tracks;
+}
+
+/* get information of track 'n' */
+int readiso_track_info(readiso_ctx *ctx, int n, readiso_track *track)
+{
+  unsigned char *t;
+
+  if (!ctx->tracks && readiso_read_toc(ctx) < 0) return -1;
+  if (n < ctx->toc[2] || n > ctx->toc[3])
+    return ctx_fail(ctx,"invalid track");
+  t=&ctx->toc[4+(n-ctx->toc[2])*8];
+  track->number=n;
+  track->start=V4(&t[4]);
+  track->length=V4(&t[8+4])-track->start;
+  track->data=(t[1]&DATA_TRACK ? 1 : 0);
+  return 0;
+}
+
+/* returns number of the first data track */
+int readiso_data_track(readiso_ctx *ctx)
+{
+  readiso_track t;
+  int i;
+
+  if (!ctx->tracks && readiso_read_toc(ctx) < 0) return -1;
+  for (i=ctx->toc[2];i<=ctx->toc[3];i++) {
+    if (readiso_track_info(ctx,i,&t)) return -1;
+    if (t.data) return i;
+  }
+  return ctx_fail(ctx,"no data track(s) found");
+}
+
+/* read ISO9660 primary volume descriptor of a data track to 'buf'
+   (BLOCKSIZE bytes) */
+int readiso_read_pvd(readiso_ctx *ctx, int track, unsigned char *buf)
+{
+  readiso_track t;
+  int len = BLOCKSIZE;
+
+  if (readiso_track_info(ctx,track,&t)) return -1;
+  if (!t.data) return ctx_fail(ctx,"not a data track");
+  if (read_10(t.start+16,1,buf,&len) || len < BLOCKSIZE)
+    return ctx_fail(ctx,"cannot read iso9660 primary descriptor");
+  return 0;
+}
+
+/* returns size of the image on a data track in blocks: size of the UDF
+   volume or ISO9660 volume, or the track size if the volume size looks
+   suspicious (see main()) */
+int readiso_image_size(readiso_ctx *ctx, int track)
+{
+  unsigned char buf[BLOCKSIZE];
+  iso_primary_descriptor_type *ipd = (iso_primary_descriptor_type*)buf;
+  udf_volume_type *udf;
+  readiso_track t;
+  int size = 0, iso_valid;
+
+  if (readiso_track_info(ctx,track,&t)) return -1;
+  if (!t.data) return ctx_fail(ctx,"not a data track");
+  if (!readiso_read_pvd(ctx,track,buf)) size=ISONUM(ipd->volume_space_size);
+  iso_valid=(size<=t.length && size>=1);
+
+  if ((udf=udf_open(t.start,t.length,1)) && udf->volume_size > t.length) {
+    udf_close(udf);
+    udf=NULL;
+  }
+
+  if (!iso_valid && udf) size=udf->volume_size;
+  else if (!iso_valid) size=t.length;
+  else if (udf && udf->volume_size > size) size=udf->volume_size;
+  else if (!udf && t.length-size > MAX_DIFF_ALLOWED) size=t.length;
+  udf_close(udf);
+  return size;
+}
+
+
+/* read 'count' blocks starting from 'lba', unreadable blocks are filled
+   with zeros. returns number of unreadable blocks */
+int readiso_read(readiso_ctx *ctx, int lba, int count, unsigned char *buf)
+{
+  int i, k, b, len, bad = 0;
+
+  if (ctx_select(ctx)) return -1;
+  for (i=0;i<count;i+=k) {
+    k=(count-i > MAXREADBLOCKS ? MAXREADBLOCKS : count-i);
+    len=k*BLOCKSIZE;
+    if (!read_10(lba+i,k,buf+i*BLOCKSIZE,&len) && len == k*BLOCKSIZE)
+      continue;
+    /* read one block at a time */
+    for (b=0;b<k;b++) {
+      len=BLOCKSIZE;
+      if (read_10(lba+i+b,1,buf+(i+b)*BLOCKSIZE,&len) || len < BLOCKSIZE) {
+	memset(buf+(i+b)*BLOCKSIZE,0,BLOCKSIZE);
+	bad++;
+      }
+    }
+  }
+  return bad;
+}
+
+
+void readiso_hash_init(readiso_ctx *ctx)
+{
+  MD5Init(&ctx->md5);
+}
+
+void readiso_hash_update(readiso_ctx *ctx, const unsigned char *buf, long len)
+{
+  MD5Update(&ctx->md5,(unsigned char*)buf,len);
+}
+
+void readiso_hash_final(readiso_ctx *ctx, unsigned char *md5)
+{
+  MD5Final(md5,&ctx->md5);
+}
+
+
+/* read image on data track 'track' (0 = first data track) to 'out'
+   (if not NULL) and calculate its MD5 checksum to 'md5' (if not NULL).
+   returns number of unreadable blocks (filled with zeros), or -1 if
+   the image could not be read completely */
+long readiso_rip(readiso_ctx *ctx, int track, FILE *out, unsigned char *md5,
+		 readiso_progress_func progress, void *arg)
+{
+  readiso_track t;
+  unsigned char *buf;
+  long size, done = 0, bad = 0;
+  int n, b, result = 0;
+
+  if (!track && (track=readiso_data_track(ctx)) < 0) return -1;
+  if (readiso_track_info(ctx,track,&t) ||
+      (size=readiso_image_size(ctx,track)) < 0) return -1;
+  if (!(buf=(unsigned char*)malloc(MULTI_CHUNK*BLOCKSIZE)))
+    return ctx_fail(ctx,"No memory");
+  if (md5) readiso_hash_init(ctx);
+
+  while (done < size) {
+    n=(size-done > MULTI_CHUNK ? MULTI_CHUNK : size-done);
+    if ((b=readiso_read(ctx,t.start+done,n,buf)) < 0) {
+      result=-1;
+      break;
+    }
+    bad+=b;
+    if (out && fwrite(buf,BLOCKSIZE,n,out) != n) {
+      result=ctx_fail(ctx,"error writing image file");
+      break;
+    }
+    if (md5) readiso_hash_update(ctx,buf,(long)n*BLOCKSIZE);
+    done+=n;
+    if (b == n && n >= MAX_BAD_RUN) {
+      result=ctx_fail(ctx,"too many unreadable blocks, image truncated");
+      break;
+    }
+    if (progress && progress(arg,done,size)) {
+      result=ctx_fail(ctx,"interrupted");
+      break;
+    }
+  }
+
+  if (md5) readiso_hash_final(ctx,md5);
+  free(buf);
+  return (result < 0 ? -1 : bad);
+}
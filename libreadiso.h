@@ -0,0 +1,65 @@
+/* libreadiso.h -- interface of the readiso library
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* All state of a rip is kept in a readiso_ctx, so several discs can be
+ * read at the same time from different threads (one thread at a time
+ * per context). Functions returning int return 0 (or a count) when
+ * successful and -1 on error, readiso_error() then returns the reason.
+ * Blocks are 2048 byte data blocks, LBAs are absolute (as in the TOC).
+ */
+
+#ifndef LIBREADISO_H
+#define LIBREADISO_H
+
+#include <stdio.h>
+
+#define READISO_BLOCKSIZE  2048
+
+typedef struct readiso_ctx_ readiso_ctx;
+
+typedef struct readiso_track_ {
+  int number;
+  int start;            /* first block */
+  int length;           /* blocks (up to the next track) */
+  int data;             /* 1 = data track, 0 = audio track */
+} readiso_track;
+
+/* progress callback of readiso_rip(), reading stops if it returns
+   non-zero */
+typedef int (*readiso_progress_func)(void *arg, long done, long total);
+
+
+readiso_ctx *readiso_new(void);
+void readiso_free(readiso_ctx *ctx);
+const char *readiso_error(readiso_ctx *ctx);
+
+int  readiso_open(readiso_ctx *ctx, const char *dev);
+void readiso_close(readiso_ctx *ctx);
+void readiso_drive_info(readiso_ctx *ctx, char *vendor, char *model,
+			char *revision);
+
+int  readiso_read_toc(readiso_ctx *ctx);
+int  readiso_track_info(readiso_ctx *ctx, int n, readiso_track *track);
+int  readiso_data_track(readiso_ctx *ctx);
+int  readiso_read_pvd(readiso_ctx *ctx, int track, unsigned char *buf);
+int  readiso_image_size(readiso_ctx *ctx, int track);
+
+int  readiso_read(readiso_ctx *ctx, int lba, int count, unsigned char *buf);
+
+void readiso_hash_init(readiso_ctx *ctx);
+void readiso_hash_update(readiso_ctx *ctx, const unsigned char *buf,
+			 long len);
+void readiso_hash_final(readiso_ctx *ctx, unsigned char *md5);
+
+long readiso_rip(readiso_ctx *ctx, int track, FILE *out, unsigned char *md5,
+		 readiso_progress_func progress, void *arg);
+
+#endif
@@ -0,0 +1,640 @@
+/* multi.c -- reading discs from several drives at the same time
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Every drive has its own library context (see libreadiso.c). The
+ * first data track of each disc is read in chunks of MULTI_CHUNK blocks
+ * into buffers taken from a pool shared by all drives (MULTI_POOL_MB
+ * megabytes). On Linux all drives are read by one thread with an
+ * event loop (see below), elsewhere every drive has a reader thread.
+ * Filled buffers are queued to MULTI_WRITERS writer threads, which
+ * write them to the image files and calculate the MD5 checksums. A
+ * writer takes the first queued buffer of an image that no other
+ * writer is busy with, so the buffers of each image are processed in
+ * order. The main thread prints the progress of all drives on one line.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#if defined(LINUX) && defined(HAVE_SYS_EPOLL_H)
+#define MULTI_EVENTS
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+#include "libreadiso.h"
+
+
+typedef struct multi_chunk_type_ {
+  unsigned char *buf;
+  int job;              /* image the data belongs to */
+  int len;              /* bytes of data */
+  struct multi_chunk_type_ *next;
+} multi_chunk_type;
+
+typedef struct multi_cmd_type_ {
+  int used;
+  int offset;           /* first block (in the buffer) */
+  int count;            /* blocks */
+  int retry;            /* single block read again */
+} multi_cmd_type;
+
+typedef struct multi_job_type_ {
+  const char *dev;
+  char name[256];       /* image file (empty with --MD5) */
+  FILE *out;
+  char vendor[9], model[17], rev[5];
+  readiso_track track;  /* data track read */
+  int size;             /* size of the image */
+  int done;             /* blocks read */
+  int bad;              /* unreadable blocks (filled with zeros) */
+  int reading;          /* reader thread is running */
+  int queued;           /* buffers in the queue */
+  int busy;             /* a writer is processing a buffer of the image */
+  int failed;
+  char error[80];
+  MD5_CTX md5;
+  pthread_t thread;
+#ifdef MULTI_EVENTS
+  readiso_ctx *ctx;
+  scsi_device_type *sdev;
+  multi_chunk_type *chunk;  /* buffer being filled */
+  int n;                /* blocks to read to the buffer */
+  int next;             /* next block of the buffer to request */
+  int filled;           /* blocks of the buffer finished */
+  int chunk_bad;        /* unreadable blocks in the buffer */
+  char retry[MULTI_CHUNK];  /* blocks to read again one at a time */
+  multi_cmd_type cmd[MULTI_QUEUE];
+  int active;           /* commands queued */
+#endif
+} multi_job_type;
+
+typedef struct multi_pool_type_ {
+  pthread_mutex_t lock;
+  pthread_cond_t free_cond;   /* buffer returned to the pool */
+  pthread_cond_t ready_cond;  /* buffer queued or image released */
+  pthread_cond_t done_cond;   /* buffer written or reader finished */
+  multi_chunk_type *chunks;
+  unsigned char *data;
+  multi_chunk_type *free_list;
+  multi_chunk_type *queue;
+  multi_job_type *jobs;
+  int count;
+  int nchunks;
+  int queued;                 /* buffers in the queue (all images) */
+  int md5_mode;
+  int wake[2];                /* pipe to wake up the event loop */
+} multi_pool_type;
+
+static multi_pool_type pool;
+
+
+/* build image file name from 'pattern': %d = drive number,
+   %s = name of the device (without directory), %% = % */
+static void multi_name(const char *pattern, int n, const char *dev,
+		       char *name, int size)
+{
+  char tmp[32];
+  const char *s;
+  int l = 0;
+
+  while (*pattern && l < size-1) {
+    s=NULL;
+    if (*pattern=='%' && pattern[1]=='d') {
+      sprintf(tmp,"%d",n);
+      s=tmp;
+    }
+    else if (*pattern=='%' && pattern[1]=='s') {
+      s=((s=strrchr(dev,'/')) ? s+1 : dev);
+    }
+    else if (*pattern=='%' && pattern[1]=='%') s="%";
+
+    if (s) {
+      while (*s && l < size-1) name[l++]=*s++;
+      pattern+=2;
+    }
+    else name[l++]=*pattern++;
+  }
+  name[l]=0;
+}
+
+static int multi_fail(multi_job_type *j, const char *msg)
+{
+  strncpy(j->error,msg,sizeof(j->error)-1);
+  j->failed=1;
+  return -1;
+}
+
+
+#ifndef MULTI_EVENTS
+static multi_chunk_type *multi_get_chunk()
+{
+  multi_chunk_type *c;
+  double t = stage_start();
+
+  pthread_mutex_lock(&pool.lock);
+  while (!pool.free_list) pthread_cond_wait(&pool.free_cond,&pool.lock);
+  stage_add(STAGE_STALL,t);
+  c=pool.free_list;
+  pool.free_list=c->next;
+  pthread_mutex_unlock(&pool.lock);
+  return c;
+}
+#endif
+
+static void multi_queue_chunk(multi_chunk_type *c, int blocks)
+{
+  multi_chunk_type **p;
+  multi_job_type *j = &pool.jobs[c->job];
+
+  pthread_mutex_lock(&pool.lock);
+  for (p=&pool.queue; *p; p=&(*p)->next);
+  c->next=NULL;
+  *p=c;
+  j->queued++;
+  j->done+=blocks;
+  stage_sample(QUEUE_BUFFERS,++pool.queued,pool.nchunks);
+  pthread_cond_broadcast(&pool.ready_cond);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+
+/* open the drive and find the image to read */
+static readiso_ctx *multi_open(multi_job_type *j)
+{
+  readiso_ctx *ctx;
+  int track;
+
+  if (!(ctx=readiso_new())) die("No memory");
+  if (readiso_open(ctx,j->dev) || (track=readiso_data_track(ctx)) < 0 ||
+      readiso_track_info(ctx,track,&j->track) ||
+      (j->size=readiso_image_size(ctx,track)) < 0) {
+    multi_fail(j,readiso_error(ctx));
+    j->size=0;
+  }
+  readiso_drive_info(ctx,j->vendor,j->model,j->rev);
+  return ctx;
+}
+
+/* all blocks of the image have been read */
+static void multi_finish(multi_job_type *j, readiso_ctx *ctx)
+{
+  readiso_free(ctx);
+  pthread_mutex_lock(&pool.lock);
+  j->reading=0;
+  pthread_cond_broadcast(&pool.ready_cond);
+  pthread_cond_broadcast(&pool.done_cond);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+#ifndef MULTI_EVENTS
+static void *multi_reader(void *arg)
+{
+  multi_job_type *j = (multi_job_type*)arg;
+  readiso_ctx *ctx = multi_open(j);
+  multi_chunk_type *c;
+  int n, bad;
+  double t;
+
+  while (j->done < j->size && !j->failed) {
+    n=(j->size-j->done > MULTI_CHUNK ? MULTI_CHUNK : j->size-j->done);
+    c=multi_get_chunk();
+    t=stage_start();
+    if ((bad=readiso_read(ctx,j->track.start+j->done,n,c->buf)) < 0) bad=n;
+    stage_add(STAGE_DRIVE,t);
+    j->bad+=bad;
+    if (bad == n && n >= MAX_BAD_RUN) {
+      multi_fail(j,"too many unreadable blocks, image truncated");
+      j->size=j->done+n;
+    }
+    c->job=j-pool.jobs;
+    c->len=n*BLOCKSIZE;
+    multi_queue_chunk(c,n);
+  }
+  multi_finish(j,ctx);
+  return NULL;
+}
+#endif
+
+
+#ifdef MULTI_EVENTS
+
+/* Event mode: one thread drives all drives. The drives are first opened
+ * by short-lived threads in parallel (opening and probing a drive
+ * blocks, with a slow drive for seconds). The sg devices are then put in
+ * non-blocking mode and up to MULTI_QUEUE READ(10) commands of each
+ * drive are kept queued in the sg driver. Results are collected when
+ * epoll reports a device readable. Blocks of a failed command are read
+ * again one at a time. The writers wake up the loop through a pipe
+ * when a buffer is returned to the pool.
+ */
+
+static multi_chunk_type *multi_try_chunk()
+{
+  multi_chunk_type *c;
+
+  pthread_mutex_lock(&pool.lock);
+  if ((c=pool.free_list)) pool.free_list=c->next;
+  pthread_mutex_unlock(&pool.lock);
+  return c;
+}
+
+static void multi_complete(multi_job_type *j, int id, int result,
+			   unsigned char *data, int len);
+
+/* queue commands for the drive, as long as there is room */
+static void multi_submit(multi_job_type *j)
+{
+  multi_cmd_type *cmd;
+  int i, o, k, retry, lba;
+
+  if (!j->chunk) {
+    if (j->done >= j->size || j->failed) return;
+    if (!(j->chunk=multi_try_chunk())) return;
+    j->n=(j->size-j->done > MULTI_CHUNK ? MULTI_CHUNK : j->size-j->done);
+    j->next=j->filled=j->chunk_bad=0;
+    memset(j->retry,0,sizeof(j->retry));
+  }
+
+  while (j->active < MULTI_QUEUE) {
+    retry=0;
+    if (j->next < j->n) {
+      o=j->next;
+      k=(j->n-o > MAXREADBLOCKS ? MAXREADBLOCKS : j->n-o);
+    } else {
+      for (o=0; o < j->n && !j->retry[o]; o++);
+      if (o >= j->n) break;
+      k=1;
+      retry=1;
+    }
+    for (i=0; j->cmd[i].used; i++);
+    cmd=&j->cmd[i];
+    lba=j->track.start+j->done+o;
+
+    if (scsi_async_start(j->sdev,i,k*BLOCKSIZE,10,
+			 READ10,0,B4(lba),0,B2(k),0)) {
+      /* queue of the device is full, try again when a command is done */
+      if ((errno==EAGAIN || errno==EDOM) && j->active > 0) break;
+      cmd->used=1; cmd->offset=o; cmd->count=k; cmd->retry=retry;
+      j->active++;
+      if (retry) j->retry[o]=0; else j->next+=k;
+      multi_complete(j,i,1,NULL,0);
+      continue;
+    }
+    cmd->used=1; cmd->offset=o; cmd->count=k; cmd->retry=retry;
+    j->active++;
+    if (retry) j->retry[o]=0; else j->next+=k;
+  }
+}
+
+/* command 'id' has finished */
+static void multi_complete(multi_job_type *j, int id, int result,
+			   unsigned char *data, int len)
+{
+  multi_cmd_type *cmd;
+  unsigned char *buf;
+  int b;
+
+  if (id < 0 || id >= MULTI_QUEUE || !j->cmd[id].used) return;
+  cmd=&j->cmd[id];
+  cmd->used=0;
+  j->active--;
+  buf=j->chunk->buf+cmd->offset*BLOCKSIZE;
+
+  if (!result && len == cmd->count*BLOCKSIZE) {
+    memcpy(buf,data,len);
+    j->filled+=cmd->count;
+  }
+  else if (cmd->count > 1) {
+    for (b=0;b<cmd->count;b++) j->retry[cmd->offset+b]=1;
+  }
+  else {
+    memset(buf,0,BLOCKSIZE);
+    j->filled++;
+    j->chunk_bad++;
+    j->bad++;
+  }
+
+  if (j->filled == j->n) {
+    if (j->chunk_bad == j->n && j->n >= MAX_BAD_RUN) {
+      multi_fail(j,"too many unreadable blocks, image truncated");
+      j->size=j->done+j->n;
+    }
+    j->chunk->job=j-pool.jobs;
+    j->chunk->len=j->n*BLOCKSIZE;
+    multi_queue_chunk(j->chunk,j->n);
+    j->chunk=NULL;
+  }
+}
+
+static void *multi_setup(void *arg)
+{
+  multi_job_type *j = (multi_job_type*)arg;
+
+  j->ctx=multi_open(j);
+  return NULL;
+}
+
+static void *multi_events(void *arg)
+{
+  struct epoll_event ev, events[MAX_DRIVES+1];
+  multi_job_type *j;
+  unsigned char *data, c;
+  int ep, i, n, fd, id, len, result, running = 0, waiting;
+  double t;
+
+  (void)arg;
+  if ((ep=epoll_create(pool.count+1)) < 0) die("epoll_create failed");
+  memset(&ev,0,sizeof(ev));
+  ev.events=EPOLLIN;
+  ev.data.u32=pool.count;
+  epoll_ctl(ep,EPOLL_CTL_ADD,pool.wake[0],&ev);
+
+  for (i=0;i<pool.count;i++)
+    if (pthread_create(&pool.jobs[i].thread,NULL,multi_setup,&pool.jobs[i]))
+      die("cannot create thread");
+  for (i=0;i<pool.count;i++) pthread_join(pool.jobs[i].thread,NULL);
+
+  for (i=0;i<pool.count;i++) {
+    j=&pool.jobs[i];
+    if (!j->failed) {
+      j->sdev=readiso_device(j->ctx);
+      ev.data.u32=i;
+      if ((fd=scsi_dev_nonblock(j->sdev,1)) < 0 ||
+	  epoll_ctl(ep,EPOLL_CTL_ADD,fd,&ev) < 0) {
+	scsi_dev_nonblock(j->sdev,0);
+	multi_fail(j,"cannot use non-blocking mode");
+      }
+    }
+    if (j->failed || j->size == 0) multi_finish(j,j->ctx);
+    else running++;
+  }
+
+  while (running > 0) {
+    for (i=0,waiting=0;i<pool.count;i++) {
+      j=&pool.jobs[i];
+      if (!j->reading) continue;
+      multi_submit(j);
+      stage_sample(QUEUE_COMMANDS,j->active,MULTI_QUEUE);
+      waiting+=j->active;
+      if (!j->active && !j->chunk && (j->done >= j->size || j->failed)) {
+	epoll_ctl(ep,EPOLL_CTL_DEL,scsi_dev_nonblock(j->sdev,0),&ev);
+	multi_finish(j,j->ctx);
+	running--;
+      }
+    }
+    if (!running) break;
+
+    /* without commands queued the loop waits for free buffers */
+    t=stage_start();
+    n=epoll_wait(ep,events,MAX_DRIVES+1,-1);
+    stage_add((waiting ? STAGE_DRIVE : STAGE_STALL),t);
+    if (n < 0) {
+      if (errno==EINTR) continue;
+      die("epoll_wait failed");
+    }
+
+    for (i=0;i<n;i++) {
+      if ((int)events[i].data.u32 == pool.count) {
+	while (read(pool.wake[0],&c,1) == 1);
+	continue;
+      }
+      j=&pool.jobs[events[i].data.u32];
+      while ((result=scsi_async_finish(j->sdev,&id,&data,&len)) >= 0)
+	multi_complete(j,id,result,data,len);
+    }
+  }
+
+  close(ep);
+  return NULL;
+}
+
+#endif /* MULTI_EVENTS */
+
+
+static int multi_readers()
+{
+  int i, n = 0;
+
+  for (i=0;i<pool.count;i++) if (pool.jobs[i].reading) n++;
+  return n;
+}
+
+static void *multi_writer(void *arg)
+{
+  multi_chunk_type *c, **p;
+  multi_job_type *j;
+  double t;
+
+  (void)arg;
+  pthread_mutex_lock(&pool.lock);
+  while (1) {
+    for (p=&pool.queue; *p && pool.jobs[(*p)->job].busy; p=&(*p)->next);
+    if (!(c=*p)) {
+      if (!pool.queue && !multi_readers()) break;
+      pthread_cond_wait(&pool.ready_cond,&pool.lock);
+      continue;
+    }
+    *p=c->next;
+    j=&pool.jobs[c->job];
+    j->queued--;
+    pool.queued--;
+    j->busy=1;
+    pthread_mutex_unlock(&pool.lock);
+
+    t=stage_start();
+    if (j->out && fwrite(c->buf,1,c->len,j->out) != (size_t)c->len)
+      multi_fail(j,"error writing image file");
+    stage_add(STAGE_WRITE,t);
+    t=stage_start();
+    if (pool.md5_mode) MD5Update(&j->md5,c->buf,c->len);
+    stage_add(STAGE_HASH,t);
+
+    pthread_mutex_lock(&pool.lock);
+    j->busy=0;
+    c->next=pool.free_list;
+    pool.free_list=c;
+    if (pool.wake[1] >= 0) write(pool.wake[1],"",1);
+    pthread_cond_signal(&pool.free_cond);
+    pthread_cond_broadcast(&pool.ready_cond);
+    pthread_cond_broadcast(&pool.done_cond);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+
+/* returns number of images not yet finished (pool must be locked) */
+static int multi_running()
+{
+  multi_job_type *j;
+  int i, n = 0;
+
+  for (i=0;i<pool.count;i++) {
+    j=&pool.jobs[i];
+    if (j->reading || j->queued || j->busy) n++;
+  }
+  return n;
+}
+
+/* rip first data track of the discs in drives 'devs' ('count' drives) to
+   image files named after 'pattern', returns number of images that
+   are not complete */
+int rip_multi(char **devs, int count, const char *pattern, int md5_mode)
+{
+  pthread_t writers[MULTI_WRITERS];
+#ifdef MULTI_EVENTS
+  pthread_t events;
+#endif
+  struct timeval now;
+  struct timespec ts;
+  multi_job_type *j;
+  char digest[16], digest_text[33];
+  int i, nchunks, running, start_time, last_time, cur_time, kbps;
+  int result = 0;
+  long done, total;
+
+  memset(&pool,0,sizeof(pool));
+  pthread_mutex_init(&pool.lock,NULL);
+  pthread_cond_init(&pool.free_cond,NULL);
+  pthread_cond_init(&pool.ready_cond,NULL);
+  pthread_cond_init(&pool.done_cond,NULL);
+  pool.count=count;
+  pool.md5_mode=md5_mode;
+  pool.wake[0]=pool.wake[1]=-1;
+
+  /* shared buffer pool, at least two buffers per drive */
+  nchunks=MULTI_POOL_MB*1024*1024/(MULTI_CHUNK*BLOCKSIZE);
+  if (nchunks < count*2) nchunks=count*2;
+  pool.nchunks=nchunks;
+  pool.jobs=(multi_job_type*)calloc(count,sizeof(multi_job_type));
+  pool.chunks=(multi_chunk_type*)malloc(nchunks*sizeof(multi_chunk_type));
+  pool.data=(unsigned char*)malloc((long)nchunks*MULTI_CHUNK*BLOCKSIZE);
+  if (!pool.jobs || !pool.chunks || !pool.data) die("No memory");
+  for (i=0;i<nchunks;i++) {
+    pool.chunks[i].buf=pool.data+(long)i*MULTI_CHUNK*BLOCKSIZE;
+    pool.chunks[i].next=(i+1 < nchunks ? &pool.chunks[i+1] : NULL);
+  }
+  pool.free_list=pool.chunks;
+
+  for (i=0;i<count;i++) {
+    j=&pool.jobs[i];
+    j->dev=devs[i];
+    if (md5_mode!=2) {
+      multi_name(pattern,i,devs[i],j->name,sizeof(j->name));
+      if (!(j->out=fopen(j->name,"w")))
+	die("cannot open output file '%s'",j->name);
+    }
+    if (md5_mode) MD5Init(&j->md5);
+    j->reading=1;
+  }
+
+  fprintf(stderr,"Reading %d drive(s) (%d buffers of %dk shared)...\n",
+	  count,nchunks,MULTI_CHUNK*BLOCKSIZE/1024);
+  stage_threads(STAGE_HASH,MULTI_WRITERS);
+  stage_threads(STAGE_WRITE,MULTI_WRITERS);
+#ifndef MULTI_EVENTS
+  /* every drive has a reader thread */
+  stage_threads(STAGE_DRIVE,count);
+  stage_threads(STAGE_STALL,count);
+#endif
+  stage_begin();
+  for (i=0;i<MULTI_WRITERS;i++)
+    if (pthread_create(&writers[i],NULL,multi_writer,NULL))
+      die("cannot create thread");
+#ifdef MULTI_EVENTS
+  if (pipe(pool.wake) ||
+      fcntl(pool.wake[0],F_SETFL,O_NONBLOCK) ||
+      fcntl(pool.wake[1],F_SETFL,O_NONBLOCK)) die("cannot create pipe");
+  if (pthread_create(&events,NULL,multi_events,NULL))
+    die("cannot create thread");
+#else
+  for (i=0;i<count;i++)
+    if (pthread_create(&pool.jobs[i].thread,NULL,multi_reader,&pool.jobs[i]))
+      die("cannot create thread");
+#endif
+
+  /* print progress until all images are done */
+  start_time=last_time=(int)time(NULL);
+  pthread_mutex_lock(&pool.lock);
+  while ((running=multi_running()) > 0) {
+    gettimeofday(&now,NULL);
+    ts.tv_sec=now.tv_sec+1;
+    ts.tv_nsec=now.tv_usec*1000;
+    pthread_cond_timedwait(&pool.done_cond,&pool.lock,&ts);
+
+    cur_time=(int)time(NULL);
+    if (cur_time-last_time < DUMP_PROGRESS) continue;
+    for (i=0,done=0,total=0;i<count;i++) {
+      done+=pool.jobs[i].done;
+      total+=pool.jobs[i].size;
+    }
+    kbps=(done*(BLOCKSIZE/1024))/(cur_time-start_time);
+    fprintf(stderr,"%3ldM of %ldM read, %d of %d drive(s) done. "
+	    "(%d kb/s)         \r",done/512,total/512,count-running,count,kbps);
+    last_time=cur_time;
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+#ifdef MULTI_EVENTS
+  pthread_join(events,NULL);
+#else
+  for (i=0;i<count;i++) pthread_join(pool.jobs[i].thread,NULL);
+#endif
+  for (i=0;i<MULTI_WRITERS;i++) pthread_join(writers[i],NULL);
+  stage_end();
+#ifdef MULTI_EVENTS
+  close(pool.wake[0]);
+  close(pool.wake[1]);
+#endif
+  fprintf(stderr,"\n");
+
+  /* summary */
+  for (i=0;i<count;i++) {
+    j=&pool.jobs[i];
+    if (j->out) fclose(j->out);
+    if (j->out && j->failed && j->size == 0) unlink(j->name);
+    if (j->size == 0)
+      fprintf(stderr,"%s: %s\n",j->dev,(j->failed ? j->error : "empty"));
+    else
+      fprintf(stderr,"%s: %s %s, %d blocks%s%s: %s\n",j->dev,j->vendor,
+	      j->model,j->size,(j->name[0] ? " -> " : ""),j->name,
+	      (j->failed ? j->error : "complete"));
+    if (j->bad)
+      fprintf(stderr,"%s: %d unreadable block(s) filled with zeros.\n",
+	      j->dev,j->bad);
+    if (md5_mode && j->size > 0) {
+      MD5Final((unsigned char*)digest,&j->md5);
+      md2str((unsigned char*)digest,digest_text);
+      fprintf(stderr,"MD5 (%s) = %s\n",(md5_mode==2 ? j->dev : j->name),
+	      digest_text);
+    }
+    if (j->failed || j->bad) result++;
+  }
+
+  free(pool.data);
+  free(pool.chunks);
+  free(pool.jobs);
+  return result;
+}
+
+#endif /* HAVE_LIBPTHREAD */
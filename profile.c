@@ -0,0 +1,116 @@
+/* profile.c -- cache of drive profiles
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* What has been found out about a drive when it was set up is saved
+ * in a profile file (by default ~/.readiso-drives), so that next time
+ * the same drive (same vendor, model and revision) can be set up
+ * without probing. The file has one line per drive: vendor, model and
+ * revision separated by tabs, followed by tab separated key=value
+ * fields. Lines starting with # and unknown keys are ignored.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define PROFILE_LINE 512
+
+
+void profile_init(drive_profile_type *p, const char *vendor,
+		  const char *model, const char *rev)
+{
+  memset(p,0,sizeof(drive_profile_type));
+  strncpy(p->vendor,vendor,sizeof(p->vendor)-1);
+  strncpy(p->model,model,sizeof(p->model)-1);
+  strncpy(p->rev,rev,sizeof(p->rev)-1);
+}
+
+/* returns name of the default profile file (or NULL) */
+char *profile_default_file()
+{
+  static char name[1024];
+  char *home = getenv("HOME");
+
+  if (!home || !*home) return NULL;
+  snprintf(name,sizeof(name),"%s/" PROFILE_FILE,home);
+  return name;
+}
+
+/* returns pointer to the fields following the key of line 'line'
+   if the key matches profile 'p', otherwise NULL */
+static char *profile_match(char *line, drive_profile_type *p)
+{
+  char key[64];
+  int len;
+
+  snprintf(key,sizeof(key),"%s\t%s\t%s",p->vendor,p->model,p->rev);
+  len=strlen(key);
+  if (strncmp(line,key,len)) return NULL;
+  if (line[len] != '\t' && line[len] != '\n' && line[len] != 0) return NULL;
+  return line+len;
+}
+
+
+/* load profile of the drive of 'p' (vendor, model and revision set
+   with profile_init()). returns 0 if the drive was found */
+int profile_load(const char *file, drive_profile_type *p)
+{
+  char line[PROFILE_LINE], *s;
+  FILE *f;
+  int found = 0;
+
+  if (!(f=fopen(file,"r"))) return -1;
+  while (!found && fgets(line,sizeof(line),f)) {
+    if (line[0] == '#' || !(s=profile_match(line,p))) continue;
+    for (s=strtok(s,"\t\n");s;s=strtok(NULL,"\t\n")) {
+      if (!strncmp(s,"bsize=",6)) p->bsize_cmd=atoi(s+6);
+    }
+    found=1;
+  }
+  fclose(f);
+
+  if (!found || p->bsize_cmd < BSIZE_MODE_SENSE ||
+      p->bsize_cmd > BSIZE_READ_CAPACITY) return -1;
+  return 0;
+}
+
+
+/* save profile 'p' to the file (replacing old profile of the drive) */
+int profile_save(const char *file, drive_profile_type *p)
+{
+  char line[PROFILE_LINE], tmp[1024];
+  FILE *f, *o;
+
+  snprintf(tmp,sizeof(tmp),"%s.tmp",file);
+  if (!(o=fopen(tmp,"w"))) return -1;
+  fprintf(o,"# " PRGNAME " drive profiles\n");
+
+  if ((f=fopen(file,"r"))) {
+    while (fgets(line,sizeof(line),f)) {
+      if (line[0] == '#' || profile_match(line,p)) continue;
+      fputs(line,o);
+    }
+    fclose(f);
+  }
+
+  fprintf(o,"%s\t%s\t%s\tbsize=%d\n",p->vendor,p->model,p->rev,p->bsize_cmd);
+  if (fclose(o) || rename(tmp,file)) {
+    remove(tmp);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,328 @@
+/* raw.c -- reading whole disc as raw 2352 byte sectors (READ CD)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* The program area is read with READ CD returning complete sectors
+ * (sync, header, user data and EDC/ECC), so Mode 2/XA and audio tracks
+ * are read the same way as Mode 1 tracks and no drive specific block
+ * size changes are needed. Output is either a single BIN file with a
+ * CUE sheet, or CloneCD style IMG + SUB (deinterleaved P-W subchannels)
+ * + CCD files.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define MSF2LBA(m,s,f) ((((m)*60)+(s))*75+(f)-150)
+
+static char *raw_filename(const char *base, const char *ext)
+{
+  char *name;
+
+  if (!(name=(char*)malloc(strlen(base)+strlen(ext)+2))) die("No memory");
+  sprintf(name,"%s.%s",base,ext);
+  return name;
+}
+
+static const char *raw_nodir(const char *name)
+{
+  return (strrchr(name,'/') ? strrchr(name,'/')+1 : name);
+}
+
+
+/* convert raw (interleaved) P-W subchannel data to CloneCD format,
+   where each of the eight channels is stored as 12 consecutive bytes */
+static void sub_deinterleave(unsigned char *raw, unsigned char *out)
+{
+  int i, c;
+
+  memset(out,0,SUBBLOCKSIZE);
+  for (i=0;i<SUBBLOCKSIZE;i++) {
+    if (!raw[i]) continue;
+    for (c=0;c<8;c++)
+      if (raw[i]&(0x80>>c)) out[c*12+i/8]|=(0x80>>(i%8));
+  }
+}
+
+
+/* get sector mode (0 = audio, 1 or 2) of a track from its first sector
+   ('buf' must have room for 'bsize' bytes, at least RAWBLOCKSIZE) */
+int track_mode(unsigned char *toce, int bsize, unsigned char *buf)
+{
+  int len = bsize;
+
+  if (!(toce[1]&DATA_TRACK)) return 0;
+  if (read_cd(V4(&toce[4]),1,READCD_RAW,READCD_SUB_NONE,buf,&len) ||
+      len<RAWBLOCKSIZE) return 1;
+  return (buf[15]==2 ? 2 : 1);
+}
+
+
+/* read blocks one by one after a failed read, unreadable blocks
+   are filled with zeros */
+static void read_raw_retry(int lba, int n, int bsize, int subch,
+			   unsigned char *buf, int *bad, int *badrun)
+{
+  int i, len;
+
+  for (i=0;i<n;i++) {
+    len=bsize;
+    if (read_cd(lba+i,1,READCD_RAW,subch,buf+i*bsize,&len) || len<bsize) {
+      memset(buf+i*bsize,0,bsize);
+      (*bad)++;
+      (*badrun)++;
+    } else {
+      *badrun=0;
+    }
+  }
+}
+
+
+static void write_cue(FILE *f, const char *binname, unsigned char *toc,
+		      int *modes)
+{
+  int first = toc[2], last = toc[3], track, lba;
+  int disc_start = V4(&toc[4+4]);
+  unsigned char *toce;
+
+  fprintf(f,"FILE \"%s\" BINARY\n",raw_nodir(binname));
+  for (track=first; track<=last; track++) {
+    toce=&toc[4+(track-first)*8];
+    lba=V4(&toce[4])-disc_start;
+    if (modes[track-first]==0) fprintf(f,"  TRACK %02d AUDIO\n",track);
+    else fprintf(f,"  TRACK %02d MODE%d/2352\n",track,modes[track-first]);
+    fprintf(f,"    INDEX 01 %02d:%02d:%02d\n",
+	    LBA_MIN(lba),LBA_SEC(lba),LBA_FRM(lba));
+  }
+}
+
+
+static void make_entry(unsigned char *e, int point, int ctrl, 
+		       int m, int s, int f)
+{
+  memset(e,0,11);
+  e[0]=1;
+  e[1]=0x10|(ctrl&0x0f);
+  e[3]=point;
+  e[8]=m;
+  e[9]=s;
+  e[10]=f;
+}
+
+static void write_ccd_entry(FILE *f, int n, unsigned char *e)
+{
+  fprintf(f,"[Entry %d]\nSession=%d\nPoint=0x%02x\nADR=0x%02x\n"
+	  "Control=0x%02x\nTrackNo=%d\nAMin=%d\nASec=%d\nAFrame=%d\n"
+	  "ALBA=%d\nZero=%d\nPMin=%d\nPSec=%d\nPFrame=%d\nPLBA=%d\n\n",
+	  n,e[0],e[3],(e[1]>>4),(e[1]&0x0f),e[2],e[4],e[5],e[6],
+	  MSF2LBA(e[4],e[5],e[6]),e[7],e[8],e[9],e[10],
+	  MSF2LBA(e[8],e[9],e[10]));
+}
+
+/* write CloneCD control file, full TOC is used if the drive supports
+   it, otherwise a single session TOC is made from the normal TOC */
+static void write_ccd(FILE *f, unsigned char *toc, int *modes)
+{
+  unsigned char ftoc[2048], *e;
+  int first = toc[2], last = toc[3];
+  int len, count, sessions, i, s, lba;
+
+  len=sizeof(ftoc);
+  if (read_full_toc(ftoc,&len)==0 && len>=4+11 && V2(&ftoc[0])+2 <= len) {
+    count=(V2(&ftoc[0])-2)/11;
+    sessions=ftoc[3];
+  } else {
+    /* make A0, A1, A2 and track entries from the normal TOC */
+    count=0;
+    make_entry(&ftoc[4+11*count++],0xa0,toc[4+1],first,0,0);
+    make_entry(&ftoc[4+11*count++],0xa1,toc[4+(last-first)*8+1],last,0,0);
+    for (i=0;i<=last-first+1;i++) {
+      e=&toc[4+i*8];
+      lba=V4(&e[4])+150;
+      make_entry(&ftoc[4+11*count++],(i>last-first ? 0xa2 : first+i),e[1],
+		 LBA_MIN(lba),LBA_SEC(lba),LBA_FRM(lba));
+    }
+    sessions=1;
+  }
+
+  fprintf(f,"[CloneCD]\nVersion=3\n\n");
+  fprintf(f,"[Disc]\nTocEntries=%d\nSessions=%d\nDataTracksScrambled=0\n"
+	  "CDTextLength=0\n\n",count,sessions);
+
+  for (s=1;s<=sessions;s++) {
+    int mode = 0;
+    for (i=0;i<count;i++) {
+      e=&ftoc[4+i*11];
+      if (e[0]==s && e[3]>=first && e[3]<=last) {
+	mode=modes[e[3]-first];
+	break;
+      }
+    }
+    fprintf(f,"[Session %d]\nPreGapMode=%d\nPreGapSubC=0\n\n",s,mode);
+  }
+
+  for (i=0;i<count;i++) write_ccd_entry(f,i,&ftoc[4+i*11]);
+
+  for (i=0;i<count;i++) {
+    e=&ftoc[4+i*11];
+    if ((e[1]>>4)!=1 || e[3]<first || e[3]>last) continue;
+    fprintf(f,"[TRACK %d]\nMODE=%d\nINDEX 1=%d\n\n",e[3],modes[e[3]-first],
+	    MSF2LBA(e[8],e[9],e[10]));
+  }
+}
+
+
+/* read the whole disc (from the first track to the leadout) as raw
+   sectors into '<basename>.bin' (RAW_FORMAT_BIN) or '<basename>.img'
+   and '<basename>.sub' (RAW_FORMAT_CCD). returns number of unreadable
+   blocks */
+int rip_raw_disc(unsigned char *toc, const char *name, int format,
+		 int md5_mode)
+{
+  unsigned char *buffer, subbuf[SUBBLOCKSIZE], *toce;
+  char *base, *imgname, *subname = NULL, *ctlname;
+  char digest[16], digest_text[33];
+  FILE *img, *sub = NULL, *ctl;
+  MD5_CTX md5;
+  int first, last, track, start, stop, lba, n, i, len;
+  int bsize, subch, bad = 0, badrun, total_bad = 0;
+  int modes[100];
+  long total, done = 0;
+  int start_time, cur_time, kbps;
+
+  first=toc[2];
+  last=toc[3];
+  if (last < first || last > 99) die("invalid TOC");
+
+  if (format==RAW_FORMAT_CCD) {
+    subch=READCD_SUB_RAW;
+    bsize=RAWBLOCKSIZE+SUBBLOCKSIZE;
+  } else {
+    subch=READCD_SUB_NONE;
+    bsize=RAWBLOCKSIZE;
+  }
+
+  buffer=(unsigned char*)malloc(RAWREADBLOCKS*bsize);
+  if (!buffer) die("No memory");
+
+  start=V4(&toc[4+4]);
+  len=bsize;
+  if (read_cd(start,1,READCD_RAW,subch,buffer,&len) || len<bsize)
+    die("drive does not support raw reads (READ CD)%s.",
+	(subch ? " with subchannel data" : ""));
+
+  for (track=first; track<=last; track++)
+    modes[track-first]=track_mode(&toc[4+(track-first)*8],bsize,buffer);
+
+  base=track_basename(name);
+  imgname=raw_filename(base,(format==RAW_FORMAT_CCD ? "img" : "bin"));
+  ctlname=raw_filename(base,(format==RAW_FORMAT_CCD ? "ccd" : "cue"));
+  if (!(img=fopen(imgname,"w"))) die("cannot open output file '%s'",imgname);
+  if (format==RAW_FORMAT_CCD) {
+    subname=raw_filename(base,"sub");
+    if (!(sub=fopen(subname,"w")))
+      die("cannot open output file '%s'",subname);
+  }
+
+  total=V4(&toc[4+(last-first+1)*8+4])-start;
+  fprintf(stderr,"Reading %d track(s), %ld raw blocks...\n",
+	  last-first+1,total);
+  if (md5_mode) MD5Init(&md5);
+  start_time=(int)time(NULL);
+
+  for (track=first; track<=last; track++) {
+    toce=&toc[4+(track-first)*8];
+    start=V4(&toce[4]);
+    stop=V4(&toce[8+4]);
+    bad=badrun=0;
+
+    for (lba=start; lba<stop; lba+=n) {
+      n=(stop-lba > RAWREADBLOCKS ? RAWREADBLOCKS : stop-lba);
+
+      len=n*bsize;
+      if (read_cd(lba,n,READCD_RAW,subch,buffer,&len) || len<n*bsize) {
+	i=bsize;
+	if (badrun >= MAX_BAD_RUN &&
+	    (read_cd(lba+n-1,1,READCD_RAW,subch,buffer,&i) || i<bsize)) {
+	  /* probably end of session, don't retry block by block until
+	     something can be read again */
+	  memset(buffer,0,n*bsize);
+	  bad+=n;
+	  badrun+=n;
+	} else {
+	  read_raw_retry(lba,n,bsize,subch,buffer,&bad,&badrun);
+	}
+      } else {
+	badrun=0;
+      }
+
+      for (i=0;i<n;i++) {
+	if (sub) {
+	  sub_deinterleave(buffer+i*bsize+RAWBLOCKSIZE,subbuf);
+	  fwrite(subbuf,SUBBLOCKSIZE,1,sub);
+	}
+	if (bsize != RAWBLOCKSIZE)
+	  memmove(buffer+i*RAWBLOCKSIZE,buffer+i*bsize,RAWBLOCKSIZE);
+      }
+      fwrite(buffer,n*RAWBLOCKSIZE,1,img);
+      if (md5_mode) MD5Update(&md5,buffer,n*RAWBLOCKSIZE);
+
+      done+=n;
+      if ((done%512) < RAWREADBLOCKS) {
+	cur_time=(int)time(NULL);
+	kbps=((cur_time-start_time)>0 ?
+	      (done*RAWBLOCKSIZE/1024)/(cur_time-start_time) : 0);
+	fprintf(stderr,"Track %02d: %3ldM of %ldM read. (%d kb/s)         \r",
+		track,done/512,total/512,kbps);
+      }
+    }
+
+    if (bad > 0) {
+      fprintf(stderr,"\nTrack %02d: %d unreadable block(s) "
+	      "(filled with zeros).\n",track,bad);
+      total_bad+=bad;
+    }
+  }
+  fprintf(stderr,"\n");
+
+  fclose(img);
+  if (sub) fclose(sub);
+
+  if (!(ctl=fopen(ctlname,"w"))) die("cannot open file '%s'",ctlname);
+  if (format==RAW_FORMAT_CCD) write_ccd(ctl,toc,modes);
+  else write_cue(ctl,imgname,toc,modes);
+  fclose(ctl);
+  fprintf(stderr,"%s written to: %s\n",
+	  (format==RAW_FORMAT_CCD ? "CloneCD control file" : "CUE sheet"),
+	  ctlname);
+
+  if (md5_mode) {
+    MD5Final((unsigned char*)digest,&md5);
+    md2str((unsigned char*)digest,digest_text);
+    fprintf(stderr,"MD5 (%s) = %s\n",imgname,digest_text);
+  }
+
+  free(imgname);
+  free(subname);
+  free(ctlname);
+  free(base);
+  free(buffer);
+
+  return total_bad;
+}
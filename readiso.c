@@ -70,6 +70,7 @@ static struct option long_options[] = {
   {"help",0,0,'h'},
   {"info",0,0,'i'},
   {"device",1,0,'d'},
+  {"output",1,0,'o'},
   {"track",1,0,'t'},
   {"force",1,0,'f'},
   {"md5",0,0,'m'},
@@ -77,66 +78,39 @@ static struct option long_options[] = {
   {"dump",1,0,'c'},
 #ifdef IRIX
   {"dumpaudio",1,0,'C'},
-  {"aiff",0,0,'a'},
-  {"aiffc",0,0,'A'},
   {"sound",0,0,'s'},
 #endif
+  {"aiff",0,0,'a'},
+  {"aiffc",0,0,'A'},
+  {"wav",0,0,'w'},
+  {"no-jitter",0,0,'J'},
+  {"c2",0,0,'E'},
+  {"accuraterip",0,0,'R'},
   {"version",0,0,'V'},
-  {"scanbus",0,0,'S'},
+  {"scanbus",2,0,'S'},
+  {"file-hashes",1,0,'H'},
+  {"list",0,0,'l'},
+  {"allocated-only",0,0,'u'},
+  {"all-tracks",0,0,'T'},
+  {"raw",2,0,'r'},
+  {"ecc",0,0,'e'},
+  {"passes",1,0,'P'},
+  {"cache",1,0,'K'},
+  {"serve",1,0,'N'},
+  {"profiles",1,0,'F'},
+  {"no-profiles",0,0,'G'},
+  {"timeline",1,0,'Y'},
+  {"latency",0,0,'L'},
+  {"latency-json",1,0,'j'},
+  {"stages",0,0,'g'},
+  {"record",1,0,'k'},
+  {"replay-scale",1,0,'z'},
   {NULL,0,0,0}
 };
 
 
 /************************************************************************/
 
-char *md2str(unsigned char *digest, char *s)
-{
-  int i;
-  char buf[16],*r;
-
-  if (!digest) return NULL;
-  if (!s) {
-    s=(char*)malloc(33);
-    if (!s) return NULL;
-  }
-
-  r=s;
-  for (i = 0; i < 16; i++) {
-    sprintf (buf,"%02x", digest[i]);
-    *(s++)=buf[0];
-    *(s++)=buf[1];
-  }
-  *s=0;
-
-  return r;
-}
-
-
-void die(char *format, ...)
-{
-  va_list args;
-
-  fprintf(stderr, PRGNAME ": ");
-  va_start(args,format);
-  vfprintf(stderr, format, args);
-  va_end(args);
-  fprintf(stderr,"\n");
-  fflush(stderr);
-  exit(1);
-}
-
-void warn(char *format, ...)
-{
-  va_list args;
-
-  fprintf(stderr, PRGNAME ": ");
-  va_start(args,format);
-  vfprintf(stderr, format, args);
-  va_end(args);
-  fprintf(stderr,"\n");
-  fflush(stderr);
-}
-
 
 void p_usage(void) 
 {
@@ -147,249 +121,85 @@ void p_usage(void)
 	  "Usage: " PRGNAME " [options] <imagefile>\n\n"
 	  "  -d<device>, --device=<device>\n"
           "                  specifies the scsi device to use (default: " DEFAULT_DEV ")\n"
+	  "                  (several times to read several drives at once)\n"
+	  "  -o<pattern>, --output=<pattern>\n"
+	  "                  image files with several drives, %%d is replaced\n"
+	  "                  with drive number and %%s with device name\n"
 	  "  -h, --help      display this help and exit\n"
 	  "  -i, --info      only display TOC record and ISO9660 image info\n"
+	  "  -l, --list      list files on the image (ISO9660 or UDF)\n"
 	  "  -v, --verbose   verbose mode\n"
           "  -m, --md5       calculate MD5 checksum for imagefile\n"
 	  "  -M, --MD5       calculate MD5 checksum for disc (don't create\n"
 	  "                  image file).\n"
 	  "  --dump=<lba,n>  dumb (copy) 'n' sectors from cd, starting from 'lba'\n"
+	  "                  (several ranges: lba,n:lba,n... or @<file>)\n"
 	  "  --force=<mode>  force program to trust blindly either ISO primary\n"
 	  "                  descriptor or TOC record for the size of image.\n"
           "                  mode = 1 (trust ISO primary descriptor)\n"
 	  "                         2 (trust TOC record)\n"
 	  "  --track=<n>     reads specified track (default is first data track found)\n"
-	  "  --scanbus       scan SCSI bus and exit\n"
+	  "  --all-tracks    read all tracks in one pass into separate files\n"
+	  "                  (<imagefile>-NN.iso/.bin/.cdda) and write CUE sheet\n"
+	  "  --ecc           read data track as raw sectors, check EDC and repair\n"
+	  "                  errors with ECC (re-read if not correctable)\n"
+	  "  --passes=<n>    (implies --ecc) re-read blocks that cannot be\n"
+	  "                  corrected <n> times at different speeds after the\n"
+	  "                  image has been read, and merge the copies by\n"
+	  "                  majority vote. results go to <imagefile>.log\n"
+	  "  --cache=<mb>    size of the block cache in megabytes (default: %d,\n"
+	  "                  0 disables the cache)\n"
+	  "  --profiles=<file>\n"
+	  "                  drive profile file (default: ~/" PROFILE_FILE ")\n"
+	  "  --no-profiles   probe the drive every time (don't use profiles)\n"
+	  "  --timeline=<file>\n"
+	  "                  write time, LBA, size, latency and speed of every\n"
+	  "                  read to <file> (CSV), and speeds per disc zone\n"
+	  "  --latency       print latency percentiles of scsi commands at exit\n"
+	  "  --latency-json=<file>\n"
+	  "                  write the command latencies to <file> (JSON)\n"
+	  "  --stages        report time spent waiting for the drive, in checksums\n"
+	  "                  and writing, and which of them limits the speed\n"
+	  "  --record=<file> record all scsi commands and replies to <file>, the\n"
+	  "                  session can be replayed with -d " REPLAY_PREFIX "<file>\n"
+	  "  --replay-scale=<x>\n"
+	  "                  multiply latencies of replayed sessions by <x>\n"
+	  "                  (default: 1.0, 0 = no delays)\n"
+	  "  --serve=<socket>\n"
+	  "                  serve the data track to local clients (NBD protocol)\n"
+	  "                  over Unix socket <socket> (no image file)\n"
+	  "  --raw[=<fmt>]   read whole disc as raw 2352 byte sectors, fmt is:\n"
+	  "                  bin (BIN + CUE, default) or ccd (IMG + SUB + CCD)\n"
+	  "  --file-hashes=<file>\n"
+	  "                  write MD5 and SHA-256 checksums of every file on the\n"
+	  "                  ISO9660 image to <file> (computed while reading)\n"
+	  "  --allocated-only\n"
+	  "                  read only allocated blocks of UDF volume (unallocated\n"
+	  "                  blocks are left as holes in the image file)\n"
+	  "  --scanbus[=format]\n"
+	  "                  scan SCSI bus and exit, format can be text (default)\n"
+	  "                  or csv\n"
 	  "  --version       display program version and exit\n"
-#ifdef IRIX
 	  " CD-DA parameters:\n"
+#ifdef IRIX
 	  "  --dumpaudio=<lba,n>\n"
 	  "                  dump raw audio sectors with subcode-q data\n"
-	  "  --aiff          select AIFF as output file format\n"
-	  "  --aiffc         select AIFF-C as output file format\n"
 #endif	  
+	  "  --aiff          select AIFF as output file format\n"
+	  "  --aiffc         select AIFF-C as output file format (default)\n"
+	  "  --wav           select WAV as output file format\n"
+	  "  --no-jitter     disable jitter correction (overlapping reads)\n"
+	  "  --c2            check C2 error pointers and subchannel Q CRC,\n"
+	  "                  re-read blocks with errors\n"
+	  "  --accuraterip   write AccurateRip (v1/v2) and CRC32 checksums of\n"
+	  "                  audio tracks to <imagefile>.csv\n"
 
-	  "\n");
+	  "\n",CACHE_DEFAULT_MB);
 
   exit(1);
 }
 
 
-
-
-int inquiry(char *manufacturer, char *model, char *revision) {
-  int i, result;
-  unsigned char bytes[255];
-  int replylen = sizeof(bytes);
-
-  manufacturer[0]=model[0]=revision[0]=0;
-
-  result = scsi_request("inquiry",bytes,&replylen,6,0,SCSIR_READ,
-			INQUIRY, /* 0 */
-			0,0,0,255,0);
-
-  if (result) return -1;
-
-  for(i=35;i>32;i--) if(bytes[i]!=' ') break;
-  bytes[i+1]=0;
-  strncpy(revision,(const char*)&bytes[32],5);
-
-  for(i=31;i>16;i--) if(bytes[i]!=' ') break;
-  bytes[i+1]=0;
-  strncpy(model,(const char*)&bytes[16],17);
-
-  for(i=15;i>8;i--) if(bytes[i]!=' ') break;
-  bytes[i+1]=0;
-  strncpy(manufacturer,(const char*)&bytes[8],9);
-
-  return bytes[0];
-}
-
-
-int mode_sense(unsigned char *buf, int *buflen)
-{
-  int len = *buflen;
-  if (len >255) len=255;
-  return scsi_request("mode_sense(6)",buf,buflen,6,0,SCSIR_READ|SCSIR_QUIET,
-		      MODESENSE,0,0x01,0,len,0);
-}
-
-int mode_sense10(unsigned char *buf, int *buflen)
-{
-  int len = *buflen;
-  if (len >65000) len=65000;
-  return scsi_request("mode_sense(10)",buf,buflen,10,0,SCSIR_READ,
-		      MODESENSE10,0,0x01,0,0,0,0,B2(len),0);
-}
-
-int read_capacity(int *lba, int *bsize)
-{
-  char buf[256];
-  int r,len = 255;
-  if (!lba || !bsize) return -1;
-
-  
-  r = scsi_request("read_capacity",buf,&len,10,0,SCSIR_READ,
-		   READCAPACITY,0,B4(0),0,0,0x00,0);
-
-  if (r) return r;
-  *lba=V4(&buf[0]);
-  *bsize=V4(&buf[4]);
-  /* fprintf(stderr,"readcapacity: lba=%d bsize=%d\n",*lba,*bsize); */
-  return 0;
-}
-
-int get_block_size()
-{
-  char buf[255];
-  int len,lba=0,bsize=0;
-
-  read_capacity(&lba,&bsize);
-
-  len=255;
-  if (mode_sense(buf,&len)==0 && buf[3]>=8) {
-    return V3(&buf[4+5]);
-  }
-
-  if (mode_sense10(buf,&len)==0 && V2(&buf[6])>=8) {
-    return V3(&buf[8+5]);
-  }
-
-  if (read_capacity(&lba,&bsize)==0) {
-    return bsize;
-  }
-
-  return -1;
-}
-
-
-
-int start_stop(int start)
-{
-  return scsi_request((start?"start_unit":"stop_unit"),0,0,6,0,SCSIR_WRITE,
-		      STOPUNIT,0,0,0,(start?1:0),0);
-}
-
-
-int set_removable(int removable)
-{
-  return scsi_request("set_removable",0,0,6,0,SCSIR_WRITE,
-		      REMOVAL,0,0,0,(removable?0:1),0);
-}
-
-
-int test_ready()
-{
-  return scsi_request("test_unit_ready",0,0,6,0,SCSIR_WRITE|SCSIR_QUIET,
-		      TESTREADY,0,0,0,0,0);
-}
-
-
-int read_toc(unsigned char *buf, int *buflen, int mode)
-{
-  int result;
-  int len,i,o;
-
-
-  result=scsi_request("read_toc",buf,buflen,10,0,SCSIR_READ,
-		      READTOC,0,0,0,0,0,
-		      0,
-		      B2(*buflen),
-		      0);
-
-  if (result || !mode) return result;
-
-  len=V2(&buf[0]); 
-  printf("\nTracks: %d \t (first=%02d last=%02d)\n",
-	(buf[3]-buf[2])+1,buf[2],buf[3]);
-  
-  for (i=0;i<((len-2)/8)-1;i++) {
-    o=4+i*8; /* offset to track descriptor */
-    printf("Track %02d: %s (adr/ctrl=%02xh) begin=%06d end=%06d  "
-           "length<=%06d\n",
-	   i+1,(buf[o+1]&DATA_TRACK?"data ":"audio"),buf[o+1],V4(&buf[o+4]),
-	   V4(&buf[o+4+8]),V4(&buf[o+4+8])-V4(&buf[o+4]) );
-
-  }
-
-  return result;
-}
-
-
-int read_10(int lba, int len, unsigned char *buf, int *buflen)
-{
-  return scsi_request("read_10",buf,buflen,10,0,SCSIR_READ,
-		      READ10, 0,
-		      B4(lba),
-		      0,
-		      B2(len),
-		      0);
-
-}
-
-
-int mode_select(int bsize, int density)
-{
-  return scsi_request("mode_select",0,0,6,12,SCSIR_WRITE,
-		     MODESELECT,0x10,0,0,12,0,
-		     0,0,0,8,
-		     density,B3(0),0,B3(bsize) );
-}
-
-void scan_bus()
-{
-  char vendor[9],model[17],rev[5];
-  char d[1024];
-  int bus,dev,type;
-  
-  int firstbus,lastbus;
-  int firstdev,lastdev;
-
-  firstbus=0;
-  firstdev=0;
-  lastbus=0;
-  lastdev=0;
-
-#ifdef LINUX
-  lastdev=16;
-#endif
-#ifdef IRIX
-  firstdev=1;
-  lastdev=15;
-  lastbus=1;
-#endif
-
-  printf("Device                   Manufacturer  Model              Revision\n"
-	 "-----------------------  ------------- ------------------ --------\n"
-	 );
-
-  for (bus=firstbus;bus<=lastbus;bus++) {
-
-    for (dev=firstdev;dev<=lastdev;dev++) {
-#ifdef LINUX
-      snprintf(d,1024,"/dev/sg%c",'a'+dev);
-#else
-      snprintf(d,1024,"/dev/scsi/sc%dd%dl0",bus,dev);
-#endif
-      /* fprintf(stderr,"try: '%s'\n",d); */
-
-      if (scsi_open(d)==0) {
-	if ((type=inquiry(vendor,model,rev))>=0) {
-	  type=type&0x1f;
-	  printf("%-23s  %-13s %-18s %-8s %s\n",d,vendor,model,rev,
-		 (type==0x5?"[CD-ROM]":""));
-	}
-	scsi_close();
-      }
-
-    }
-
-  }
-    
-    
-}
-
-
 #ifdef IRIX
 void playaudio(void *arg, CDDATATYPES type, short *audio)
 {
@@ -397,6 +207,16 @@ void playaudio(void *arg, CDDATATYPES type, short *audio)
   if (!dump_mode) AFwriteframes(aiffoutfile,AF_DEFAULT_TRACK,audio,
 				CDDA_NUMSAMPLES/2);
 }
+
+static CDPARSER *dump_parser;
+
+void dumpaudio(unsigned char *block)
+{
+  CDFRAME buf;
+
+  memcpy(&buf,block,CDDA_BLOCKSIZE);
+  CDparseframe(dump_parser,&buf);
+}
 #endif
 
 
@@ -408,6 +228,9 @@ int main(int argc, char **argv)
 {
   iso_primary_descriptor_type  ipd;
   char *dev = default_dev;
+  char *devs[MAX_DRIVES];
+  int dev_count = 0;
+  char *out_pattern = NULL;
   char vendor[9],model[17],rev[5];
   unsigned char reply[1024];
   char tmpstr[255];
@@ -416,21 +239,50 @@ int main(int argc, char **argv)
   int info_only = 0;
   unsigned char *buffer;
   int buffersize = READBLOCKS*BLOCKSIZE;
+  int readblocks = READBLOCKS;
+  int media = 0;
+  int64 capacity = -1;
+  char *timeline_name = NULL;
+  char *latency_json = NULL;
+  char *record_name = NULL;
+  int latency_mode = 0;
   int start,stop,imagesize=0,tracksize=0;
   int counter = 0;
-  long readsize = 0;
-  long imagesize_bytes = 0;
+  int64 readsize = 0;
+  int64 imagesize_bytes = 0;
   int drive_block_size, init_bsize;
   int force_mode = 0;
   int scanbus_mode = 0;
-  int dump_start, dump_count;
+  int scan_format = SCAN_TEXT;
+  block_map_type *dump_map = NULL;
   MD5_CTX *MD5; 
+  char *filehash_name = NULL;
+  file_index_type *file_index = NULL;
+  FILE *filehash_file;
+  int list_mode = 0;
+  int alloc_mode = 0;
+  int all_tracks = 0;
+  int raw_format = 0;
+  int ecc_mode = 0;
+  int passes = 0;
+  int cache_mb = CACHE_DEFAULT_MB;
+  char *serve_path = NULL;
+  char *profile_file = profile_default_file();
+  drive_profile_type profile;
+  int have_profile = 0;
+  block_map_type *flagged = NULL;
+  FILE *rescue_log;
+  int iso_valid = 0;
+  udf_volume_type *udf = NULL;
+  block_map_type *used_map = NULL;
+  static unsigned char zero_block[BLOCKSIZE];
   char digest[16],digest_text[33];
   int md5_mode = 0;
   int opt_index = 0;
   int audio_track = 0;
   int readblocksize = BLOCKSIZE;
   int file_format = AF_FILE_AIFFC;
+  int audio_flags = AUDIO_JITTER;
 #ifdef IRIX
   CDPARSER *cdp = CDcreateparser();
   CDFRAME  cdframe;
@@ -438,12 +290,16 @@ int main(int argc, char **argv)
   int dev_type;
   int i,c,o;
   int len;
-  int start_time,cur_time,kbps;
+  double start_time,cur_time,stage_t;
+  int kbps;
 
   if (rcsid); 
 
   MD5 = malloc(sizeof(MD5_CTX));
-  buffer=(unsigned char*)malloc(READBLOCKS*AUDIOBLOCKSIZE);
+  buffer=(unsigned char*)malloc(MAXREADBLOCKS*AUDIOBLOCKSIZE >
+				MAXTRANSFER*BLOCKSIZE ?
+				MAXREADBLOCKS*AUDIOBLOCKSIZE :
+				MAXTRANSFER*BLOCKSIZE);
   if (!buffer || !MD5) die("No memory");
 
   if (argc<2) die("parameter(s) missing\n"
@@ -452,7 +308,7 @@ int main(int argc, char **argv)
  
   /* parse command line parameters */
   while(1) {
-    if ((c=getopt_long(argc,argv,"SMmvhid:",long_options,&opt_index))
+    if ((c=getopt_long(argc,argv,"SMmvhild:o:",long_options,&opt_index))
 	== -1) break;
     switch (c) {
     case 'a':
@@ -461,6 +317,18 @@ int main(int argc, char **argv)
     case 'A':
       file_format=AF_FILE_AIFFC;
       break;
+    case 'w':
+      file_format=AF_FILE_WAVE;
+      break;
+    case 'J':
+      audio_flags&=~AUDIO_JITTER;
+      break;
+    case 'E':
+      audio_flags|=AUDIO_C2;
+      break;
+    case 'R':
+      audio_flags|=AUDIO_ACCURATERIP;
+      break;
     case 'v':
       verbose_mode=1;
       break;
@@ -468,7 +336,11 @@ int main(int argc, char **argv)
       p_usage();
       break;
     case 'd':
-      dev=strdup(optarg);
+      if (dev_count >= MAX_DRIVES) die("too many devices (max %d)",MAX_DRIVES);
+      dev=devs[dev_count++]=strdup(optarg);
+      break;
+    case 'o':
+      out_pattern=strdup(optarg);
       break;
     case 't':
       if (sscanf(optarg,"%d",&trackno)!=1) trackno=0;
@@ -477,17 +349,13 @@ int main(int argc, char **argv)
       info_only=1; 
       break;
     case 'c':
-      if (sscanf(optarg,"%d,%d",&dump_start,&dump_count)!=2)
-	die("invalid parameters");
-      dump_mode=1;
-      break;
 #ifdef IRIX
     case 'C':
-      if (sscanf(optarg,"%d,%d",&dump_start,&dump_count)!=2)
-	die("invalid parameters");
-      dump_mode=2;
-      break;
 #endif
+      if (!dump_map && !(dump_map=blockmap_new())) die("No memory");
+      if (dump_parse_ranges(optarg,dump_map)) die("invalid parameters");
+      dump_mode=(c=='c' ? 1 : 2);
+      break;
     case 'f':
       if (sscanf(optarg,"%d",&force_mode)!=1) die("invalid parameters");
       if (force_mode<1 || force_mode >2) {
@@ -505,6 +373,65 @@ int main(int argc, char **argv)
       break;
     case 'S':
       scanbus_mode=1;
+      if (!optarg || !strcmp(optarg,"text")) scan_format=SCAN_TEXT;
+      else if (!strcmp(optarg,"csv")) scan_format=SCAN_CSV;
+      else die("invalid scanbus format '%s'",optarg);
+      break;
+    case 'H':
+      filehash_name=strdup(optarg);
+      break;
+    case 'l':
+      list_mode=1;
+      break;
+    case 'u':
+      alloc_mode=1;
+      break;
+    case 'T':
+      all_tracks=1;
+      break;
+    case 'e':
+      ecc_mode=1;
+      break;
+    case 'P':
+      if (sscanf(optarg,"%d",&passes)!=1 || passes<1 || passes>MAX_PASSES)
+	die("invalid number of passes");
+      ecc_mode=1;
+      break;
+    case 'K':
+      if (sscanf(optarg,"%d",&cache_mb)!=1 || cache_mb<0)
+	die("invalid cache size");
+      break;
+    case 'N':
+      serve_path=strdup(optarg);
+      break;
+    case 'F':
+      profile_file=strdup(optarg);
+      break;
+    case 'G':
+      profile_file=NULL;
+      break;
+    case 'Y':
+      timeline_name=strdup(optarg);
+      break;
+    case 'L':
+      latency_mode=1;
+      break;
+    case 'j':
+      latency_json=strdup(optarg);
+      break;
+    case 'g':
+      stage_enable();
+      break;
+    case 'k':
+      record_name=strdup(optarg);
+      break;
+    case 'z':
+      replay_set_scale(atof(optarg));
+      break;
+    case 'r':
+      if (!optarg || !strcmp(optarg,"bin")) raw_format=RAW_FORMAT_BIN;
+      else if (!strcmp(optarg,"ccd")) raw_format=RAW_FORMAT_CCD;
+      else die("invalid raw format '%s'",optarg);
       break;
     case 'V':
       printf(PRGNAME " "  VERSION "  " HOST_TYPE
@@ -522,7 +449,53 @@ int main(int argc, char **argv)
   }
 
 
-  if (!info_only) {
+  if (all_tracks && raw_format) 
+    die("--all-tracks and --raw cannot be used together");
+
+  if (passes && md5_mode==2) 
+    die("--passes cannot be used with --MD5");
+
+  if ((latency_mode || latency_json) && 
+      latency_enable(latency_mode,latency_json))
+    die("cannot open latency file '%s'",latency_json);
+
+  if (dev_count > 1 || out_pattern) {
+    /* several drives at once */
+    if (info_only || list_mode || scanbus_mode || dump_mode || all_tracks || 
+	raw_format || ecc_mode || serve_path || filehash_name || alloc_mode ||
+	trackno || force_mode || timeline_name || record_name)
+      die("-o (multiple drives) can only be used to read images");
+    if (!out_pattern && md5_mode!=2) die("output file name pattern missing");
+    if (dev_count > 1 && out_pattern && md5_mode!=2 &&
+	!strstr(out_pattern,"%d") && !strstr(out_pattern,"%s"))
+      die("output file name pattern must contain %%d or %%s");
+    if (!dev_count) devs[dev_count++]=dev;
+#ifdef HAVE_LIBPTHREAD
+    printf("readiso(9660) " VERSION "\n");
+    fflush(stdout);
+    i=rip_multi(devs,dev_count,out_pattern,md5_mode);
+    stage_report(stderr);
+    return (i > 0 ? 1 : 0);
+#else
+    die("reading several drives at once is not supported on this system");
+#endif
+  }
+
+  if (scanbus_mode) {
+    /* default device is not needed */
+    if (scan_format == SCAN_TEXT) printf("readiso(9660) " VERSION "\n\n");
+    scan_bus(scan_format);
+    exit(0);
+  }
+
+  if (serve_path) {
+    if (all_tracks || raw_format || dump_mode || md5_mode)
+      die("--serve cannot be used with other read modes");
+  }
+  else if ((all_tracks || raw_format) && !info_only) {
+    if (!argv[optind]) die("image file name missing");
+  }
+  else if (!info_only) {
     if (md5_mode==2) outfile=fopen("/dev/null","w");
     else outfile=fopen(argv[optind],"w");
     if (!outfile) {
@@ -533,14 +506,16 @@ int main(int argc, char **argv)
 
   printf("readiso(9660) " VERSION "\n");
 
+  if (timeline_name && timeline_open(timeline_name))
+    die("cannot open timeline file '%s'",timeline_name);
+  if (record_name && record_open(record_name))
+    die("cannot open session file '%s'",record_name);
+
+  if (cache_mb > 0 && cache_init(cache_mb)) 
+    warn("cannot allocate %dMb cache, cache disabled.",cache_mb);
+
   /* open the scsi device */
   if (scsi_open(dev)) die("error opening scsi device '%s'",dev); 
-
-  if (scanbus_mode) {
-    printf("\n");
-    scan_bus();
-    exit(0);
-  }
   
   memset(reply,0,sizeof(reply));
   if ((dev_type=inquiry(vendor,model,rev))<0) 
@@ -555,14 +530,20 @@ int main(int argc, char **argv)
     die("Device doesn't seem to be a CD-ROM!");
   }
 
+  profile_init(&profile,vendor,model,rev);
+  if (profile_file && profile_load(profile_file,&profile)==0) {
+    have_profile=1;
+    if (verbose_mode) printf("Using drive profile from %s\n",profile_file);
+  }
+
 #ifdef IRIX
   if (strcmp(vendor,"TOSHIBA")) {
     warn("NOTE! Audio track reading probably not supported on this device.\n");
   }
 #endif
 
-  test_ready();
-  if (test_ready()!=0) {
+  /* first command after a disc change may fail (unit attention) */
+  if (test_ready()!=0 && test_ready()!=0) {
     sleep(2);
     if (test_ready()!=0)  die("device not ready");
   }
@@ -607,48 +588,60 @@ int main(int argc, char **argv)
   if (dump_mode==2) init_bsize=AUDIOBLOCKSIZE;
   else init_bsize=BLOCKSIZE;
 
-  start_stop(0);
-
-  if ( (drive_block_size=get_block_size()) < 0 ) {
-    warn("cannot get current block size");
+  if (have_profile && get_block_size_cmd(&profile.bsize_cmd) == init_bsize) {
+    /* known drive already using the right block size, no need to
+       stop the disc for MODE SELECT */
     drive_block_size=init_bsize;
   }
+  else {
+    start_stop(0);
+    profile.bsize_cmd=0;
+
+    if ( (drive_block_size=get_block_size_cmd(&profile.bsize_cmd)) < 0 ) {
+      warn("cannot get current block size");
+      drive_block_size=init_bsize;
+    }
+
+    if (drive_block_size != init_bsize) {
+      mode_select(init_bsize,(dump_mode==2?0x82:0x00));
+      drive_block_size=get_block_size_cmd(&profile.bsize_cmd);
+      if (drive_block_size!=init_bsize) warn("cannot set drive block size.");
+    }
+
+    start_stop(1);
+    if (profile_file && profile.bsize_cmd &&
+	profile_save(profile_file,&profile))
+      warn("cannot save drive profile to %s",profile_file);
+  }
 
-  if (drive_block_size != init_bsize) {
-    mode_select(init_bsize,(dump_mode==2?0x82:0x00));
-    drive_block_size=get_block_size();
-    if (drive_block_size!=init_bsize) warn("cannot set drive block size.");
+  cache_set_block_size(drive_block_size);
+
+  /* DVD and BD media are read with READ(12) and larger transfers */
+  if (get_configuration(&media)==0 &&
+      (media_class(media)==MEDIA_DVD || media_class(media)==MEDIA_BD)) {
+    set_read_12(1);
+    readblocks=media_read_blocks(media_class(media));
+    buffersize=readblocks*BLOCKSIZE;
   }
 
-  start_stop(1);
+  /* speeds are summarized per zone of the whole disc */
+  if (timeline_active() && (capacity=disc_capacity()) > 0)
+    timeline_range(0,(int)capacity);
 
   if (dump_mode && !info_only) {
 #ifdef IRIX
-    CDFRAME buf;
     if (dump_mode==2) {
       if (cdp) {
 	CDaddcallback(cdp, cd_audio, (CDCALLBACKFUNC)playaudio, 0);
+	dump_parser=cdp;
       } else die("No audioparser");
     }
+    dump_ranges(dump_map,init_bsize,outfile,
+		(dump_mode==2 ? dumpaudio : NULL));
+#else
+    dump_ranges(dump_map,init_bsize,outfile,NULL);
 #endif
-    fprintf(stderr,"Dumping %d sector(s) starting from LBA=%d\n",
-	    dump_count,dump_start);
-    for (i=dump_start;i<dump_start+dump_count;i++) {
-      len=buffersize;
-      read_10(i,1,buffer,&len);
-      if (len<init_bsize) break;
-
-#ifdef IRIX
-      if (dump_mode==2) {
-	memcpy(&buf,buffer,CDDA_BLOCKSIZE);
-	CDparseframe(cdp,&buf);
-      }
-#endif
-	
-      fwrite(buffer,len,1,outfile); 
-      fprintf(stderr,".");
-    }
-    fprintf(stderr,"\ndone.\n");
+    fprintf(stderr,"done.\n");
     
     goto quit;
   }
@@ -658,6 +651,21 @@ int main(int argc, char **argv)
   replylen=sizeof(reply);
   read_toc(reply,&replylen,verbose_mode);
   printf("\n");
+  if (timeline_active() && capacity <= 0 && replylen >= 12)
+    timeline_range(0,V4(&reply[4+(reply[3]-reply[2]+1)*8+4]));
+
+  if (all_tracks && !info_only) {
+    if (rip_all_tracks(reply,argv[optind],md5_mode,audio_flags) > 0)
+      fprintf(stderr,"Some tracks are not complete!\n");
+    goto quit;
+  }
+
+  if (raw_format && !info_only) {
+    if (rip_raw_disc(reply,argv[optind],raw_format,md5_mode) > 0)
+      fprintf(stderr,"Image not complete!\n");
+    else fprintf(stderr,"Image complete.\n");
+    goto quit;
+  }
 
   if (trackno==0) { /* try to find first data track */
     for (i=0;i<(reply[3]-reply[2]+1);i++) {
@@ -674,11 +682,13 @@ int main(int argc, char **argv)
     
   if ( ((reply[(trackno-1)*8+4+1]&DATA_TRACK)==0) ) {
     fprintf(stderr,"Not a data track.\n");
+#ifdef IRIX
     mode_select(AUDIOBLOCKSIZE,0x82);
     if (mode_sense(reply,&replylen)!=0) die("cannot get sense data");
     drive_block_size=V3(&reply[9]);
+#endif
     fprintf(stderr,"Selecting CD-DA mode, output file format: %s\n",
-	    file_format==AF_FILE_AIFFC?"AIFFC":"AIFF");
+	    audio_format_name(file_format));
     audio_track=1;
   } else {
     audio_track=0;
@@ -690,6 +700,34 @@ int main(int argc, char **argv)
   tracksize=abs(stop-start);
   /* if (verbose_mode) printf("Start LBA=%d\nStop  LBA=%d\n",start,stop); */
 
+  if (serve_path && !info_only) {
+    if (audio_track) die("--serve works only with data tracks");
+    serve_disc(serve_path,start,tracksize);
+    goto quit;
+  }
+
+#ifndef IRIX
+  if (audio_track) {
+    /* audio tracks are read with READ CD */
+    if (!info_only) {
+      fclose(outfile);
+      /* first and last audio track are needed for AccurateRip */
+      for (i=0,o=0;i<(reply[3]-reply[2]+1);i++) {
+	if (reply[4+i*8+1]&DATA_TRACK) continue;
+	if (!o++ && i+1==trackno) audio_flags|=AUDIO_FIRST;
+	if (i+1==trackno) audio_flags|=AUDIO_LAST;
+	else audio_flags&=~AUDIO_LAST;
+      }
+      if (rip_audio_track(trackno,start,tracksize,
+			  (md5_mode==2?NULL:argv[optind]),
+			  file_format,md5_mode,audio_flags) > 0)
+	fprintf(stderr,"Track not complete!\n");
+      else fprintf(stderr,"Track complete.\n");
+    }
+    goto quit;
+  }
+#endif
+
   len=buffersize;
   read_10(start-0,1,buffer,&len);
   /* PRINT_BUF(buffer,32); */
@@ -704,17 +742,33 @@ int main(int argc, char **argv)
     memcpy(&ipd,buffer,sizeof(ipd));
     
     imagesize=ISONUM(ipd.volume_space_size);
+    iso_valid=(imagesize<=(stop-start) && imagesize>=1);
+
+    /* look for UDF filesystem (UDF only or UDF bridge disc) */
+    if ((udf=udf_open(start,tracksize,0))) {
+      fprintf(stderr,"UDF filesystem found.\n");
+      if (udf->volume_size > tracksize) {
+	warn("UDF volume larger than track, ignoring UDF.");
+	udf_close(udf);
+	udf=NULL;
+      }
+    }
     
     /* we should really check here if we really got a valid primary 
        descriptor or not... */
-    if ( (imagesize>(stop-start)) || (imagesize<1) ) {
+    if (!iso_valid && udf) {
+      imagesize=udf->volume_size;
+    } else if (!iso_valid) {
       fprintf(stderr,"\aInvalid ISO primary descriptor!!!\n");
       if (!info_only) fprintf(stderr,"Copying entire track to image file.\n");
       force_mode=2;
+    } else if (udf && udf->volume_size > imagesize) {
+      imagesize=udf->volume_size;
     }
     
     if (force_mode==1) {} /* use size from ISO primary descriptor */
     else if (force_mode==2) imagesize=tracksize; /* use size from TOC */
+    else if (udf) {} /* UDF volume size can be trusted */
     else {
       if (  ( (tracksize-imagesize) > MAX_DIFF_ALLOWED ) || 
 	    ( imagesize > tracksize )  )   {
@@ -729,10 +783,10 @@ int main(int argc, char **argv)
       }
     }
 
-    imagesize_bytes=imagesize*BLOCKSIZE;
+    imagesize_bytes=(int64)imagesize*BLOCKSIZE;
     
 
-    if (verbose_mode||info_only) {
+    if ((verbose_mode||info_only) && (iso_valid || !udf)) {
       printf("ISO9660 image info:\n");
       printf("Type:              %02xh\n",ipd.type[0]);  
       ISOGETSTR(tmpstr,ipd.id,5);
@@ -762,27 +816,86 @@ int main(int argc, char **argv)
       if (!NULLISODATE(ipd.effective_date))
 	printf("Effective date:    %s\n",tmpstr);
       
-      printf("Image size:        %02d:%02d:%02d, %d blocks (%ld bytes)\n",
+      printf("Image size:        %02d:%02d:%02d, %d blocks (%lld bytes)\n",
 	      LBA_MIN(ISONUM(ipd.volume_space_size)),
 	      LBA_SEC(ISONUM(ipd.volume_space_size)),
 	      LBA_FRM(ISONUM(ipd.volume_space_size)),
 	      ISONUM(ipd.volume_space_size),
-	      (long)ISONUM(ipd.volume_space_size)*BLOCKSIZE
+	      (int64)ISONUM(ipd.volume_space_size)*BLOCKSIZE
 	     );
-      printf("Track size:        %02d:%02d:%02d, %d blocks (%ld bytes)\n",
+    }
+    if ((verbose_mode||info_only) && udf) udf_print_info(udf);
+    if (verbose_mode||info_only) {
+      printf("Track size:        %02d:%02d:%02d, %d blocks (%lld bytes)\n",
 	      LBA_MIN(tracksize),
 	      LBA_SEC(tracksize),
 	      LBA_FRM(tracksize),
 	      tracksize,
-	      (long)tracksize*BLOCKSIZE
+	      (int64)tracksize*BLOCKSIZE
 	     );
+      if (media) printf("Media:             %s\n",media_profile_name(media));
+      if ((capacity=disc_capacity()) > 0)
+	printf("Disc capacity:     %lld blocks (%lld bytes)\n",capacity,
+	       capacity*BLOCKSIZE);
     }
+
+    if ((filehash_name && !info_only) || list_mode) {
+      if (udf) {
+	fprintf(stderr,"Reading UDF directory tree...\n");
+	if (!(file_index=fileindex_new())) die("No memory");
+	if (udf_build_file_index(udf,file_index) < 0) {
+	  warn("cannot read directory tree, no file checksums.");
+	  fileindex_free(file_index);
+	  file_index=NULL;
+	} else {
+	  fprintf(stderr,"%d file(s) found.\n",file_index->file_count);
+	}
+      } else if (ISONUM(ipd.volume_space_size) != imagesize) {
+	warn("cannot trust ISO9660 directory tree, no file checksums.");
+      } else {
+	fprintf(stderr,"Reading ISO9660 directory tree...\n");
+	if (!(file_index=fileindex_new())) die("No memory");
+	if (iso_build_file_index(&ipd,start,imagesize,file_index) < 0) {
+	  warn("cannot read directory tree, no file checksums.");
+	  fileindex_free(file_index);
+	  file_index=NULL;
+	} else {
+	  fprintf(stderr,"%d file(s) found.\n",file_index->file_count);
+	}
+      }
+      if (list_mode && file_index) fileindex_list(file_index,stdout);
+      if (!filehash_name || info_only) {
+	fileindex_free(file_index);
+	file_index=NULL;
+      }
+    }
+
+    if (alloc_mode && !info_only) {
+      if (!udf) {
+	warn("no UDF volume, reading the whole image.");
+      } else {
+	fprintf(stderr,"Reading UDF space allocation...\n");
+	if (!(used_map=blockmap_new())) die("No memory");
+	if (udf_used_blocks(udf,used_map) ||
+	    (iso_valid && iso_used_blocks(start,imagesize,used_map))) {
+	  warn("cannot read space allocation, reading the whole image.");
+	  blockmap_free(used_map);
+	  used_map=NULL;
+	} else {
+	  blockmap_normalize(used_map,0);
+	  fprintf(stderr,"%ld of %d blocks allocated.\n",
+		  blockmap_blocks(used_map),imagesize);
+	}
+      }
+    }
+    udf_close(udf);
   } else { 
 #ifdef IRIX
     /* if reading audio track */
     imagesize=tracksize;
-    imagesize_bytes=imagesize*CDDA_DATASIZE;
+    imagesize_bytes=(int64)imagesize*CDDA_DATASIZE;
     buffersize = READBLOCKS*AUDIOBLOCKSIZE;
+    readblocks = READBLOCKS;
     readblocksize = AUDIOBLOCKSIZE;
 
     if (cdp) {
@@ -804,35 +917,60 @@ int main(int argc, char **argv)
   /* read the image */
 
   if (md5_mode) MD5Init(MD5);
+  if (passes && !audio_track && !info_only) {
+    if (!(flagged=blockmap_new())) die("No memory");
+  }
 
   if (!info_only) {
-    start_time=(int)time(NULL);
+    start_time=timeline_now();
+    stage_begin();
     fprintf(stderr,"Reading %s (%ldMb)...\n",
 	    audio_track?"audio track":"ISO9660 image",
-	    imagesize_bytes/(1024*1024));
+	    (long)(imagesize_bytes/(1024*1024)));
 
     do {
-      len=buffersize;
-      if(readsize/readblocksize+READBLOCKS>imagesize) {
-	read_10(start+counter,imagesize-readsize/readblocksize,buffer,&len);
+      if (used_map) {
+	/* skip over unallocated blocks */
+	i=blockmap_next(used_map,counter);
+	if (i<0 || i>imagesize) i=imagesize;
+	for (;counter<i;counter++) {
+	  if (md5_mode) MD5Update(MD5,zero_block,BLOCKSIZE);
+	}
+	readsize=(int64)counter*readblocksize;
+	fseeko(outfile,(off_t)readsize,SEEK_SET);
+	if (counter>=imagesize) break;
       }
+
+      len=buffersize;
+      i=(readsize/readblocksize+readblocks>imagesize ?
+	 imagesize-(int)(readsize/readblocksize) : readblocks);
+      stage_t=stage_start();
+      if (ecc_mode && !audio_track)
+	read_data_ecc(start+counter,i,buffer,&len,flagged);
       else
-	read_10(start+counter,READBLOCKS,buffer,&len);
-      if ((counter%(1024*1024/readblocksize))<READBLOCKS) {
-	cur_time=(int)time(NULL);
+	read_10(start+counter,i,buffer,&len);
+      stage_add(STAGE_DRIVE,stage_t);
+      if ((counter%(1024*1024/readblocksize))<readblocks) {
+	cur_time=timeline_now();
 	if ((cur_time-start_time)>0) {
-	  kbps=(readsize/1024)/(cur_time-start_time);
+	  kbps=(int)(readsize/1024/(cur_time-start_time));
 	} else {
 	  kbps=0;
 	}
 	
 	fprintf(stderr,"%3dM of %dM read. (%d kb/s)         \r",
-		counter/512,imagesize/512,kbps);
+		(int)(readsize>>20),(int)(imagesize_bytes>>20),kbps);
       }
-      counter+=READBLOCKS;
+      stage_t=stage_start();
+      if (file_index)
+	fileindex_feed(file_index,counter,buffer,len/readblocksize);
+      stage_add(STAGE_HASH,stage_t);
+      counter+=readblocks;
       readsize+=len;
       if (!audio_track) {
+	stage_t=stage_start();
 	fwrite(buffer,len,1,outfile);
+	stage_add(STAGE_WRITE,stage_t);
       } else {
 #ifdef IRIX
 	/* audio track */
@@ -841,16 +979,48 @@ int main(int argc, char **argv)
 	}
 #endif
       }
+      stage_t=stage_start();
       if (md5_mode) MD5Update(MD5,buffer,(readsize>imagesize_bytes?
 				       len-(readsize-imagesize_bytes):len) );
-    } while (len==readblocksize*READBLOCKS&&readsize<imagesize*readblocksize);
+      stage_add(STAGE_HASH,stage_t);
+    } while (len==readblocksize*readblocks &&
+	     readsize<(int64)imagesize*readblocksize);
     
+    if (!audio_track) {
+      stage_t=stage_start();
+      fflush(outfile);
+      stage_add(STAGE_WRITE,stage_t);
+    }
+    stage_end();
     fprintf(stderr,"\n");
+    stage_report(stderr);
     if (!audio_track) {
-      if (readsize > imagesize_bytes) 
+      if (used_map && readsize >= imagesize_bytes) {
+	fflush(outfile);
+	ftruncate(fileno(outfile),imagesize_bytes);
+      }
+      else if (readsize > imagesize_bytes) 
 	ftruncate(fileno(outfile),imagesize_bytes);
+      if (ecc_mode) ecc_report();
+      if (flagged && flagged->count > 0) {
+	/* re-read bad blocks and write them to the image */
+	sprintf(tmpstr,"%.240s.log",argv[optind]);
+	if (!(rescue_log=fopen(tmpstr,"w")))
+	  warn("cannot open rescue log '%s'",tmpstr);
+	i=rescue_blocks(flagged,passes,start,outfile,rescue_log);
+	if (rescue_log) fclose(rescue_log);
+	fflush(outfile);
+	if (md5_mode || file_index)
+	  rehash_image(argv[optind],(readsize < imagesize_bytes ? readsize :
+				     imagesize_bytes),
+		       (md5_mode ? MD5 : NULL),file_index);
+      }
       if (readsize < imagesize_bytes) 
 	fprintf(stderr,"Image not complete!\n");
+      else if (flagged && flagged->count > 0 && i > 0)
+	fprintf(stderr,"Image contains unverified blocks!\n");
+      else if (!flagged && ecc_mode && ecc_failed_blocks() > 0)
+	fprintf(stderr,"Image contains uncorrectable blocks!\n");
       else fprintf(stderr,"Image complete.\n");
       fclose(outfile);
     } else {
@@ -867,12 +1037,25 @@ int main(int argc, char **argv)
 	    digest_text);
   }
 
+  if (file_index) {
+    if (!(filehash_file=fopen(filehash_name,"w"))) 
+      die("cannot open file '%s'",filehash_name);
+    if ((i=fileindex_write(file_index,filehash_file)) > 0)
+      fprintf(stderr,"%d file(s) incomplete!\n",i);
+    fclose(filehash_file);
+    fprintf(stderr,"File checksums written to: %s\n",filehash_name);
+    fileindex_free(file_index);
+  }
+
  quit:
+  timeline_close();
+  if (verbose_mode) cache_report();
   start_stop(0);
   /* set_removable(1); */
 
   /* close the scsi device */
   scsi_close();
+  record_close();
 
   return 0;
 }
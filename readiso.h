@@ -17,6 +17,12 @@
 #define DEFAULT_DEV "/dev/cdrom"
 #endif
 
+#define REPLAY_PREFIX "replay:"  /* device name of a recorded session */
+
+#ifndef SYSFS_SG
+#define SYSFS_SG "/sys/class/scsi_generic"
+#endif
+
 
 /* macros for building MSF values from LBA */
 #define LBA_MIN(x) ((x)/(60*75))
@@ -31,17 +37,58 @@
 
 #ifdef IRIX
 #define READBLOCKS     64    /* no of blocks to read at a time */
+#define MAXREADBLOCKS  64    /* max. no of blocks in one transfer */
+#define MAXTRANSFER    64    /* max. data blocks in one transfer (DVD/BD) */
 #else
 #define READBLOCKS     1
+#define MAXREADBLOCKS  9     /* fits in RAWREADBLOCKS raw sectors */
+#define MAXTRANSFER    32    /* max. data blocks in one transfer (DVD/BD) */
 #endif
 
 #define BLOCKSIZE      2048  /* data block size */
 #define AUDIOBLOCKSIZE 2368  /* cdda (2352) + subcode-q (16) */
+#define RAWBLOCKSIZE   2352  /* raw cd sector (or cdda block) size */
+#define SUBBLOCKSIZE   96    /* raw P-W subchannel data of a sector */
+#define C2BLOCKSIZE    294   /* C2 error pointers of a sector (bit/byte) */
+
+#define RAWREADBLOCKS  8     /* no of blocks to read at a time with READ CD */
+
+#define DVD_READBLOCKS 16    /* blocks per read on DVD (one ECC block) */
+#define BD_READBLOCKS  32    /* blocks per read on BD (one cluster) */
 
 #define MAX_DIFF_ALLOWED  512  /* how many blocks image size can be smaller
                                   than track size, before we override image
 				  size with track size */
 
+#define JITTER_OVERLAP  1      /* blocks re-read from previous transfer */
+#define JITTER_KEY     32      /* samples used for aligning reads */
+#define JITTER_MAX    256      /* max. jitter searched (samples) */
+#define JITTER_RETRIES  3      /* re-reads if read cannot be aligned */
+#define C2_RETRIES      5      /* re-reads of a block with C2/Q errors */
+#define ECC_RETRIES     5      /* re-reads of a block that ECC cannot fix */
+#define RESCUE_GROUP  256      /* blocks re-read at a time with --passes */
+#define MAX_PASSES     15      /* max. number of --passes */
+
+#define SCHED_MAX_GAP  16      /* max. gap (blocks) read to merge requests */
+#define SCHED_MAX_SPAN 256     /* max. length of merged requests (blocks) */
+#define DUMP_BATCH   1024      /* blocks dumped per scheduler batch */
+#define CACHE_DEFAULT_MB 2     /* default size of the block cache (--cache) */
+#define CACHE_SEQ_READS  2     /* sequential reads before reading ahead */
+#define SERVE_BACKLOG    4     /* pending connections to --serve socket */
+#define MAX_DRIVES      16     /* max. number of drives (-d) used at once */
+#define MULTI_CHUNK     64     /* blocks per buffer with multiple drives */
+#define MULTI_POOL_MB   16     /* size of the shared buffer pool */
+#define MULTI_WRITERS    2     /* threads writing and hashing the images */
+#define MULTI_QUEUE      4     /* commands queued per drive (event mode) */
+#define SCAN_TIMEOUT     5     /* seconds to wait for devices (--scanbus) */
+#define SCAN_MAX_DEVICES 256   /* max. number of devices listed */
+#define PROFILE_FILE ".readiso-drives"  /* drive profiles (in $HOME) */
+#define TIMELINE_ZONES  10     /* disc zones in --timeline summary */
+#define DUMP_PROGRESS   1      /* seconds between progress lines (--dump) */
+
+#define MAX_BAD_RUN  32        /* how many unreadable blocks in a row before
+				  giving up reading a track */
+
 /* track types in TOC */
 #define DATA_TRACK   0x04
 
@@ -55,13 +102,59 @@
 #define READCAPACITY  0x25
 #define READ10        0x28
 #define READTOC       0x43
+#define GETCONFIG     0x46
+#define SERVICEIN     0x9E   /* SERVICE ACTION IN(16) */
+#define READCAPACITY16 0x10  /* service action of SERVICEIN */
+#define READ12        0xA8
 #define MODESELECT10  0x55
 #define MODESENSE10   0x5A
+#define SETCDSPEED    0xBB
+#define READCD        0xBE
 #define LOAD_UNLOAD   0xE7
 
+/* READ CD main channel selection (byte 9) and subchannel selection 
+   (byte 10) */
+#define READCD_USERDATA  0x10  /* user data only */
+#define READCD_RAW       0xF8  /* sync, headers, user data and EDC/ECC */
+#define READCD_C2        0x02  /* C2 error pointers */
+#define READCD_SUB_NONE  0x00
+#define READCD_SUB_RAW   0x01  /* raw (interleaved) P-W subchannel */
+
+/* output formats of raw mode (see raw.c) */
+#define RAW_FORMAT_BIN   1     /* BIN + CUE */
+#define RAW_FORMAT_CCD   2     /* IMG + SUB + CCD (CloneCD) */
+
+/* commands used for getting the block size (see get_block_size_cmd()) */
+#define BSIZE_MODE_SENSE     1
+#define BSIZE_MODE_SENSE10   2
+#define BSIZE_READ_CAPACITY  3
+
+/* media classes (see media_class()) */
+#define MEDIA_UNKNOWN  0
+#define MEDIA_CD       1
+#define MEDIA_DVD      2
+#define MEDIA_BD       3
+
+/* output formats of --scanbus (see scan.c) */
+#define SCAN_TEXT        0     /* device table */
+#define SCAN_CSV         1     /* comma separated values */
+
+/* stages of reading an image (see stage.c) */
+#define STAGE_DRIVE      0     /* waiting for the drive */
+#define STAGE_HASH       1     /* checksums (MD5, file hashes) */
+#define STAGE_WRITE      2     /* writing the image file */
+#define STAGE_STALL      3     /* reader waiting for a free buffer */
+#define STAGES           4
+
+/* queues sampled for occupancy (see stage_sample()) */
+#define QUEUE_BUFFERS    0     /* buffers waiting for a writer */
+#define QUEUE_COMMANDS   1     /* commands queued to the drives */
+#define QUEUES           2
+
 #ifdef LINUX
 #define AF_FILE_AIFF 0
 #define AF_FILE_AIFFC 1
+#define AF_FILE_WAVE 2
 #endif
 
 #ifndef IRIX
@@ -92,6 +185,10 @@
 #define NULLISODATE(s)  (s[0]==s[1]&&s[1]==s[2]&&s[2]==s[3]&&s[3]==s[4]&& \
 			 s[4]==s[5]&&s[5]==s[6]&&s[6]==s[7]&&s[7]==s[8])
 
+/* byte offsets and sizes of images and files (DVD and BD images, and
+   files on them, can be larger than 2GB) */
+typedef long long int64;
+
 
 /* ISO9660 primary descriptor definition */
 typedef struct iso_primary_descriptor_type_ {
@@ -134,12 +231,389 @@ typedef struct iso_primary_descriptor_type_ {
 } iso_primary_descriptor_type;
 
 
+/* ISO9660 directory record (fixed part, file identifier follows) */
+#define ISO_DR_LEN      0   /* 711 length of directory record */
+#define ISO_DR_EXTENT   2   /* 733 location of extent */
+#define ISO_DR_SIZE    10   /* 733 data length */
+#define ISO_DR_FLAGS   25   /* 711 file flags */
+#define ISO_DR_NAMELEN 32   /* 711 length of file identifier */
+#define ISO_DR_NAME    33
+
+#define ISO_FLAG_DIR       0x02
+#define ISO_FLAG_MULTIEXT  0x80
+
+#define ISO_MAX_DEPTH  32   /* how deep we follow directory tree */
+#define ISO_MAX_VD     32   /* max. number of volume descriptors */
+
+
+/* per-file digest index (see filehash.c) */
+#include "sha256.h"
+
+typedef struct file_entry_type_ {
+  char *name;           /* path of the file inside image */
+  int64 size;           /* file size in bytes */
+  int64 done;           /* bytes fed to the digests so far */
+  int  status;          /* FILE_xxx */
+  MD5_CTX md5;
+  SHA256_CTX sha256;
+  unsigned char md5_digest[16];
+  unsigned char sha256_digest[32];
+} file_entry_type;
+
+#define FILE_PENDING   0
+#define FILE_COMPLETE  1
+#define FILE_BROKEN    2   /* extents not seen in order, digests invalid */
+
+typedef struct file_extent_type_ {
+  int  lba;             /* first block of extent (relative to image start) */
+  int  boff;            /* byte offset of data in the first block */
+  int64 offset;         /* offset of the extent within the file */
+  int64 len;            /* length of the extent in bytes */
+  int64 fed;            /* bytes of this extent fed so far */
+  int  file;            /* index to file table */
+} file_extent_type;
+
+typedef struct file_index_type_ {
+  file_entry_type *files;
+  int file_count, file_alloc;
+  file_extent_type *extents;
+  int extent_count, extent_alloc;
+  int next;             /* first extent not yet completely fed */
+} file_index_type;
+
+
+/* handle of an open scsi device (defined by the backend) */
+typedef struct scsi_device_type_ scsi_device_type;
+typedef struct replay_type_ replay_type;
+
+
+/* list of block ranges (see blockmap.c) */
+typedef struct block_range_type_ {
+  int start;
+  int count;
+} block_range_type;
+
+typedef struct block_map_type_ {
+  block_range_type *ranges;
+  int count, alloc;
+  int sorted;
+} block_map_type;
+
+
+/* batch of block read requests (see sched.c) */
+typedef struct read_request_type_ {
+  int lba;              /* first block */
+  int count;            /* number of blocks */
+  unsigned char *buf;   /* where to put the data */
+  int bad;              /* unreadable blocks (filled with zeros) */
+} read_request_type;
+
+typedef struct read_sched_type_ {
+  int bsize;            /* block size */
+  read_request_type *reqs;
+  int count, alloc;
+  int head;             /* block after the last block read */
+} read_sched_type;
+
+
+/* UDF (ECMA-167) volume structures */
+#define UDF_TAG_PVD       1    /* primary volume descriptor */
+#define UDF_TAG_AVDP      2    /* anchor volume descriptor pointer */
+#define UDF_TAG_PD        5    /* partition descriptor */
+#define UDF_TAG_LVD       6    /* logical volume descriptor */
+#define UDF_TAG_TD        8    /* terminating descriptor */
+#define UDF_TAG_FSD     256    /* file set descriptor */
+#define UDF_TAG_FID     257    /* file identifier descriptor */
+#define UDF_TAG_AED     258    /* allocation extent descriptor */
+#define UDF_TAG_FE      261    /* file entry */
+#define UDF_TAG_EFE     266    /* extended file entry */
+
+#define UDF_ANCHOR      256    /* location of the first anchor */
+#define UDF_MAX_PARTS     4
+#define UDF_MAX_MAPS      4
+#define UDF_MAX_DEPTH    64
+#define UDF_FE_BATCH    256    /* file entries read with one batch */
+#define UDF_MAX_AED    4096    /* max. extent descriptor blocks of a file */
+
+#define UDF_MAP_PHYSICAL  1
+#define UDF_MAP_METADATA  2
+#define UDF_MAP_VIRTUAL   3    /* VAT based, not supported */
+
+typedef struct udf_partition_type_ {
+  int number;           /* partition number */
+  int start;            /* first block of partition */
+  int length;           /* partition length in blocks */
+  int bitmap;           /* location of unallocated space bitmap (lbn) */
+  int bitmap_len;       /* length of the bitmap in bytes (0 = no bitmap) */
+} udf_partition_type;
+
+typedef struct udf_map_type_ {
+  int type;             /* UDF_MAP_xxx */
+  int part;             /* index to partition table */
+  int meta_file;        /* location of metadata file (lbn) */
+  block_map_type *meta; /* extents of the metadata partition */
+} udf_map_type;
+
+typedef struct udf_volume_type_ {
+  int start;            /* first block of the volume (track start) */
+  int revision;         /* UDF revision (bcd, eg. 0x0250) */
+  char volume_id[128];  /* logical volume identifier */
+  int volume_size;      /* size of the volume in blocks */
+  int part_count;
+  udf_partition_type part[UDF_MAX_PARTS];
+  int map_count;
+  udf_map_type map[UDF_MAX_MAPS];
+  int fsd_lbn, fsd_map; /* file set descriptor */
+  int root_lbn, root_map; /* root directory ICB */
+  block_map_type *meta_blocks; /* blocks used by directories etc. */
+  int quiet;            /* don't warn about unsupported volumes */
+} udf_volume_type;
+
+
+
+/* flags for rip_audio_track() */
+#define AUDIO_JITTER  0x01     /* jitter correction */
+#define AUDIO_C2      0x02     /* C2 error pointer and Q CRC checking */
+#define AUDIO_ACCURATERIP 0x04 /* write AccurateRip/CRC32 checksums */
+#define AUDIO_FIRST   0x10     /* first audio track of the disc */
+#define AUDIO_LAST    0x20     /* last audio track of the disc */
+
+/* sound file being written (see audio.c) */
+typedef struct audio_file_type_ {
+  FILE *f;
+  int format;           /* AF_FILE_xxx */
+  long frames;          /* sample frames written so far */
+} audio_file_type;
+
+/* checksums of an audio track (see arcrc.c) */
+typedef struct audio_crc_type_ {
+  uint32 ar1, ar2;      /* AccurateRip v1 and v2 */
+  uint32 crc32;
+  long pos;             /* samples processed so far */
+  long check_from;      /* samples included in AccurateRip checksums */
+  long check_to;
+} audio_crc_type;
+
+/* cached drive profile (see profile.c) */
+typedef struct drive_profile_type_ {
+  char vendor[9], model[17], rev[5];
+  int bsize_cmd;        /* command reporting the block size (BSIZE_xxx) */
+} drive_profile_type;
+
+
 
 /* function declarations */
 
+/* drive.c */
+void die(char *format, ...);
+void warn(char *format, ...);
+int  inquiry(char *manufacturer, char *model, char *revision);
+int  test_ready();
+int  start_stop(int start);
+int  read_toc(unsigned char *buf, int *buflen, int mode);
+int  read_10(int lba, int len, unsigned char *buf, int *buflen);
+int  read_10_drive(int lba, int len, unsigned char *buf, int *buflen, 
+		   int quiet);
+void set_read_12(int on);
+int  read_cd(int lba, int len, int flags, int subch, 
+	     unsigned char *buf, int *buflen);
+int  read_full_toc(unsigned char *buf, int *buflen);
+int  mode_sense(unsigned char *buf, int *buflen);
+int  mode_sense10(unsigned char *buf, int *buflen);
+int  read_capacity(int *lba, int *bsize);
+int  read_capacity16(int64 *lba, int *bsize);
+int64 disc_capacity();
+int  get_configuration(int *profile);
+char *media_profile_name(int profile);
+int  media_class(int profile);
+int  media_read_blocks(int class);
+int  set_removable(int removable);
+int  mode_select(int bsize, int density);
+int  set_speed(int kbps);
+int  get_block_size();
+int  get_block_size_cmd(int *cmd);
+char *md2str(unsigned char *digest, char *s);
+
+/* scsi.c */
+void scsi_select(scsi_device_type *dev);
+scsi_device_type *scsi_current();
 int  scsi_open(const char *dev);
 void scsi_close();
+
+/* scsi_linux.c, scsi_irix.c */
+scsi_device_type *scsi_dev_open(const char *dev);
+void scsi_dev_close(scsi_device_type *d);
 int  scsi_request(char *note, unsigned char *reply, int *replylen, 
 	          int cmdlen, int datalen, int mode, ...);
 
+/* scsi_linux.c (non-blocking mode) */
+int  scsi_dev_nonblock(scsi_device_type *d, int on);
+int  scsi_async_start(scsi_device_type *d, int id, int replylen, 
+		      int cmdlen, ...);
+int  scsi_async_finish(scsi_device_type *d, int *id, unsigned char **data,
+		       int *len);
+
+/* filehash.c */
+file_index_type *fileindex_new();
+void fileindex_free(file_index_type *idx);
+int  fileindex_add_file(file_index_type *idx, const char *name, int64 size);
+int  fileindex_add_extent(file_index_type *idx, int file, int lba, int boff,
+			  int64 offset, int64 len);
+void fileindex_sort(file_index_type *idx);
+void fileindex_reset(file_index_type *idx);
+void fileindex_feed(file_index_type *idx, int block, 
+		    unsigned char *buf, int blocks);
+int  fileindex_write(file_index_type *idx, FILE *f);
+void fileindex_list(file_index_type *idx, FILE *f);
+
+/* iso9660.c */
+int  iso_build_file_index(iso_primary_descriptor_type *ipd, int start, 
+			  int imagesize, file_index_type *idx);
+int  iso_used_blocks(int start, int imagesize, block_map_type *used);
+
+/* tracks.c */
+char *track_basename(const char *name);
+int  rip_all_tracks(unsigned char *toc, const char *name, int md5_mode,
+		    int flags);
+
+/* raw.c */
+int  track_mode(unsigned char *toce, int bsize, unsigned char *buf);
+int  rip_raw_disc(unsigned char *toc, const char *name, int format, 
+		  int md5_mode);
+
+/* audio.c */
+void swab16(unsigned char *buf, long len);
+const char *audio_format_name(int format);
+audio_file_type *audio_open(const char *name, int format);
+int  audio_write(audio_file_type *af, unsigned char *buf, long len);
+int  audio_close(audio_file_type *af);
+int  rip_audio_track(int track, int start, int count, const char *name,
+		     int format, int md5_mode, int flags);
+
+/* arcrc.c */
+void audio_crc_init(audio_crc_type *c, long samples, int first, int last);
+void audio_crc_update(audio_crc_type *c, const unsigned char *buf, long len);
+void audio_crc_csv_header(FILE *f);
+void audio_crc_csv_line(FILE *f, int track, int start, int length,
+			audio_crc_type *c);
+void audio_crc_print(int track, audio_crc_type *c);
+
+/* subq.c */
+unsigned short crc16(const unsigned char *buf, int len);
+void subq_from_raw(const unsigned char *raw, unsigned char *q);
+int  subq_check(const unsigned char *q);
+
+/* edc.c */
+uint32 edc_compute(const unsigned char *buf, int len);
+int  edc_data_offset(const unsigned char *sector);
+int  edc_check_sector(const unsigned char *sector);
+int  ecc_repair_sector(unsigned char *sector);
+int  read_data_ecc(int lba, int n, unsigned char *buf, int *buflen,
+		   block_map_type *flagged);
+void ecc_report();
+int  ecc_failed_blocks();
+
+/* rescue.c */
+int  rescue_blocks(block_map_type *flagged, int passes, int start, FILE *out,
+		   FILE *log);
+void rehash_image(const char *name, int64 bytes, MD5_CTX *md5,
+		  file_index_type *idx);
+
+/* dump.c */
+int  dump_parse_ranges(const char *arg, block_map_type *map);
+int  dump_ranges(block_map_type *map, int bsize, FILE *out,
+		 void (*parse)(unsigned char *block));
+
+/* sched.c */
+read_sched_type *sched_new(int bsize);
+void sched_free(read_sched_type *s);
+void sched_reset(read_sched_type *s);
+int  sched_add(read_sched_type *s, int lba, int count, unsigned char *buf);
+int  sched_run(read_sched_type *s);
+
+/* cache.c */
+int  cache_init(int mb);
+void cache_flush();
+void cache_set_block_size(int bsize);
+int  cache_active(int bytes);
+int  cache_read(int lba, int len, unsigned char *buf, int *buflen);
+void cache_report();
+
+/* serve.c */
+int  serve_disc(const char *path, int start, int blocks);
+
+/* libreadiso.c (see also libreadiso.h) */
+struct readiso_ctx_;
+scsi_device_type *readiso_device(struct readiso_ctx_ *ctx);
+
+/* scan.c */
+void scan_bus(int format);
+
+/* timeline.c */
+double timeline_now();
+int  timeline_open(const char *name);
+int  timeline_active();
+void timeline_range(int start, int blocks);
+void timeline_record(int lba, int blocks, int bytes, double secs, double end);
+void timeline_close();
+
+/* latency.c */
+int  latency_enable(int text, const char *json_name);
+int  latency_active();
+double latency_start();
+void latency_record(int opcode, double start, int failed);
+void latency_report(FILE *f);
+void latency_report_json(FILE *f);
+
+/* stage.c */
+void stage_enable();
+int  stage_active();
+void stage_threads(int stage, int threads);
+void stage_begin();
+void stage_end();
+double stage_start();
+void stage_add(int stage, double start);
+void stage_sample(int queue, int used, int size);
+void stage_report(FILE *f);
+
+/* record.c */
+int  record_open(const char *name);
+int  record_active();
+void record_cmd(const unsigned char *cdb, int cmdlen,
+		const unsigned char *data, int datalen,
+		const unsigned char *reply, int replylen,
+		const unsigned char *sense, int senselen, int result,
+		double secs);
+void record_close();
+replay_type *replay_open(const char *name);
+void replay_close(replay_type *r);
+void replay_set_scale(double scale);
+int  replay_request(replay_type *r, const unsigned char *cdb, int cmdlen,
+		    unsigned char *reply, int *replylen);
+
+/* profile.c */
+void profile_init(drive_profile_type *p, const char *vendor,
+		  const char *model, const char *rev);
+char *profile_default_file();
+int  profile_load(const char *file, drive_profile_type *p);
+int  profile_save(const char *file, drive_profile_type *p);
+
+/* multi.c */
+int  rip_multi(char **devs, int count, const char *pattern, int md5_mode);
+
+/* blockmap.c */
+block_map_type *blockmap_new();
+void blockmap_free(block_map_type *map);
+int  blockmap_add(block_map_type *map, int start, int count);
+void blockmap_normalize(block_map_type *map, int gap);
+int  blockmap_next(block_map_type *map, int block);
+long blockmap_blocks(block_map_type *map);
+
+/* udf.c */
+udf_volume_type *udf_open(int start, int tracksize, int quiet);
+void udf_close(udf_volume_type *udf);
+void udf_print_info(udf_volume_type *udf);
+int  udf_build_file_index(udf_volume_type *udf, file_index_type *idx);
+int  udf_used_blocks(udf_volume_type *udf, block_map_type *used);
+
 
@@ -0,0 +1,462 @@
+/* record.c -- recording scsi sessions (--record) and replaying them
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* With --record every command sent with scsi_request() is written to a
+ * session file: a header of REC_HEADER bytes followed by records of
+ *
+ *   byte 0      command length
+ *   byte 1      sense length
+ *   bytes 2-3   length of data sent (MODE SELECT)
+ *   bytes 4-7   length of data returned (0 if the command failed)
+ *   bytes 8-11  latency in microseconds
+ *   byte 12     result (0 = ok)
+ *   bytes 13-15 reserved
+ *
+ * followed by the command, data sent, data returned and sense bytes
+ * (numbers in little endian byte order).
+ *
+ * A session is replayed by using "replay:<file>" as the device. Read
+ * commands (READ(10), READ(12), READ CD) are served block by block
+ * from the data read in the session, so they do not need to be the
+ * same as in the session (transfer size can be changed): the latency
+ * of a read is the sum of the latencies of its blocks (latency of the
+ * recorded command divided by its blocks). The reply of a read may be
+ * the whole buffer of the caller, so the block size of READ(10) and
+ * READ(12) is followed from the MODE SELECT commands of the session.
+ * READ CD blocks are kept apart by the fields requested. A replayed
+ * read returns the blocks in the size they were recorded with. A block
+ * is unreadable if it was never read successfully in the session (all
+ * blocks of a failed read are recorded as unreadable). Other commands
+ * get the reply of the next recorded command with the same bytes (or
+ * the same opcode). Latencies are multiplied by the scale set with
+ * replay_set_scale() (0 = no delays).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define REC_MAGIC   "RDISOREC"
+#define REC_VERSION 1
+#define REC_HEADER  16      /* size of file header and record header */
+#define REC_CDB     16      /* max. command length */
+#define REC_SENSE   32      /* max. sense length */
+
+typedef struct replay_cmd_type_ {
+  unsigned char cdb[REC_CDB];
+  int cmdlen;
+  int result;
+  double secs;
+  unsigned char *reply;
+  int replylen;
+} replay_cmd_type;
+
+typedef struct replay_block_type_ {
+  int lba;
+  int type;             /* see replay_read_type() */
+  int bsize;            /* bytes per block in the reply */
+  int bad;              /* read failed */
+  float secs;           /* share of the latency of the command */
+  off_t offset;         /* data in the session file */
+} replay_block_type;
+
+struct replay_type_ {
+  FILE *f;
+  replay_cmd_type *cmds;
+  int ncmds, next;
+  replay_block_type *blocks;
+  int nblocks;
+};
+
+static FILE *rec_file = NULL;
+static double replay_scale = 1.0;
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+static void put_le(unsigned char *p, unsigned long v, int n)
+{
+  int i;
+
+  for (i=0;i<n;i++,v>>=8) p[i]=v&0xff;
+}
+
+static unsigned long get_le(const unsigned char *p, int n)
+{
+  unsigned long v = 0;
+
+  while (n-- > 0) v=(v<<8)|p[n];
+  return v;
+}
+
+
+int record_open(const char *name)
+{
+  unsigned char hdr[REC_HEADER];
+
+  if (!(rec_file=fopen(name,"wb"))) return -1;
+  memset(hdr,0,sizeof(hdr));
+  memcpy(hdr,REC_MAGIC,8);
+  put_le(hdr+8,REC_VERSION,4);
+  if (fwrite(hdr,1,REC_HEADER,rec_file) != REC_HEADER) {
+    fclose(rec_file);
+    rec_file=NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int record_active()
+{
+  return (rec_file != NULL);
+}
+
+/* record command 'cdb' (data 'data' sent), that returned 'reply' and
+   sense bytes 'sense' with result 'result' in 'secs' seconds */
+void record_cmd(const unsigned char *cdb, int cmdlen,
+		const unsigned char *data, int datalen,
+		const unsigned char *reply, int replylen,
+		const unsigned char *sense, int senselen, int result,
+		double secs)
+{
+  unsigned char hdr[REC_HEADER];
+
+  if (!rec_file) return;
+  /* data of a failed command is not reliable (sg returns the whole
+     buffer) */
+  if (replylen < 0 || result) replylen=0;
+  if (senselen > REC_SENSE) senselen=REC_SENSE;
+  memset(hdr,0,sizeof(hdr));
+  hdr[0]=cmdlen;
+  hdr[1]=senselen;
+  put_le(hdr+2,datalen,2);
+  put_le(hdr+4,replylen,4);
+  put_le(hdr+8,(unsigned long)(secs*1e6),4);
+  hdr[12]=(result ? 1 : 0);
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&rec_lock);
+#endif
+  fwrite(hdr,1,REC_HEADER,rec_file);
+  fwrite(cdb,1,cmdlen,rec_file);
+  if (datalen > 0) fwrite(data,1,datalen,rec_file);
+  if (replylen > 0) fwrite(reply,1,replylen,rec_file);
+  if (senselen > 0) fwrite(sense,1,senselen,rec_file);
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&rec_lock);
+#endif
+}
+
+void record_close()
+{
+  if (!rec_file) return;
+  if (fclose(rec_file)) warn("error writing session file");
+  rec_file=NULL;
+}
+
+
+/* returns 1 if 'cdb' is a read command, and its first block and count */
+static int replay_read_cmd(const unsigned char *cdb, int *lba, int *count)
+{
+  switch (cdb[0]) {
+  case READ10:
+    *count=(cdb[7]<<8)|cdb[8];
+    break;
+  case READ12:
+    *count=V4(&cdb[6]);
+    break;
+  case READCD:
+    *count=(cdb[6]<<16)|(cdb[7]<<8)|cdb[8];
+    break;
+  default:
+    return 0;
+  }
+  *lba=V4(&cdb[2]);
+  return 1;
+}
+
+/* returns type of the data returned by a read command, blocks of the
+   same type have the same size (READ(10) and READ(12) return the drive
+   block size, READ CD the fields selected in bytes 9 and 10) */
+static int replay_read_type(const unsigned char *cdb)
+{
+  return (cdb[0] == READCD ? 0x10000|(cdb[9]<<8)|cdb[10] : 0);
+}
+
+static int replay_block_cmp(const void *a, const void *b)
+{
+  const replay_block_type *x = (const replay_block_type*)a;
+  const replay_block_type *y = (const replay_block_type*)b;
+
+  if (x->lba != y->lba) return (x->lba < y->lba ? -1 : 1);
+  if (x->type != y->type) return (x->type < y->type ? -1 : 1);
+  if (x->bsize != y->bsize) return (x->bsize < y->bsize ? -1 : 1);
+  return y->bad - x->bad;  /* good copies last */
+}
+
+/* returns NULL if out of memory */
+static replay_block_type *replay_add_block(replay_type *r, int *size)
+{
+  replay_block_type *b;
+
+  if (r->nblocks >= *size) {
+    b=(replay_block_type*)realloc(r->blocks,(*size ? *size*2 : 1024)*
+				  sizeof(replay_block_type));
+    if (!b) return NULL;
+    r->blocks=b;
+    *size=(*size ? *size*2 : 1024);
+  }
+  return &r->blocks[r->nblocks++];
+}
+
+
+/* open session file 'name' for replaying, returns NULL on error */
+replay_type *replay_open(const char *name)
+{
+  unsigned char hdr[REC_HEADER], cdb[REC_CDB], data[16];
+  replay_type *r;
+  replay_cmd_type *c;
+  replay_block_type *b;
+  unsigned char *reply;
+  int cmdlen, senselen, datalen, replylen, result, lba, count, bsize, i, n;
+  int type, rbsize = BLOCKSIZE;
+  int csize = 0, bblocks = 0;
+  double secs;
+  off_t pos;
+
+  if (!(r=(replay_type*)malloc(sizeof(replay_type)))) return NULL;
+  memset(r,0,sizeof(replay_type));
+  if (!(r->f=fopen(name,"rb"))) {
+    free(r);
+    return NULL;
+  }
+  if (fread(hdr,1,REC_HEADER,r->f) != REC_HEADER ||
+      memcmp(hdr,REC_MAGIC,8) || get_le(hdr+8,4) != REC_VERSION) {
+    warn("'%s' is not a session file",name);
+    replay_close(r);
+    return NULL;
+  }
+
+  while (fread(hdr,1,REC_HEADER,r->f) == REC_HEADER) {
+    cmdlen=hdr[0];
+    senselen=hdr[1];
+    datalen=get_le(hdr+2,2);
+    replylen=get_le(hdr+4,4);
+    secs=get_le(hdr+8,4)/1e6;
+    result=hdr[12];
+    n=(datalen < (int)sizeof(data) ? datalen : (int)sizeof(data));
+    if (cmdlen < 1 || cmdlen > REC_CDB ||
+	fread(cdb,1,cmdlen,r->f) != (size_t)cmdlen ||
+	fread(data,1,n,r->f) != (size_t)n ||
+	fseeko(r->f,(off_t)datalen-n,SEEK_CUR)) break;
+    pos=ftello(r->f);
+
+    /* block size of READ(10) and READ(12) (from block descriptor) */
+    if (!result && cdb[0] == MODESELECT && n >= 12 && data[3] >= 8)
+      rbsize=(data[9]<<16)|(data[10]<<8)|data[11];
+    if (!result && cdb[0] == MODESELECT10 && n >= 16 && data[7] >= 8)
+      rbsize=(data[13]<<16)|(data[14]<<8)|data[15];
+
+    if (replay_read_cmd(cdb,&lba,&count)) {
+      type=replay_read_type(cdb);
+      if (result) {
+	/* blocks that were read later are found (see replay_find()) */
+	for (i=0;i<count;i++) {
+	  if (!(b=replay_add_block(r,&bblocks))) goto error;
+	  b->lba=lba+i;
+	  b->type=type;
+	  b->bsize=0;
+	  b->bad=1;
+	  b->secs=secs/count;
+	  b->offset=0;
+	}
+      }
+      else if (count > 0 && replylen > 0) {
+	bsize=(type ? replylen/count : rbsize);
+	n=(bsize > 0 && (!type || replylen%count == 0) ? replylen/bsize : 0);
+	for (i=0;i<count && i<n;i++) {
+	  if (!(b=replay_add_block(r,&bblocks))) goto error;
+	  b->lba=lba+i;
+	  b->type=type;
+	  b->bsize=bsize;
+	  b->bad=0;
+	  b->secs=secs/count;
+	  b->offset=pos+(off_t)i*bsize;
+	}
+      }
+      if (fseeko(r->f,(off_t)replylen+senselen,SEEK_CUR)) break;
+      continue;
+    }
+
+    if (r->ncmds >= csize) {
+      c=(replay_cmd_type*)realloc(r->cmds,(csize ? csize*2 : 64)*
+				  sizeof(replay_cmd_type));
+      if (!c) goto error;
+      r->cmds=c;
+      csize=(csize ? csize*2 : 64);
+    }
+    if (!(reply=(unsigned char*)malloc(replylen+1))) goto error;
+    c=&r->cmds[r->ncmds];
+    memcpy(c->cdb,cdb,cmdlen);
+    c->cmdlen=cmdlen;
+    c->result=result;
+    c->secs=secs;
+    c->replylen=replylen;
+    c->reply=reply;
+    if (fread(c->reply,1,replylen,r->f) != (size_t)replylen ||
+	fseeko(r->f,(off_t)senselen,SEEK_CUR)) {
+      free(c->reply);
+      break;
+    }
+    r->ncmds++;
+  }
+
+  if (r->nblocks > 0)
+    qsort(r->blocks,r->nblocks,sizeof(replay_block_type),replay_block_cmp);
+  return r;
+
+ error:
+  replay_close(r);
+  return NULL;
+}
+
+void replay_close(replay_type *r)
+{
+  int i;
+
+  if (!r) return;
+  for (i=0;i<r->ncmds;i++) free(r->cmds[i].reply);
+  free(r->cmds);
+  free(r->blocks);
+  if (r->f) fclose(r->f);
+  free(r);
+}
+
+void replay_set_scale(double scale)
+{
+  replay_scale=(scale > 0 ? scale : 0);
+}
+
+
+static void replay_delay(double secs)
+{
+  struct timespec ts;
+
+  secs*=replay_scale;
+  if (secs <= 0) return;
+  ts.tv_sec=(time_t)secs;
+  ts.tv_nsec=(long)((secs-ts.tv_sec)*1e9);
+  nanosleep(&ts,NULL);
+}
+
+/* returns the block to use for 'lba' read with a command of 'type':
+   the copy with 'bsize' byte blocks or else the first copy of at most
+   'max' bytes. for a block never read successfully an unreadable copy
+   is returned, NULL if the block was not read at all */
+static replay_block_type *replay_find(replay_type *r, int lba, int type,
+				      int bsize, int max)
+{
+  int lo = 0, hi = r->nblocks-1, m;
+  replay_block_type *b, *fit = NULL, *bad = NULL;
+
+  /* first entry of the block */
+  while (lo <= hi) {
+    m=(lo+hi)/2;
+    if (r->blocks[m].lba < lba) lo=m+1;
+    else hi=m-1;
+  }
+  for (;lo < r->nblocks && (b=&r->blocks[lo])->lba == lba;lo++) {
+    if (b->type != type) continue;
+    if (b->bad) bad=b;
+    else if (b->bsize == bsize) return b;
+    else if (!fit && b->bsize <= max) fit=b;
+  }
+  return (fit ? fit : bad);
+}
+
+/* serve read of 'count' blocks of 'type' from 'lba' (up to '*replylen'
+   bytes), blocks are returned in the size of the first block */
+static int replay_read(replay_type *r, int lba, int count, int type,
+		       unsigned char *reply, int *replylen)
+{
+  replay_block_type *b;
+  double secs = 0;
+  int i, bsize, max, n = 0, result = 0;
+
+  max=bsize=(count > 0 && replylen ? *replylen/count : 0);
+  for (i=0;i<count && max > 0;i++) {
+    if (!(b=replay_find(r,lba+i,type,bsize,(i ? 0 : max)))) {
+      result=1;
+      break;
+    }
+    secs+=b->secs;
+    if (b->bad) {
+      result=1;
+      break;
+    }
+    bsize=b->bsize;
+    if (fseeko(r->f,b->offset,SEEK_SET) ||
+	fread(reply+n,1,bsize,r->f) != (size_t)bsize) {
+      result=1;
+      break;
+    }
+    n+=bsize;
+  }
+  replay_delay(secs);
+  /* like the sg driver, a failed read returns the whole buffer */
+  if (replylen && result) memset(reply+n,0,*replylen-n);
+  else if (replylen) *replylen=n;
+  return result;
+}
+
+/* replay command 'cdb', returns result of the command like
+   scsi_request() */
+int replay_request(replay_type *r, const unsigned char *cdb, int cmdlen,
+		   unsigned char *reply, int *replylen)
+{
+  replay_cmd_type *c = NULL;
+  int i, k, lba, count;
+
+  if (replay_read_cmd(cdb,&lba,&count))
+    return replay_read(r,lba,count,replay_read_type(cdb),reply,replylen);
+
+  /* next command with the same bytes, or the same opcode */
+  for (k=0;k<2*r->ncmds && !c;k++) {
+    i=(r->next+k)%r->ncmds;
+    if (k < r->ncmds ? (r->cmds[i].cmdlen == cmdlen &&
+			!memcmp(r->cmds[i].cdb,cdb,cmdlen))
+	: r->cmds[i].cdb[0] == cdb[0]) c=&r->cmds[i];
+  }
+  if (!c) {
+    if (replylen) *replylen=0;
+    return 1;
+  }
+  r->next=(c-r->cmds)+1;
+
+  replay_delay(c->secs);
+  if (replylen) {
+    if (*replylen > c->replylen) *replylen=c->replylen;
+    memcpy(reply,c->reply,*replylen);
+  }
+  return c->result;
+}
@@ -0,0 +1,233 @@
+/* rescue.c -- multi-pass re-reading of bad data blocks
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Blocks that could not be read (or repaired with ECC) during the
+ * normal read are collected to a block map, and re-read after it as raw
+ * sectors in several passes. Each pass uses a different read speed and
+ * the passes alternate between reading upwards and downwards, so the
+ * blocks are approached from both directions. A block is accepted as
+ * soon as one copy has a correct EDC, otherwise the copies are merged
+ * byte by byte with majority vote. Blocks without EDC (Mode 0, Mode 2
+ * Form 2) are accepted when the drive returns them with READ(10).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* read speeds used in passes (kB/s, 0xffff = maximum) */
+static int rescue_speeds[] = { 0xffff, 8*176, 4*176, 2*176 };
+#define RESCUE_SPEEDS (sizeof(rescue_speeds)/sizeof(int))
+
+#define RESCUE_OK        0   /* copy with correct EDC found */
+#define RESCUE_VOTED     1   /* majority vote, EDC correct */
+#define RESCUE_UNVERIFIED 2  /* majority vote, EDC not correct */
+#define RESCUE_UNREADABLE 3  /* no copy could be read */
+
+static char *rescue_status_str[] = { "ok", "voted", "unverified",
+				     "unreadable" };
+
+typedef struct rescue_block_type_ {
+  int lba;
+  int copies;           /* number of copies read */
+  int status;           /* RESCUE_xxx (-1 = not decided yet) */
+  int pass;             /* pass where block was accepted */
+  unsigned char *data;  /* 'passes' raw copies of the block */
+} rescue_block_type;
+
+
+/* check copy of a block, returns 0 if EDC is correct (or could be
+   corrected with ECC) */
+static int rescue_check(unsigned char *s)
+{
+  if (!edc_data_offset(s)) return -1;
+  if (!edc_check_sector(s)) return 0;
+  return ecc_repair_sector(s);
+}
+
+/* returns offset of the user data in a copy of a block (copies of
+   sectors without EDC/ECC are marked as Mode 0 with READ(10) data
+   at 16, see rescue_passes()) */
+static int rescue_offset(unsigned char *s)
+{
+  int o = edc_data_offset(s);
+
+  return (o ? o : 16);
+}
+
+/* merge copies by majority vote into the first copy, returns
+   confidence (percentage of votes agreeing with the result) */
+static double rescue_vote(rescue_block_type *b)
+{
+  unsigned char *out = b->data, *c;
+  int i, j, k, best, count, agree;
+  long total = 0;
+
+  if (b->copies < 1) return 0.0;
+  for (i=0;i<RAWBLOCKSIZE;i++) {
+    best=0;
+    agree=0;
+    for (j=0;j<b->copies && agree*2<=b->copies;j++) {
+      c=b->data+j*RAWBLOCKSIZE;
+      for (k=j,count=0;k<b->copies;k++)
+	if (b->data[k*RAWBLOCKSIZE+i]==c[i]) count++;
+      if (count > agree) {
+	agree=count;
+	best=c[i];
+      }
+    }
+    out[i]=best;
+    total+=agree;
+  }
+  return (100.0*total)/((double)b->copies*RAWBLOCKSIZE);
+}
+
+
+/* re-read blocks of a group 'passes' times */
+static void rescue_passes(rescue_block_type *blocks, int count, int passes)
+{
+  rescue_block_type *b;
+  unsigned char *s;
+  int p, i, len;
+
+  for (p=0;p<passes;p++) {
+    set_speed(rescue_speeds[p%RESCUE_SPEEDS]);
+    for (i=0;i<count;i++) {
+      /* odd passes read downwards */
+      b=&blocks[(p&1) ? count-1-i : i];
+      if (b->status >= 0) continue;
+      s=b->data+b->copies*RAWBLOCKSIZE;
+      len=RAWBLOCKSIZE;
+      if (read_cd(b->lba,1,READCD_RAW,READCD_SUB_NONE,s,&len) ||
+	  len<RAWBLOCKSIZE) continue;
+      if (!edc_data_offset(s)) {
+	/* nothing to check (like in read_data_ecc()), use the data the
+	   drive returns with READ(10) */
+	len=BLOCKSIZE;
+	if (read_10(b->lba,1,s+16,&len) || len<BLOCKSIZE) continue;
+	s[15]=0;  /* data is at 16 now (see rescue_offset()) */
+      } else if (rescue_check(s)) {
+	b->copies++;
+	continue;
+      }
+      if (b->copies > 0) memcpy(b->data,s,RAWBLOCKSIZE);
+      b->status=RESCUE_OK;
+      b->pass=p+1;
+      b->copies++;
+    }
+  }
+  set_speed(0xffff);
+}
+
+
+/* re-read blocks in 'flagged' (absolute LBAs) 'passes' times, and write
+   user data of the result to 'out' (image starting at LBA 'start').
+   results are written to rescue log 'log' (if not NULL). returns number
+   of blocks that could not be verified */
+int rescue_blocks(block_map_type *flagged, int passes, int start, FILE *out,
+		  FILE *log)
+{
+  rescue_block_type *blocks;
+  unsigned char *data;
+  double conf;
+  int r, i, n, count, lba, failed = 0, total;
+
+  blockmap_normalize(flagged,0);
+  total=blockmap_blocks(flagged);
+  if (total < 1) return 0;
+  fprintf(stderr,"Re-reading %d bad block(s), %d pass(es)...\n",
+	  total,passes);
+  if (log) fprintf(log,"# lba status copies pass confidence\n");
+
+  blocks=(rescue_block_type*)malloc(RESCUE_GROUP*sizeof(rescue_block_type));
+  data=(unsigned char*)malloc((long)RESCUE_GROUP*passes*RAWBLOCKSIZE);
+  if (!blocks || !data) die("No memory");
+
+  r=0;
+  lba=(flagged->count > 0 ? flagged->ranges[0].start : 0);
+  while (r < flagged->count) {
+    /* collect next group of blocks */
+    for (count=0; count<RESCUE_GROUP && r<flagged->count; ) {
+      blocks[count].lba=lba;
+      blocks[count].copies=0;
+      blocks[count].status=-1;
+      blocks[count].pass=0;
+      blocks[count].data=data+(long)count*passes*RAWBLOCKSIZE;
+      count++;
+      if (++lba >= flagged->ranges[r].start+flagged->ranges[r].count) {
+	if (++r < flagged->count) lba=flagged->ranges[r].start;
+      }
+    }
+
+    rescue_passes(blocks,count,passes);
+
+    for (i=0;i<count;i++) {
+      rescue_block_type *b = &blocks[i];
+
+      conf=100.0;
+      if (b->copies < 1) {
+	b->status=RESCUE_UNREADABLE;
+	conf=0.0;
+      } else if (b->status < 0) {
+	conf=rescue_vote(b);
+	b->status=(rescue_check(b->data) ? RESCUE_UNVERIFIED : RESCUE_VOTED);
+      }
+      if (b->status >= RESCUE_UNVERIFIED) failed++;
+
+      if (log) fprintf(log,"%d %s %d %d %.1f\n",b->lba,
+		       rescue_status_str[b->status],b->copies,b->pass,conf);
+      if (b->status != RESCUE_UNREADABLE) {
+	n=b->lba-start;
+	fseeko(out,(off_t)n*BLOCKSIZE,SEEK_SET);
+	fwrite(b->data+rescue_offset(b->data),BLOCKSIZE,1,out);
+      }
+    }
+  }
+
+  fflush(out);
+  free(data);
+  free(blocks);
+  fprintf(stderr,"%d block(s) recovered, %d block(s) not verified.\n",
+	  total-failed,failed);
+  return failed;
+}
+
+
+/* calculate MD5 and file digests again from the image file (after
+   blocks have been rewritten) */
+void rehash_image(const char *name, int64 bytes, MD5_CTX *md5,
+		  file_index_type *idx)
+{
+  unsigned char buf[64*BLOCKSIZE];
+  FILE *f;
+  int64 pos = 0;
+  int len;
+
+  if (!(f=fopen(name,"r"))) die("cannot open file '%s'",name);
+  if (md5) MD5Init(md5);
+  if (idx) fileindex_reset(idx);
+
+  while (pos < bytes) {
+    len=(bytes-pos > (int64)sizeof(buf) ? (int64)sizeof(buf) : bytes-pos);
+    if (fread(buf,len,1,f) != 1) break;
+    if (md5) MD5Update(md5,buf,len);
+    if (idx) fileindex_feed(idx,pos/BLOCKSIZE,buf,len/BLOCKSIZE);
+    pos+=len;
+  }
+  fclose(f);
+}
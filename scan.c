@@ -0,0 +1,309 @@
+/* scan.c -- scanning the scsi bus for devices (--scanbus)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* On Linux the scsi generic devices are listed from sysfs
+ * (SYSFS_SG), which also gives vendor, model and revision of each
+ * device without opening it. Older systems without sysfs have
+ * /dev/sga ... /dev/sgz. All devices are probed (opened and sent an
+ * INQUIRY) at the same time, each by its own thread, and the scan
+ * waits at most SCAN_TIMEOUT seconds for them. Devices that do not
+ * answer in time are listed as timed out (with the sysfs information
+ * if there is any), their threads are left behind. Without threads
+ * devices are probed one at a time, and a probe is interrupted with
+ * alarm() after SCAN_TIMEOUT seconds.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef LINUX
+#include <dirent.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#else
+#include <signal.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define SCAN_PENDING   0
+#define SCAN_OK        1
+#define SCAN_ERROR     2     /* cannot open device or no answer */
+#define SCAN_TIMEDOUT  3
+
+typedef struct scan_dev_type_ {
+  char name[64];
+  char vendor[9], model[17], rev[5];
+  int type;             /* peripheral device type (-1 = unknown) */
+  int status;
+  int number;           /* for sorting */
+} scan_dev_type;
+
+static scan_dev_type scan_devs[SCAN_MAX_DEVICES];
+static int scan_count = 0;
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_cond = PTHREAD_COND_INITIALIZER;
+static int scan_pending = 0;
+#endif
+
+
+static void scan_add(const char *name, int number)
+{
+  scan_dev_type *d;
+
+  if (scan_count >= SCAN_MAX_DEVICES) return;
+  d=&scan_devs[scan_count++];
+  memset(d,0,sizeof(scan_dev_type));
+  snprintf(d->name,sizeof(d->name),"%s",name);
+  d->type=-1;
+  d->number=number;
+}
+
+#ifdef LINUX
+/* read sysfs attribute to 'buf' (without trailing white space) */
+static void sysfs_attr(const char *dev, const char *attr, char *buf, int len)
+{
+  char path[256];
+  FILE *f;
+  int i;
+
+  buf[0]=0;
+  snprintf(path,sizeof(path),"%s/%s/device/%s",SYSFS_SG,dev,attr);
+  if (!(f=fopen(path,"r"))) return;
+  if (!fgets(buf,len,f)) buf[0]=0;
+  fclose(f);
+  for (i=strlen(buf)-1;i>=0 && isspace((unsigned char)buf[i]);i--) buf[i]=0;
+}
+
+static int scan_cmp(const void *a, const void *b)
+{
+  return ((scan_dev_type*)a)->number - ((scan_dev_type*)b)->number;
+}
+
+static void scan_list()
+{
+  DIR *dir;
+  struct dirent *e;
+  scan_dev_type *d;
+  char name[64], type[16];
+  int i;
+
+  if ((dir=opendir(SYSFS_SG))) {
+    while ((e=readdir(dir))) {
+      if (strncmp(e->d_name,"sg",2) || !isdigit((unsigned char)e->d_name[2]))
+	continue;
+      snprintf(name,sizeof(name),"/dev/%.32s",e->d_name);
+      scan_add(name,atoi(e->d_name+2));
+      d=&scan_devs[scan_count-1];
+      sysfs_attr(e->d_name,"vendor",d->vendor,sizeof(d->vendor));
+      sysfs_attr(e->d_name,"model",d->model,sizeof(d->model));
+      sysfs_attr(e->d_name,"rev",d->rev,sizeof(d->rev));
+      sysfs_attr(e->d_name,"type",type,sizeof(type));
+      if (type[0]) d->type=atoi(type);
+    }
+    closedir(dir);
+    qsort(scan_devs,scan_count,sizeof(scan_dev_type),scan_cmp);
+  }
+
+  if (scan_count == 0) {
+    /* no sysfs, old device names */
+    for (i=0;i<26;i++) {
+      snprintf(name,sizeof(name),"/dev/sg%c",'a'+i);
+      if (access(name,F_OK)==0) scan_add(name,i);
+    }
+  }
+}
+#else
+static void scan_list()
+{
+  char name[64];
+  int bus,dev;
+
+  for (bus=0;bus<=1;bus++) {
+    for (dev=1;dev<=15;dev++) {
+      snprintf(name,sizeof(name),"/dev/scsi/sc%dd%dl0",bus,dev);
+      scan_add(name,bus*16+dev);
+    }
+  }
+}
+#endif
+
+
+/* open device and send INQUIRY, the result is stored in 'd' unless
+   the scan has given up waiting for it */
+static void scan_probe_dev(scan_dev_type *d)
+{
+  char vendor[9],model[17],rev[5];
+  scsi_device_type *dev;
+  int type = -1;
+
+  if ((dev=scsi_dev_open(d->name))) {
+    scsi_select(dev);
+    type=inquiry(vendor,model,rev);
+    scsi_select(NULL);
+    scsi_dev_close(dev);
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&scan_lock);
+#endif
+  if (d->status == SCAN_PENDING) {
+    if (type >= 0) {
+      strcpy(d->vendor,vendor);
+      strcpy(d->model,model);
+      strcpy(d->rev,rev);
+      d->type=type&0x1f;
+      d->status=SCAN_OK;
+    }
+    else d->status=SCAN_ERROR;
+  }
+#ifdef HAVE_LIBPTHREAD
+  scan_pending--;
+  pthread_cond_signal(&scan_cond);
+  pthread_mutex_unlock(&scan_lock);
+#endif
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void *scan_thread(void *arg)
+{
+  scan_probe_dev((scan_dev_type*)arg);
+  return NULL;
+}
+
+static void scan_probe()
+{
+  struct timeval now;
+  struct timespec deadline;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int i;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+  gettimeofday(&now,NULL);
+  deadline.tv_sec=now.tv_sec+SCAN_TIMEOUT;
+  deadline.tv_nsec=now.tv_usec*1000;
+
+  pthread_mutex_lock(&scan_lock);
+  for (i=0;i<scan_count;i++) {
+    if (pthread_create(&thread,&attr,scan_thread,&scan_devs[i]))
+      scan_devs[i].status=SCAN_ERROR;
+    else
+      scan_pending++;
+  }
+  while (scan_pending > 0) {
+    if (pthread_cond_timedwait(&scan_cond,&scan_lock,&deadline)) break;
+  }
+  for (i=0;i<scan_count;i++) {
+    if (scan_devs[i].status == SCAN_PENDING)
+      scan_devs[i].status=SCAN_TIMEDOUT;
+  }
+  pthread_mutex_unlock(&scan_lock);
+  pthread_attr_destroy(&attr);
+}
+#else
+static void scan_alarm(int sig)
+{
+}
+
+static void scan_probe()
+{
+  struct sigaction sa, old;
+  int i;
+
+  /* no SA_RESTART, so blocking open/read return with EINTR */
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler=scan_alarm;
+  sigaction(SIGALRM,&sa,&old);
+  for (i=0;i<scan_count;i++) {
+    alarm(SCAN_TIMEOUT);
+    scan_probe_dev(&scan_devs[i]);
+    if (alarm(0) == 0 && scan_devs[i].status == SCAN_ERROR)
+      scan_devs[i].status=SCAN_TIMEDOUT;
+  }
+  sigaction(SIGALRM,&old,NULL);
+}
+#endif
+
+
+static const char *scan_status(int status)
+{
+  switch (status) {
+  case SCAN_OK: return "ok";
+  case SCAN_TIMEDOUT: return "timeout";
+  }
+  return "error";
+}
+
+/* print 's' as a CSV field */
+static void csv_field(const char *s)
+{
+  if (!strpbrk(s,",\"")) {
+    fputs(s,stdout);
+    return;
+  }
+  putchar('"');
+  for (;*s;s++) {
+    if (*s == '"') putchar('"');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+
+/* scan for devices and print them, 'format' is SCAN_TEXT or SCAN_CSV */
+void scan_bus(int format)
+{
+  scan_dev_type *d;
+  int i;
+
+  scan_list();
+  scan_probe();
+
+  if (format == SCAN_CSV) {
+    printf("device,vendor,model,revision,type,status\n");
+    for (i=0;i<scan_count;i++) {
+      d=&scan_devs[i];
+      printf("%s,",d->name);
+      csv_field(d->vendor); putchar(',');
+      csv_field(d->model); putchar(',');
+      csv_field(d->rev);
+      if (d->type >= 0) printf(",%d,%s\n",d->type,scan_status(d->status));
+      else printf(",,%s\n",scan_status(d->status));
+    }
+    return;
+  }
+
+  printf("Device                   Manufacturer  Model              Revision\n"
+	 "-----------------------  ------------- ------------------ --------\n"
+	 );
+  for (i=0;i<scan_count;i++) {
+    d=&scan_devs[i];
+    if (d->status == SCAN_OK)
+      printf("%-23s  %-13s %-18s %-8s %s\n",d->name,d->vendor,d->model,d->rev,
+	     (d->type==0x5?"[CD-ROM]":""));
+    else if (d->status == SCAN_TIMEDOUT)
+      printf("%-23s  %-13s %-18s %-8s [no answer]\n",d->name,d->vendor,
+	     d->model,d->rev);
+  }
+}
@@ -0,0 +1,190 @@
+/* sched.c -- scheduler for batches of scattered block reads
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Read requests are collected with sched_add() and executed with
+ * sched_run(). Requests are sorted by LBA, requests closer than
+ * SCHED_MAX_GAP blocks to each other are merged to one span (the gap
+ * is read and thrown away, which is much cheaper than a seek), and the
+ * spans are read in one sweep, in the direction that starts closer to
+ * where the previous batch of the scheduler ended (each scheduler keeps
+ * its own position, so schedulers of different contexts or threads do
+ * not share state). Data is then copied to the buffer of each request.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+typedef struct sched_span_type_ {
+  int first, last;      /* requests (index in sorted order) in the span */
+  int start, end;       /* blocks of the span */
+} sched_span_type;
+
+
+read_sched_type *sched_new(int bsize)
+{
+  read_sched_type *s;
+
+  s=(read_sched_type*)malloc(sizeof(read_sched_type));
+  if (!s) return NULL;
+  memset(s,0,sizeof(read_sched_type));
+  s->bsize=bsize;
+  return s;
+}
+
+void sched_free(read_sched_type *s)
+{
+  if (!s) return;
+  free(s->reqs);
+  free(s);
+}
+
+/* remove all requests */
+void sched_reset(read_sched_type *s)
+{
+  s->count=0;
+}
+
+
+/* add request to read 'count' blocks starting from 'lba' to 'buf',
+   returns index of the request (or -1) */
+int sched_add(read_sched_type *s, int lba, int count, unsigned char *buf)
+{
+  read_request_type *r;
+
+  if (count < 1) return -1;
+  if (s->count >= s->alloc) {
+    int n = (s->alloc ? s->alloc*2 : 64);
+    r=(read_request_type*)realloc(s->reqs,n*sizeof(read_request_type));
+    if (!r) return -1;
+    s->reqs=r;
+    s->alloc=n;
+  }
+
+  r=&s->reqs[s->count];
+  r->lba=lba;
+  r->count=count;
+  r->buf=buf;
+  r->bad=0;
+  return s->count++;
+}
+
+
+static int req_cmp(const void *a, const void *b)
+{
+  const read_request_type *x = *(const read_request_type**)a;
+  const read_request_type *y = *(const read_request_type**)b;
+
+  if (x->lba != y->lba) return (x->lba < y->lba ? -1 : 1);
+  return (x->count < y->count ? -1 : (x->count > y->count));
+}
+
+/* read one span, blocks that cannot be read are filled with zeros and
+   marked in 'bad' */
+static void sched_read_span(read_sched_type *s, sched_span_type *sp,
+			    unsigned char *buf, char *bad)
+{
+  int o, n, i, len, bsize = s->bsize, max;
+
+  /* as many blocks as fit in the largest transfer of the backend */
+  max=MAXTRANSFER*BLOCKSIZE/bsize;
+  if (max < 1) max=1;
+  for (o=0; o < sp->end-sp->start; o+=n) {
+    n=sp->end-sp->start-o;
+    if (n > max) n=max;
+    len=n*bsize;
+    /* reply length is not reliable when the read failed */
+    if (read_10(sp->start+o,n,buf+o*bsize,&len)) len=0;
+    if (len < n*bsize) {
+      for (i=len/bsize;i<n;i++) {
+	len=bsize;
+	if (read_10(sp->start+o+i,1,buf+(o+i)*bsize,&len) || len < bsize) {
+	  memset(buf+(o+i)*bsize,0,bsize);
+	  bad[o+i]=1;
+	}
+      }
+    }
+  }
+  s->head=sp->end;
+}
+
+/* execute all requests, returns total number of unreadable blocks
+   (number of unreadable blocks of each request is in its 'bad' field) */
+int sched_run(read_sched_type *s)
+{
+  read_request_type **order, *r;
+  sched_span_type *spans, *sp;
+  unsigned char *buf = NULL;
+  char *bad = NULL;
+  int i, j, k, nspans, len, alloc = 0, down, total = 0;
+
+  if (s->count < 1) return 0;
+  order=(read_request_type**)malloc(s->count*sizeof(read_request_type*));
+  spans=(sched_span_type*)malloc(s->count*sizeof(sched_span_type));
+  if (!order || !spans) die("No memory");
+  for (i=0;i<s->count;i++) order[i]=&s->reqs[i];
+  qsort(order,s->count,sizeof(read_request_type*),req_cmp);
+
+  /* merge requests to spans */
+  for (i=0,nspans=0; i<s->count; nspans++) {
+    sp=&spans[nspans];
+    sp->first=i;
+    sp->start=order[i]->lba;
+    sp->end=order[i]->lba+order[i]->count;
+    for (i++; i<s->count; i++) {
+      r=order[i];
+      if (r->lba > sp->end+SCHED_MAX_GAP) break;
+      if (r->lba+r->count > sp->end) {
+	if (r->lba+r->count-sp->start > SCHED_MAX_SPAN) break;
+	sp->end=r->lba+r->count;
+      }
+    }
+    sp->last=i-1;
+  }
+
+  /* sweep downwards if the drive is closer to the end */
+  down=(abs(s->head-spans[nspans-1].end) < abs(s->head-spans[0].start));
+
+  for (k=0;k<nspans;k++) {
+    sp=&spans[(down ? nspans-1-k : k)];
+    len=sp->end-sp->start;
+    if (len > alloc) {
+      free(buf);
+      free(bad);
+      buf=(unsigned char*)malloc((long)len*s->bsize);
+      bad=(char*)malloc(len);
+      if (!buf || !bad) die("No memory");
+      alloc=len;
+    }
+    memset(bad,0,len);
+    sched_read_span(s,sp,buf,bad);
+
+    for (i=sp->first;i<=sp->last;i++) {
+      r=order[i];
+      memcpy(r->buf,buf+(long)(r->lba-sp->start)*s->bsize,
+	     (long)r->count*s->bsize);
+      for (j=0;j<r->count;j++) if (bad[r->lba-sp->start+j]) r->bad++;
+      total+=r->bad;
+    }
+  }
+
+  free(buf);
+  free(bad);
+  free(spans);
+  free(order);
+  return total;
+}
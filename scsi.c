@@ -0,0 +1,88 @@
+/* scsi.c -- selecting the scsi device used by scsi_request()
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Device handles are opened by the system specific backend
+ * (scsi_linux.c, scsi_irix.c) with scsi_dev_open(). All commands go to
+ * the current device of the calling thread, which is set with
+ * scsi_select() (or scsi_open()). So the code sending the commands does
+ * not need to know about handles, and several drives can be used at
+ * the same time from different threads (see multi.c).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_key_t scsi_key;
+static pthread_once_t scsi_key_once = PTHREAD_ONCE_INIT;
+static int scsi_key_ok = 0;
+
+static void scsi_key_init(void)
+{
+  /* (without the key, all threads share scsi_dev) */
+  scsi_key_ok=(pthread_key_create(&scsi_key,NULL) == 0);
+}
+#endif
+static scsi_device_type *scsi_dev = NULL;
+
+
+/* make 'dev' the current device of the calling thread */
+void scsi_select(scsi_device_type *dev)
+{
+#ifdef HAVE_LIBPTHREAD
+  pthread_once(&scsi_key_once,scsi_key_init);
+  if (scsi_key_ok) {
+    pthread_setspecific(scsi_key,dev);
+    return;
+  }
+#endif
+  scsi_dev=dev;
+}
+
+/* returns current device of the calling thread (or NULL) */
+scsi_device_type *scsi_current()
+{
+#ifdef HAVE_LIBPTHREAD
+  pthread_once(&scsi_key_once,scsi_key_init);
+  if (scsi_key_ok) return (scsi_device_type*)pthread_getspecific(scsi_key);
+#endif
+  return scsi_dev;
+}
+
+
+/* open device and make it the current device */
+int scsi_open(const char *dev)
+{
+  scsi_device_type *d;
+
+  if (!(d=scsi_dev_open(dev))) return -1;
+  scsi_select(d);
+  return 0;
+}
+
+/* close the current device */
+void scsi_close()
+{
+  scsi_device_type *d = scsi_current();
+
+  if (!d) return;
+  scsi_dev_close(d);
+  scsi_select(NULL);
+}
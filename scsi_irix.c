@@ -33,20 +33,35 @@
 
 #include "readiso.h"
 
-static struct dsreq *dsp = 0;   /* handle to scsi device */
+struct scsi_device_type_ {
+  struct dsreq *dsp;    /* handle to scsi device */
+  replay_type *replay;  /* recorded session (instead of a device) */
+};
 
 
-int scsi_open(const char *dev)
+scsi_device_type *scsi_dev_open(const char *dev)
 {
-  dsp=dsopen(dev, O_RDWR);
-  if (!dsp) return -1;
-  return 0;
+  scsi_device_type *d;
+  struct dsreq *dsp = NULL;
+  replay_type *replay = NULL;
+
+  if (!strncmp(dev,REPLAY_PREFIX,strlen(REPLAY_PREFIX))) {
+    if (!(replay=replay_open(dev+strlen(REPLAY_PREFIX)))) return NULL;
+  }
+  else if (!(dsp=dsopen(dev, O_RDWR))) return NULL;
+  if (!(d=(scsi_device_type*)malloc(sizeof(scsi_device_type))))
+    die("No memory");
+  d->dsp=dsp;
+  d->replay=replay;
+  return d;
 }
 
-void scsi_close()
+void scsi_dev_close(scsi_device_type *d)
 {
-  if (dsp) dsclose(dsp);
-  dsp=0;
+  if (!d) return;
+  if (d->dsp) dsclose(d->dsp);
+  replay_close(d->replay);
+  free(d);
 }
 
 
@@ -58,19 +73,34 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
   int result;
 
 /* Irix... */
+  scsi_device_type *d = scsi_current();
+  struct dsreq *dsp;
   int i;
-  unsigned char *buf,*databuf;
+  unsigned char *buf,*databuf,cmd[16];
+  double start;
 
+  if (!d || cmdlen > sizeof(cmd)) return -1;
+  dsp=d->dsp;
   if (replylen) reply_len=*replylen;
 
-  buf=(unsigned char*)CMDBUF(dsp);
   databuf=(unsigned char*)malloc(datalen);
 
   va_start(args,mode);
-  for (i=0;i<cmdlen;i++) buf[i]=va_arg(args,unsigned int);
+  for (i=0;i<cmdlen;i++) cmd[i]=va_arg(args,unsigned int);
   for (i=0;i<datalen;i++) databuf[i]=va_arg(args,unsigned int);
   va_end(args);
 
+  start=(record_active() ? timeline_now() : latency_start());
+  if (d->replay) {
+    free(databuf);
+    result=replay_request(d->replay,cmd,cmdlen,reply,replylen);
+    if (start) latency_record(cmd[0],start,result);
+    return result;
+  }
+
+  buf=(unsigned char*)CMDBUF(dsp);
+  memcpy(buf,cmd,cmdlen);
+
   CMDBUF(dsp)=(caddr_t)buf;
   CMDLEN(dsp)=cmdlen;
   
@@ -89,6 +119,14 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
 
   if (mode==SCSIR_READ) { if (replylen) *replylen=DATASENT(dsp); } 
 
+  if (start) {
+    latency_record(cmd[0],start,(result || STATUS(dsp)));
+    record_cmd(cmd,cmdlen,databuf,datalen,reply,
+	       (mode==SCSIR_READ && replylen ? *replylen : 0),
+	       (unsigned char*)SENSEBUF(dsp),SENSESENT(dsp),
+	       (result || STATUS(dsp)),timeline_now()-start);
+  }
+
 
   free(databuf);
 
@@ -12,9 +12,12 @@
 #include "config.h"
 #include <linux/version.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include <scsi/scsi.h>
 #include <scsi/scsi_ioctl.h>
@@ -23,18 +26,40 @@
 #include "readiso.h"
 
 #define SCSI_HEADER_SIZE (sizeof(struct sg_header))
-#define SCSI_BUFFER_SIZE (READBLOCKS*BLOCKSIZE+SCSI_HEADER_SIZE)
+#define SCSI_RAW_SIZE    (RAWREADBLOCKS*(RAWBLOCKSIZE+C2BLOCKSIZE+SUBBLOCKSIZE))
+#define SCSI_DATA_SIZE   (MAXTRANSFER*BLOCKSIZE > SCSI_RAW_SIZE ? \
+			  MAXTRANSFER*BLOCKSIZE : SCSI_RAW_SIZE)
+#define SCSI_BUFFER_SIZE (SCSI_DATA_SIZE+SCSI_HEADER_SIZE)
+#define SCSI_ASYNC_SLOTS 16   /* queued commands timed per device */
 
-static int fd = -1;    /* file descriptor of the scsi device open */
+struct scsi_device_type_ {
+  int fd;               /* file descriptor of the scsi device */
+  int pack_id;
+  char *outbuf;         /* sg command and reply buffers */
+  char *inbuf;
+  double async_start[SCSI_ASYNC_SLOTS];   /* for latency_record() */
+  int async_op[SCSI_ASYNC_SLOTS];
+  replay_type *replay;  /* recorded session (instead of a device) */
+};
 
 
-int scsi_open(const char *dev)
+scsi_device_type *scsi_dev_open(const char *dev)
 {
-  int i;
+  scsi_device_type *d;
+  replay_type *replay = NULL;
+  int fd,i;
+
+  if (!strncmp(dev,REPLAY_PREFIX,strlen(REPLAY_PREFIX))) {
+    if (!(replay=replay_open(dev+strlen(REPLAY_PREFIX)))) return NULL;
+    fd=-1;
+  }
+  else if ((fd=open(dev,O_RDWR)) < 0) return NULL;
 
-  i=open(dev,O_RDWR);
-  if (i<0) return i;
-  fd=i;
+#ifdef SG_SET_RESERVED_SIZE
+  /* make sure the largest transfers fit in the reserved buffer */
+  i=SCSI_DATA_SIZE;
+  if (fd >= 0) ioctl(fd,SG_SET_RESERVED_SIZE,&i);
+#endif
 
 #if 0
   i=fcntl(fd,F_GETFL);
@@ -43,14 +68,36 @@ int scsi_open(const char *dev)
   fcntl(fd,F_SETFL,i&~O_NONBLOCK);
 #endif
 
-  return 0;
+  d=(scsi_device_type*)malloc(sizeof(scsi_device_type));
+  if (d) {
+    d->outbuf=(char*)malloc(SCSI_BUFFER_SIZE);
+    d->inbuf=(char*)malloc(SCSI_BUFFER_SIZE);
+  }
+  if (!d || !d->outbuf || !d->inbuf) {
+    if (d) {
+      free(d->outbuf);
+      free(d->inbuf);
+      free(d);
+    }
+    if (fd >= 0) close(fd);
+    replay_close(replay);
+    return NULL;
+  }
+  d->fd=fd;
+  d->pack_id=0;
+  d->replay=replay;
+  memset(d->async_start,0,sizeof(d->async_start));
+  return d;
 }
 
-void scsi_close()
+void scsi_dev_close(scsi_device_type *d)
 {
-  if (fd < 0) return;
-  close(fd);
-  fd=-1;
+  if (!d) return;
+  if (d->fd >= 0) close(d->fd);
+  replay_close(d->replay);
+  free(d->outbuf);
+  free(d->inbuf);
+  free(d);
 }
 
 int scsi_request(char *note, unsigned char *reply, int *replylen, 
@@ -62,24 +109,29 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
 
 /* Linux... */
 
-  static char  sg_outbuf[SCSI_BUFFER_SIZE];
-  static char  sg_inbuf[SCSI_BUFFER_SIZE];
-  struct sg_header *out_hdr = (struct sg_header *)sg_outbuf;
-  struct sg_header *in_hdr = (struct sg_header *)sg_inbuf;
-
+  scsi_device_type *d = scsi_current();
+  char *sg_outbuf, *sg_inbuf;
+  struct sg_header *out_hdr, *in_hdr;
   int i,size,wasread;
-  static int pack_id=0;
+  double start;
 
-  if (replylen) reply_len=*replylen;
+  if (!d) return -1;
+  sg_outbuf=d->outbuf;
+  sg_inbuf=d->inbuf;
+  out_hdr=(struct sg_header *)sg_outbuf;
+  in_hdr=(struct sg_header *)sg_inbuf;
 
-  memset(sg_outbuf,0,SCSI_BUFFER_SIZE);
-  memset(sg_inbuf,0,SCSI_BUFFER_SIZE);
+  if (replylen) reply_len=*replylen;
 
   size=SCSI_HEADER_SIZE+cmdlen+datalen;
 
+  /* clear only the parts used, replies can be large */
+  memset(sg_outbuf,0,size);
+  memset(sg_inbuf,0,SCSI_HEADER_SIZE);
+
   out_hdr->pack_len=size;
   out_hdr->reply_len=SCSI_HEADER_SIZE+reply_len;
-  out_hdr->pack_id=++pack_id;
+  out_hdr->pack_id=++d->pack_id;
   out_hdr->result=0;
   
 
@@ -88,7 +140,22 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
     sg_outbuf[SCSI_HEADER_SIZE+i]=va_arg(args,unsigned int);
   va_end(args);
 
-  result = write(fd, sg_outbuf, size);
+#ifdef SG_NEXT_CMD_LEN
+  /* sg guesses command length from the opcode, 16 byte commands
+     (READ CAPACITY(16)) are not always guessed right */
+  if (cmdlen > 12) ioctl(d->fd,SG_NEXT_CMD_LEN,&cmdlen);
+#endif
+
+  start=(record_active() ? timeline_now() : latency_start());
+  if (d->replay) {
+    result=replay_request(d->replay,(unsigned char*)sg_outbuf+SCSI_HEADER_SIZE,
+			  cmdlen,reply,replylen);
+    if (start) latency_record((unsigned char)sg_outbuf[SCSI_HEADER_SIZE],start,
+			      result);
+    return result;
+  }
+
+  result = write(d->fd, sg_outbuf, size);
   if (result<0) {
     fprintf(stderr,"%s write error %d\n",note,result);
     return result;
@@ -99,7 +166,7 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
     return 2;
   }
   
-  wasread=read(fd, sg_inbuf, SCSI_HEADER_SIZE+reply_len);
+  wasread=read(d->fd, sg_inbuf, SCSI_HEADER_SIZE+reply_len);
   if (wasread > SCSI_HEADER_SIZE) {
     if (replylen) {
       *replylen=wasread-SCSI_HEADER_SIZE;
@@ -111,6 +178,14 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
   /* HACK...Linux sg driver is rather stupid... */
   result=wasread<0 || wasread!=SCSI_HEADER_SIZE+reply_len || in_hdr->result ||
          in_hdr->sense_buffer[0]==0x70 || in_hdr->sense_buffer[0]==0x71;
+  if (start) {
+    latency_record((unsigned char)sg_outbuf[SCSI_HEADER_SIZE],start,result);
+    record_cmd((unsigned char*)sg_outbuf+SCSI_HEADER_SIZE,cmdlen,
+	       (unsigned char*)sg_outbuf+SCSI_HEADER_SIZE+cmdlen,datalen,
+	       reply,(replylen ? *replylen : 0),in_hdr->sense_buffer,
+	       (result ? sizeof(in_hdr->sense_buffer) : 0),result,
+	       timeline_now()-start);
+  }
 
   if ( (!(mode&SCSIR_QUIET) && result) || 0) {
     int i;
@@ -125,3 +200,78 @@ int scsi_request(char *note, unsigned char *reply, int *replylen,
   return result;
 }
 
+
+
+/* Non-blocking mode: several commands can be queued to the sg driver
+   with scsi_async_start() and their results read with scsi_async_finish()
+   when the file descriptor of the device becomes readable (see multi.c).
+   Commands are identified with 'id' (pack_id of the sg header). The sg
+   driver accepts only one command at a time unless command queuing is
+   turned on (SG_SET_COMMAND_Q), a command that does not fit in the
+   queue fails with EDOM. */
+
+/* set non-blocking mode on/off, returns file descriptor of the device */
+int scsi_dev_nonblock(scsi_device_type *d, int on)
+{
+  int i;
+
+  if (d->replay || (i=fcntl(d->fd,F_GETFL)) < 0) return -1;
+  if (fcntl(d->fd,F_SETFL,(on ? i|O_NONBLOCK : i&~O_NONBLOCK)) < 0) return -1;
+#ifdef SG_SET_COMMAND_Q
+  /* (if this fails, commands are sent one at a time) */
+  i=(on ? 1 : 0);
+  ioctl(d->fd,SG_SET_COMMAND_Q,&i);
+#endif
+  return d->fd;
+}
+
+/* queue command of 'cmdlen' bytes, returning up to 'replylen' bytes.
+   returns 0 if successful, -1 on error (errno is EAGAIN or EDOM if the
+   queue of the device is full) */
+int scsi_async_start(scsi_device_type *d, int id, int replylen, 
+		     int cmdlen, ...)
+{
+  struct sg_header *out_hdr = (struct sg_header *)d->outbuf;
+  va_list args;
+  int i,size;
+
+  size=SCSI_HEADER_SIZE+cmdlen;
+  memset(d->outbuf,0,size);
+  out_hdr->pack_len=size;
+  out_hdr->reply_len=SCSI_HEADER_SIZE+replylen;
+  out_hdr->pack_id=id;
+
+  va_start(args,cmdlen);
+  for (i=0;i<cmdlen;i++) 
+    d->outbuf[SCSI_HEADER_SIZE+i]=va_arg(args,unsigned int);
+  va_end(args);
+
+  i=id&(SCSI_ASYNC_SLOTS-1);
+  d->async_start[i]=latency_start();
+  d->async_op[i]=(unsigned char)d->outbuf[SCSI_HEADER_SIZE];
+  if (write(d->fd,d->outbuf,size) != size) return -1;
+  return 0;
+}
+
+/* get result of a finished command: its id, the data returned (valid
+   until the next call) and its length. returns 0 if the command was
+   successful, 1 if it failed and -1 if no command has finished */
+int scsi_async_finish(scsi_device_type *d, int *id, unsigned char **data,
+		      int *len)
+{
+  struct sg_header *in_hdr = (struct sg_header *)d->inbuf;
+  int wasread,i,result;
+
+  wasread=read(d->fd,d->inbuf,SCSI_BUFFER_SIZE);
+  if (wasread < (int)SCSI_HEADER_SIZE) return -1;
+
+  *id=in_hdr->pack_id;
+  *data=(unsigned char*)d->inbuf+SCSI_HEADER_SIZE;
+  *len=wasread-SCSI_HEADER_SIZE;
+  result=(in_hdr->result || in_hdr->sense_buffer[0]==0x70 || 
+	  in_hdr->sense_buffer[0]==0x71 ? 1 : 0);
+  i=*id&(SCSI_ASYNC_SLOTS-1);
+  if (d->async_start[i])
+    latency_record(d->async_op[i],d->async_start[i],result);
+  return result;
+}
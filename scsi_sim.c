@@ -0,0 +1,525 @@
+/* scsi_sim.c -- simulated drive for benchmarks (make bench)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* This backend replaces scsi_linux.c/scsi_irix.c in readiso-bench. The
+ * device name describes the drive and the disc in it, as comma
+ * separated key=value pairs:
+ *
+ *   blocks=n      size of the disc (2048 byte blocks)
+ *   media=m       cd, dvd or bd (profile reported by GET CONFIGURATION)
+ *   speed=x       transfer rate in MB/s
+ *   seek=ms       seek time (read not following the previous one)
+ *   overhead=ms   time of every command
+ *   bad=a-b/c-d   unreadable blocks (up to SIM_MAX_BAD ranges)
+ *   retry=ms      time of a read that hits an unreadable block
+ *   time=x        scale of all the times above (default 1.0)
+ *   queue=n       commands accepted at once in non-blocking mode
+ *                 (default SIM_QUEUE)
+ *
+ * The disc has one data track with an ISO9660 primary descriptor (the
+ * other blocks are filled with a pattern made from their LBA). The
+ * time of each command is slept, but short times are added up until
+ * SIM_MIN_SLEEP so that per command overheads stay accurate. When the
+ * program exits, throughput, CPU time per GB and peak RSS are printed
+ * on a line starting with "bench:" (see bench.sh).
+ *
+ * Non-blocking mode (several drives, see multi.c) is simulated on Linux:
+ * scsi_async_start() runs the command at once, but its result is held
+ * back until the drive would have finished it, and a timerfd makes the
+ * device readable at that time. Like the sg driver, a command that does
+ * not fit in the queue fails with EDOM.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#if defined(LINUX) && defined(HAVE_SYS_EPOLL_H)
+#define SIM_ASYNC
+#include <sys/timerfd.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define SIM_MAX_BAD    16
+#define SIM_MIN_SLEEP  0.002    /* seconds */
+#define SIM_QUEUE      16       /* (SG_MAX_QUEUE of the sg driver) */
+#define MB (1024.0*1024.0)
+
+typedef struct sim_cmd_type_ {
+  int id, result, len;
+  unsigned char op;
+  double start, done;   /* latency_start(), time the drive is done */
+  unsigned char *buf;
+  int bufsize;
+} sim_cmd_type;
+
+struct scsi_device_type_ {
+  int blocks;
+  int profile;
+  double speed;         /* bytes/s */
+  double seek, overhead, retry;  /* seconds */
+  double scale;
+  int bad_start[SIM_MAX_BAD], bad_end[SIM_MAX_BAD];
+  int bad_count;
+  int bsize;
+  int density;
+  int next;             /* block following the previous read */
+  double debt;          /* time not slept yet */
+
+  /* non-blocking mode */
+  int fd;               /* timerfd, -1 if not created */
+  int qmax, qhead, qcount;
+  sim_cmd_type queue[SIM_QUEUE];
+  unsigned char *done;  /* data of the last finished command */
+  int donesize;
+  double busy;          /* time the drive is done with the queue */
+};
+
+static unsigned char sim_pattern[BLOCKSIZE];
+static double sim_t0 = 0, sim_drive = 0;
+static long sim_cmds = 0;
+static int64 sim_bytes = 0;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* add to the counters printed at exit (drives may be opened and read
+   from several threads) */
+static void sim_count(long cmds, int64 bytes, double secs)
+{
+  pthread_mutex_lock(&sim_lock);
+  sim_cmds+=cmds;
+  sim_bytes+=bytes;
+  sim_drive+=secs;
+  pthread_mutex_unlock(&sim_lock);
+}
+
+static void sim_delay(scsi_device_type *d, double secs)
+{
+  struct timespec ts;
+
+  sim_count(0,0,secs);
+  d->debt+=secs*d->scale;
+  if (d->debt < SIM_MIN_SLEEP) return;
+  ts.tv_sec=(time_t)d->debt;
+  ts.tv_nsec=(long)((d->debt-ts.tv_sec)*1e9);
+  nanosleep(&ts,NULL);
+  d->debt=0;
+}
+
+static void sim_exit()
+{
+  struct rusage ru;
+  double wall, cpu;
+
+  wall=timeline_now()-sim_t0;
+  getrusage(RUSAGE_SELF,&ru);
+  cpu=ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+
+    ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+  fprintf(stderr,"bench: %lld bytes in %.2f s, %.1f MB/s, cpu %.2f s "
+	  "(%.2f s/GB), peak rss %ld kB, %ld commands, drive %.1f s\n",
+	  sim_bytes,wall,(wall > 0 ? sim_bytes/MB/wall : 0),cpu,
+	  (sim_bytes > 0 ? cpu*1024*MB/sim_bytes : 0),(long)ru.ru_maxrss,
+	  sim_cmds,sim_drive);
+}
+
+
+scsi_device_type *scsi_dev_open(const char *dev)
+{
+  scsi_device_type *d;
+  char *spec, *s, *v, *next;
+  unsigned long x = 1;
+  int i;
+
+  if (!(d=(scsi_device_type*)malloc(sizeof(scsi_device_type))) ||
+      !(spec=strdup(dev))) die("No memory");
+  memset(d,0,sizeof(scsi_device_type));
+  d->blocks=333000;
+  d->profile=0x08;
+  d->speed=7.2*MB;
+  d->scale=1.0;
+  d->bsize=BLOCKSIZE;
+  d->qmax=SIM_QUEUE;
+  d->fd=-1;
+
+  for (s=(strncmp(spec,"sim:",4) ? spec : spec+4);s && *s;s=next) {
+    if ((next=strchr(s,','))) *next++=0;
+    if (!(v=strchr(s,'='))) continue;
+    *v++=0;
+    if (!strcmp(s,"blocks")) d->blocks=atoi(v);
+    else if (!strcmp(s,"media"))
+      d->profile=(!strcmp(v,"bd") ? 0x40 : (!strcmp(v,"dvd") ? 0x10 : 0x08));
+    else if (!strcmp(s,"speed")) d->speed=atof(v)*MB;
+    else if (!strcmp(s,"seek")) d->seek=atof(v)/1000;
+    else if (!strcmp(s,"overhead")) d->overhead=atof(v)/1000;
+    else if (!strcmp(s,"retry")) d->retry=atof(v)/1000;
+    else if (!strcmp(s,"time")) d->scale=atof(v);
+    else if (!strcmp(s,"queue")) d->qmax=atoi(v);
+    else if (!strcmp(s,"bad")) {
+      while (*v && d->bad_count < SIM_MAX_BAD) {
+	i=d->bad_count++;
+	d->bad_start[i]=strtol(v,&v,10);
+	d->bad_end[i]=(*v=='-' ? strtol(v+1,&v,10) : d->bad_start[i]);
+	if (*v++ != '/') break;
+      }
+    }
+    else warn("unknown drive parameter '%s'",s);
+  }
+  free(spec);
+  if (d->speed <= 0) d->speed=MB;
+  if (d->qmax < 1 || d->qmax > SIM_QUEUE) d->qmax=SIM_QUEUE;
+
+  pthread_mutex_lock(&sim_lock);
+  for (i=0;i<BLOCKSIZE;i++) {
+    x=x*1103515245+12345;
+    sim_pattern[i]=(x>>16)&0xff;
+  }
+  if (sim_t0 == 0) {
+    sim_t0=timeline_now();
+    atexit(sim_exit);
+  }
+  pthread_mutex_unlock(&sim_lock);
+  return d;
+}
+
+void scsi_dev_close(scsi_device_type *d)
+{
+  int i;
+
+  if (d->fd >= 0) close(d->fd);
+  for (i=0;i<SIM_QUEUE;i++) free(d->queue[i].buf);
+  free(d->done);
+  free(d);
+}
+
+
+static void sim_block(scsi_device_type *d, int lba, unsigned char *buf)
+{
+  if (lba < 16) {
+    memset(buf,0,BLOCKSIZE);
+    return;
+  }
+  if (lba == 16 || lba == 17) {
+    /* ISO9660 primary descriptor and terminator */
+    memset(buf,0,BLOCKSIZE);
+    buf[0]=(lba == 16 ? 1 : 255);
+    memcpy(buf+1,"CD001",5);
+    buf[6]=1;
+    if (lba == 16) {
+      memcpy(buf+8,"READISO",7);
+      memcpy(buf+40,"BENCH",5);
+      buf[80]=buf[87]=d->blocks&0xff;
+      buf[81]=buf[86]=(d->blocks>>8)&0xff;
+      buf[82]=buf[85]=(d->blocks>>16)&0xff;
+      buf[83]=buf[84]=(d->blocks>>24)&0xff;
+    }
+    return;
+  }
+  memcpy(buf,sim_pattern,BLOCKSIZE);
+  buf[0]^=lba&0xff;
+  buf[1]^=(lba>>8)&0xff;
+  buf[2]^=(lba>>16)&0xff;
+  buf[3]^=(lba>>24)&0xff;
+}
+
+static int sim_bad(scsi_device_type *d, int lba, int count)
+{
+  int i;
+
+  for (i=0;i<d->bad_count;i++)
+    if (lba <= d->bad_end[i] && lba+count-1 >= d->bad_start[i]) return 1;
+  return 0;
+}
+
+/* a failed command returns the whole buffer (with garbage in it) and
+   result 1, like the sg driver does */
+static int sim_fail(unsigned char *reply, int *replylen)
+{
+  if (replylen && *replylen > 0) memset(reply,0xee,*replylen);
+  return 1;
+}
+
+/* read blocks, the time the drive takes is added to 'secs' */
+static int sim_read(scsi_device_type *d, int lba, int count,
+		    unsigned char *reply, int *replylen, double *secs)
+{
+  int i, max = (replylen ? *replylen : 0);
+
+  if (lba != d->next) *secs+=d->seek;
+  d->next=lba+count;
+  if (d->bsize != BLOCKSIZE || lba < 0 || lba+count > d->blocks ||
+      count*BLOCKSIZE > max) return sim_fail(reply,replylen);
+  if (sim_bad(d,lba,count)) {
+    *secs+=d->retry;
+    return sim_fail(reply,replylen);
+  }
+  for (i=0;i<count;i++) sim_block(d,lba+i,reply+i*BLOCKSIZE);
+  *secs+=count*BLOCKSIZE/d->speed;
+  *replylen=count*BLOCKSIZE;
+  sim_count(0,*replylen,0);
+  return 0;
+}
+
+
+int scsi_request(char *note, unsigned char *reply, int *replylen,
+		 int cmdlen, int datalen, int mode, ...)
+{
+  scsi_device_type *d = scsi_current();
+  unsigned char c[64], r[64];
+  va_list args;
+  int i, n = 0, result = 0, max;
+  double start, secs = 0;
+
+  if (!d || cmdlen+datalen > sizeof(c)) return -1;
+  va_start(args,mode);
+  for (i=0;i<cmdlen+datalen;i++) c[i]=va_arg(args,unsigned int);
+  va_end(args);
+
+  start=latency_start();
+  sim_count(1,0,0);
+  sim_delay(d,d->overhead);
+  max=(replylen ? *replylen : 0);
+  memset(r,0,sizeof(r));
+
+  switch (c[0]) {
+  case TESTREADY:
+  case STOPUNIT:
+  case REMOVAL:
+  case SETCDSPEED:
+    break;
+  case INQUIRY:
+    r[0]=0x05;
+    memcpy(r+8,"READISO SIMULATED DRIVE 1.0 ",28);
+    n=36;
+    break;
+  case MODESENSE:
+    r[3]=8;
+    r[4]=d->density;
+    r[9]=d->bsize>>16; r[10]=d->bsize>>8; r[11]=d->bsize;
+    n=12;
+    break;
+  case MODESENSE10:
+    r[7]=8;
+    r[8]=d->density;
+    r[13]=d->bsize>>16; r[14]=d->bsize>>8; r[15]=d->bsize;
+    n=16;
+    break;
+  case MODESELECT:
+    if (datalen < 12) result=1;
+    else {
+      d->density=c[cmdlen+4];
+      d->bsize=(c[cmdlen+9]<<16)|(c[cmdlen+10]<<8)|c[cmdlen+11];
+    }
+    break;
+  case READCAPACITY:
+    r[0]=(d->blocks-1)>>24; r[1]=(d->blocks-1)>>16;
+    r[2]=(d->blocks-1)>>8; r[3]=d->blocks-1;
+    r[6]=BLOCKSIZE>>8;
+    n=8;
+    break;
+  case SERVICEIN:
+    r[4]=(d->blocks-1)>>24; r[5]=(d->blocks-1)>>16;
+    r[6]=(d->blocks-1)>>8; r[7]=d->blocks-1;
+    r[10]=BLOCKSIZE>>8;
+    n=32;
+    break;
+  case GETCONFIG:
+    r[3]=4;
+    r[6]=d->profile>>8; r[7]=d->profile;
+    n=8;
+    break;
+  case READTOC:
+    if (c[2]&0x0f) {
+      result=1;   /* only the plain TOC */
+      break;
+    }
+    r[1]=18; r[2]=1; r[3]=1;
+    r[5]=0x14; r[6]=1;
+    r[13]=0x14; r[14]=0xaa;
+    r[16]=d->blocks>>24; r[17]=d->blocks>>16;
+    r[18]=d->blocks>>8; r[19]=d->blocks;
+    n=20;
+    break;
+  case READ10:
+    result=sim_read(d,V4(&c[2]),(c[7]<<8)|c[8],reply,replylen,&secs);
+    sim_delay(d,secs);
+    if (start) latency_record(c[0],start,result);
+    return result;
+  case READ12:
+    result=sim_read(d,V4(&c[2]),V4(&c[6]),reply,replylen,&secs);
+    sim_delay(d,secs);
+    if (start) latency_record(c[0],start,result);
+    return result;
+  default:
+    result=1;
+  }
+
+  if (result) sim_fail(reply,replylen);
+  else if (replylen) {
+    *replylen=(n > max ? max : n);
+    memcpy(reply,r,*replylen);
+  }
+  if (start) latency_record(c[0],start,result);
+  return result;
+}
+
+
+#ifdef SIM_ASYNC
+
+/* make the timerfd readable when the first command in the queue is done
+   (or never, if the queue is empty) */
+static void sim_arm(scsi_device_type *d)
+{
+  struct itimerspec it;
+  double t;
+
+  memset(&it,0,sizeof(it));
+  if (d->qcount > 0) {
+    t=d->queue[d->qhead].done-timeline_now();
+    if (t < 1e-6) t=1e-6;
+    it.it_value.tv_sec=(time_t)t;
+    it.it_value.tv_nsec=(long)((t-it.it_value.tv_sec)*1e9);
+  }
+  timerfd_settime(d->fd,0,&it,NULL);
+}
+
+/* set non-blocking mode on/off, returns file descriptor of the device */
+int scsi_dev_nonblock(scsi_device_type *d, int on)
+{
+  if (d->fd < 0 &&
+      (d->fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK)) < 0) return -1;
+  /* (commands still in the queue are dropped when switching off) */
+  if (!on || d->qcount == 0) {
+    d->qhead=d->qcount=0;
+    d->busy=0;
+  }
+  sim_arm(d);
+  return d->fd;
+}
+
+/* queue a READ(10) or READ(12) command (others fail), returns 0 if
+   successful, -1 on error (errno is EDOM if the queue is full) */
+int scsi_async_start(scsi_device_type *d, int id, int replylen,
+		     int cmdlen, ...)
+{
+  sim_cmd_type *q;
+  unsigned char c[16];
+  va_list args;
+  double now, secs;
+  int i;
+
+  if (d->fd < 0 || cmdlen > (int)sizeof(c)) {
+    errno=EINVAL;
+    return -1;
+  }
+  if (d->qcount >= d->qmax) {
+    errno=EDOM;
+    return -1;
+  }
+  va_start(args,cmdlen);
+  for (i=0;i<cmdlen;i++) c[i]=va_arg(args,unsigned int);
+  va_end(args);
+
+  q=&d->queue[(d->qhead+d->qcount)%SIM_QUEUE];
+  if (q->bufsize < replylen) {
+    free(q->buf);
+    if (!(q->buf=(unsigned char*)malloc(replylen))) die("No memory");
+    q->bufsize=replylen;
+  }
+  q->id=id;
+  q->op=c[0];
+  q->start=latency_start();
+  q->len=replylen;
+  secs=d->overhead;
+  if (c[0] == READ10)
+    q->result=sim_read(d,V4(&c[2]),(c[7]<<8)|c[8],q->buf,&q->len,&secs);
+  else if (c[0] == READ12)
+    q->result=sim_read(d,V4(&c[2]),V4(&c[6]),q->buf,&q->len,&secs);
+  else
+    q->result=sim_fail(q->buf,&q->len);
+  sim_count(1,0,secs);
+
+  /* the drive starts the command when it is done with the previous ones */
+  now=timeline_now();
+  d->busy=(d->busy > now ? d->busy : now)+secs*d->scale;
+  q->done=d->busy;
+  if (d->qcount++ == 0) sim_arm(d);
+  return 0;
+}
+
+/* get result of a finished command: its id, the data returned (valid
+   until the next call) and its length. returns 0 if the command was
+   successful, 1 if it failed and -1 if no command has finished */
+int scsi_async_finish(scsi_device_type *d, int *id, unsigned char **data,
+		      int *len)
+{
+  sim_cmd_type *q;
+  unsigned char *buf;
+  unsigned char expired[8];
+  int size;
+
+  if (d->fd < 0 || (read(d->fd,expired,sizeof(expired)) < 0 &&
+		    errno != EAGAIN)) return -1;
+  q=&d->queue[d->qhead];
+  if (d->qcount == 0 || q->done > timeline_now()) {
+    sim_arm(d);
+    return -1;
+  }
+  d->qhead=(d->qhead+1)%SIM_QUEUE;
+  d->qcount--;
+  sim_arm(d);
+
+  /* (swap buffers, so that the data stays valid while the slot is
+     reused) */
+  buf=d->done; size=d->donesize;
+  d->done=q->buf; d->donesize=q->bufsize;
+  q->buf=buf; q->bufsize=size;
+
+  *id=q->id;
+  *data=d->done;
+  *len=q->len;
+  if (q->start) latency_record(q->op,q->start,q->result);
+  return q->result;
+}
+
+#else
+
+/* non-blocking mode is not simulated, so several drives cannot be
+   read at once (-o) */
+int scsi_dev_nonblock(scsi_device_type *d, int on)
+{
+  return -1;
+}
+
+int scsi_async_start(scsi_device_type *d, int id, int replylen,
+		     int cmdlen, ...)
+{
+  return -1;
+}
+
+int scsi_async_finish(scsi_device_type *d, int *id, unsigned char **data,
+		      int *len)
+{
+  return -1;
+}
+
+#endif
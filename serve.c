@@ -0,0 +1,304 @@
+/* serve.c -- serving the disc to local clients over a Unix socket
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* The data track is exported read-only with the NBD (network block
+ * device) protocol ("fixed newstyle" handshake, only the default export
+ * with NBD_OPT_EXPORT_NAME / NBD_OPT_GO), so it can be used with
+ * nbd-client, qemu-nbd, nbdfuse etc. The drive is opened and set up
+ * only once, clients are served one at a time and all reads go through
+ * read_10(), so they share the block cache.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define NBD_MAGIC_OPTS      "IHAVEOPT"
+#define NBD_REQUEST_MAGIC   0x25609513UL
+#define NBD_REPLY_MAGIC     0x67446698UL
+
+#define NBD_FLAG_FIXED_NEWSTYLE  0x0001
+#define NBD_FLAG_NO_ZEROES       0x0002
+#define NBD_FLAG_HAS_FLAGS       0x0001  /* transmission flags */
+#define NBD_FLAG_READ_ONLY       0x0002
+
+#define NBD_OPT_EXPORT_NAME  1
+#define NBD_OPT_ABORT        2
+#define NBD_OPT_GO           7
+#define NBD_REP_ACK          1
+#define NBD_REP_INFO         3
+#define NBD_REP_ERR_UNSUP    0x80000001UL
+#define NBD_INFO_EXPORT      0
+
+#define NBD_CMD_READ   0
+#define NBD_CMD_DISC   2
+
+#define NBD_EPERM      1
+#define NBD_EIO        5
+#define NBD_EINVAL    22
+
+#define NBD_MAX_OPTLEN  4096
+#define NBD_MAX_READ    (32*1024*1024)
+
+static volatile int serve_quit = 0;
+
+
+static void serve_signal(int sig)
+{
+  (void)sig;
+  serve_quit=1;
+}
+
+/* write/read exactly 'len' bytes, returns 0 if successful (a signal
+   setting serve_quit stops the transfer) */
+static int serve_write(int fd, const void *buf, long len)
+{
+  const unsigned char *p = (const unsigned char*)buf;
+  long n;
+
+  while (len > 0) {
+    if ((n=write(fd,p,len)) < 0 && errno==EINTR && !serve_quit) continue;
+    if (n <= 0) return -1;
+    p+=n;
+    len-=n;
+  }
+  return 0;
+}
+
+static int serve_read(int fd, void *buf, long len)
+{
+  unsigned char *p = (unsigned char*)buf;
+  long n;
+
+  while (len > 0) {
+    if ((n=read(fd,p,len)) < 0 && errno==EINTR && !serve_quit) continue;
+    if (n <= 0) return -1;
+    p+=n;
+    len-=n;
+  }
+  return 0;
+}
+
+static void put32(unsigned char *p, uint32 v)
+{
+  p[0]=(v>>24)&0xff; p[1]=(v>>16)&0xff; p[2]=(v>>8)&0xff; p[3]=v&0xff;
+}
+
+/* 64 bit values are stored as two 32 bit halves */
+static void put64(unsigned char *p, uint32 hi, uint32 lo)
+{
+  put32(p,hi);
+  put32(p+4,lo);
+}
+
+
+/* send option reply */
+static int nbd_opt_reply(int fd, uint32 opt, uint32 type,
+			 unsigned char *data, int len)
+{
+  unsigned char r[20];
+
+  put64(r,0x0003e889UL,0x045565a9UL);
+  put32(r+8,opt);
+  put32(r+12,type);
+  put32(r+16,len);
+  if (serve_write(fd,r,20)) return -1;
+  return (len > 0 ? serve_write(fd,data,len) : 0);
+}
+
+/* handshake, returns 0 when the client has selected the export
+   (size of the export is 'blocks' blocks) */
+static int nbd_handshake(int fd, int blocks)
+{
+  unsigned char b[20], *data;
+  uint32 cflags, opt, len;
+  int result = -1;
+
+  memcpy(b,"NBDMAGIC" NBD_MAGIC_OPTS,16);
+  b[16]=0;
+  b[17]=NBD_FLAG_FIXED_NEWSTYLE|NBD_FLAG_NO_ZEROES;
+  if (serve_write(fd,b,18) || serve_read(fd,b,4)) return -1;
+  cflags=V4(b);
+  if (!(data=(unsigned char*)malloc(NBD_MAX_OPTLEN+124))) die("No memory");
+
+  while (1) {
+    if (serve_read(fd,b,16) || memcmp(b,NBD_MAGIC_OPTS,8)) break;
+    opt=V4(b+8);
+    len=V4(b+12);
+    if (len > NBD_MAX_OPTLEN || serve_read(fd,data,len)) break;
+
+    if (opt==NBD_OPT_EXPORT_NAME) {
+      memset(data,0,124);
+      put64(data,(uint32)blocks>>21,(uint32)blocks<<11);
+      data[8]=0;
+      data[9]=NBD_FLAG_HAS_FLAGS|NBD_FLAG_READ_ONLY;
+      if (!serve_write(fd,data,
+		       (cflags&NBD_FLAG_NO_ZEROES ? 10 : 10+124))) result=0;
+      break;
+    }
+    if (opt==NBD_OPT_GO) {
+      data[0]=0; data[1]=NBD_INFO_EXPORT;
+      put64(data+2,(uint32)blocks>>21,(uint32)blocks<<11);
+      data[10]=0;
+      data[11]=NBD_FLAG_HAS_FLAGS|NBD_FLAG_READ_ONLY;
+      if (!nbd_opt_reply(fd,opt,NBD_REP_INFO,data,12) &&
+	  !nbd_opt_reply(fd,opt,NBD_REP_ACK,NULL,0)) result=0;
+      break;
+    }
+    if (opt==NBD_OPT_ABORT) {
+      nbd_opt_reply(fd,opt,NBD_REP_ACK,NULL,0);
+      break;
+    }
+    if (nbd_opt_reply(fd,opt,NBD_REP_ERR_UNSUP,NULL,0)) break;
+  }
+
+  free(data);
+  return result;
+}
+
+
+/* read 'len' bytes starting from byte 'o' of block 'lba' of the track
+   starting from 'start', returns 0 if successful */
+static int serve_read_data(int start, int lba, int o, long len,
+			   unsigned char *out)
+{
+  unsigned char buf[MAXREADBLOCKS*BLOCKSIZE];
+  int blocks, got;
+  long n;
+
+  while (len > 0) {
+    blocks=(o+len+BLOCKSIZE-1)/BLOCKSIZE;
+    if (blocks > MAXREADBLOCKS) blocks=MAXREADBLOCKS;
+    got=blocks*BLOCKSIZE;
+    if (read_10(start+lba,blocks,buf,&got) || got < blocks*BLOCKSIZE)
+      return -1;
+    n=blocks*BLOCKSIZE-o;
+    if (n > len) n=len;
+    memcpy(out,buf+o,n);
+    out+=n;
+    len-=n;
+    lba+=blocks;
+    o=0;
+  }
+  return 0;
+}
+
+/* serve requests of one client until it disconnects */
+static void serve_client(int fd, int start, int blocks)
+{
+  unsigned char req[28], rep[16], *data = NULL;
+  long len, alloc = 0;
+  uint32 error, hi, lo;
+  int type, lba, o, count = 0;
+
+  if (nbd_handshake(fd,blocks)) return;
+
+  while (!serve_quit) {
+    if (serve_read(fd,req,28) || V4(req) != NBD_REQUEST_MAGIC) break;
+    type=V2(req+6);
+    hi=V4(req+16);
+    lo=V4(req+20);
+    len=(uint32)V4(req+24);
+    if (type==NBD_CMD_DISC) break;
+
+    /* offset as block number and offset in the block */
+    lba=(int)((hi<<21)|(lo>>11));
+    o=lo&(BLOCKSIZE-1);
+
+    error=0;
+    if (type!=NBD_CMD_READ) error=NBD_EPERM;
+    else if (hi >= (1UL<<10) || len < 0 || len > NBD_MAX_READ ||
+	     lba+(o+len+BLOCKSIZE-1)/BLOCKSIZE > blocks)
+      error=NBD_EINVAL;
+    else {
+      if (len > alloc) {
+	free(data);
+	if (!(data=(unsigned char*)malloc(len))) die("No memory");
+	alloc=len;
+      }
+      if (serve_read_data(start,lba,o,len,data)) error=NBD_EIO;
+    }
+
+    put32(rep,NBD_REPLY_MAGIC);
+    put32(rep+4,error);
+    memcpy(rep+8,req+8,8);  /* handle */
+    if (serve_write(fd,rep,16)) break;
+    if (!error && type==NBD_CMD_READ && serve_write(fd,data,len)) break;
+    count++;
+  }
+
+  free(data);
+  fprintf(stderr,"Client disconnected (%d request(s)).\n",count);
+}
+
+
+/* serve track starting at 'start' ('blocks' blocks) to clients
+   connecting to Unix socket 'path', until interrupted */
+int serve_disc(const char *path, int start, int blocks)
+{
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  struct stat st;
+  int s, c;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) die("socket path too long");
+  if (!stat(path,&st) && S_ISSOCK(st.st_mode)) unlink(path);
+
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path,path);
+  if ((s=socket(AF_UNIX,SOCK_STREAM,0)) < 0 ||
+      bind(s,(struct sockaddr*)&addr,sizeof(addr)) < 0 ||
+      listen(s,SERVE_BACKLOG) < 0) {
+    warn("cannot create socket '%s': %s",path,strerror(errno));
+    if (s >= 0) close(s);
+    return -1;
+  }
+
+  /* no SA_RESTART, so that accept() is interrupted */
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler=serve_signal;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+  fprintf(stderr,"Serving %d blocks (LBA %d-%d) on %s (NBD protocol)\n",
+	  blocks,start,start+blocks-1,path);
+
+  while (!serve_quit) {
+    if ((c=accept(s,NULL,NULL)) < 0) {
+      if (errno==EINTR) continue;
+      warn("accept failed: %s",strerror(errno));
+      break;
+    }
+    fprintf(stderr,"Client connected.\n");
+    serve_client(c,start,blocks);
+    close(c);
+  }
+
+  close(s);
+  unlink(path);
+  signal(SIGINT,SIG_DFL);
+  signal(SIGTERM,SIG_DFL);
+  return 0;
+}
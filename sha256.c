@@ -0,0 +1,225 @@
+/*
+ * This code implements the SHA-256 message-digest algorithm
+ * as specified in FIPS 180-2.  It is written in the style of
+ * the public domain MD5 code in md5.c and is also placed in
+ * the public domain.
+ *
+ * To compute the message digest of a chunk of bytes, declare a
+ * SHA256Context structure, pass it to SHA256Init, call SHA256Update
+ * as needed on buffers full of bytes, and then call SHA256Final,
+ * which will fill a supplied 32-byte array with the digest.
+ */
+
+#include "config.h"
+
+#if HAVE_STRING_H || STDC_HEADERS
+#include <string.h>	/* for memcpy() */
+#endif
+
+#include "sha256.h"
+
+static const uint32 K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Start SHA-256 accumulation.  Set bit count to 0 and state to the
+ * initial hash values.
+ */
+void
+SHA256Init(ctx)
+	struct SHA256Context *ctx;
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+
+	ctx->bits[0] = 0;
+	ctx->bits[1] = 0;
+}
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void
+SHA256Update(ctx, buf, len)
+	struct SHA256Context *ctx;
+	unsigned char const *buf;
+	unsigned len;
+{
+	uint32 t;
+
+	/* Update bitcount */
+
+	t = ctx->bits[0];
+	if ((ctx->bits[0] = t + ((uint32)len << 3)) < t)
+		ctx->bits[1]++; /* Carry from low to high */
+	ctx->bits[1] += len >> 29;
+
+	t = (t >> 3) & 0x3f;	/* Bytes already in ctx->in */
+
+	/* Handle any leading odd-sized chunks */
+
+	if ( t ) {
+		unsigned char *p = (unsigned char *)ctx->in + t;
+
+		t = 64-t;
+		if (len < t) {
+			memcpy(p, buf, len);
+			return;
+		}
+		memcpy(p, buf, t);
+		SHA256Transform(ctx->state, ctx->in);
+		buf += t;
+		len -= t;
+	}
+
+	/* Process data in 64-byte chunks */
+
+	while (len >= 64) {
+		SHA256Transform(ctx->state, buf);
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Handle any remaining bytes of data. */
+
+	memcpy(ctx->in, buf, len);
+}
+
+/*
+ * Final wrapup - pad to 64-byte boundary with the bit pattern 
+ * 1 0* (64-bit count of bits processed, MSB-first)
+ */
+void
+SHA256Final(digest, ctx)
+	unsigned char digest[32];
+	struct SHA256Context *ctx;
+{
+	unsigned count;
+	unsigned char *p;
+	int i;
+
+	/* Compute number of bytes mod 64 */
+	count = (ctx->bits[0] >> 3) & 0x3F;
+
+	/* Set the first char of padding to 0x80.  This is safe since there is
+	   always at least one byte free */
+	p = ctx->in + count;
+	*p++ = 0x80;
+
+	/* Bytes of padding needed to make 64 bytes */
+	count = 64 - 1 - count;
+
+	/* Pad out to 56 mod 64 */
+	if (count < 8) {
+		/* Two lots of padding:  Pad the first block to 64 bytes */
+		memset(p, 0, count);
+		SHA256Transform(ctx->state, ctx->in);
+
+		/* Now fill the next block with 56 bytes */
+		memset(ctx->in, 0, 56);
+	} else {
+		/* Pad block to 56 bytes */
+		memset(p, 0, count-8);
+	}
+
+	/* Append length in bits (big-endian) and transform */
+	for (i = 0; i < 4; i++) {
+		ctx->in[56+i] = (unsigned char)(ctx->bits[1] >> (24-8*i));
+		ctx->in[60+i] = (unsigned char)(ctx->bits[0] >> (24-8*i));
+	}
+
+	SHA256Transform(ctx->state, ctx->in);
+	for (i = 0; i < 8; i++) {
+		digest[4*i]   = (unsigned char)(ctx->state[i] >> 24);
+		digest[4*i+1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[4*i+2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[4*i+3] = (unsigned char)(ctx->state[i]);
+	}
+	memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
+}
+
+
+/* The six core functions */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32-(n))))
+#define CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define S0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+/*
+ * The core of the SHA-256 algorithm, this alters an existing SHA-256
+ * state to reflect the addition of 64 bytes of new data.  SHA256Update
+ * blocks the data and feeds it to this routine.
+ */
+void
+SHA256Transform(state, in)
+	uint32 state[8];
+	unsigned char const in[64];
+{
+	uint32 w[64];
+	register uint32 a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32)in[4*i] << 24 | (uint32)in[4*i+1] << 16 |
+		       (uint32)in[4*i+2] << 8 | (uint32)in[4*i+3];
+	for (i = 16; i < 64; i++)
+		w[i] = (s1(w[i-2]) + w[i-7] + s0(w[i-15]) + w[i-16]) & 0xffffffff;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + S1(e) + CH(e, f, g) + K[i] + w[i];
+		t2 = S0(a) + MAJ(a, b, c);
+		h = g;
+		g = f;
+		f = e;
+		e = (d + t1) & 0xffffffff;
+		d = c;
+		c = b;
+		b = a;
+		a = (t1 + t2) & 0xffffffff;
+	}
+
+	state[0] = (state[0] + a) & 0xffffffff;
+	state[1] = (state[1] + b) & 0xffffffff;
+	state[2] = (state[2] + c) & 0xffffffff;
+	state[3] = (state[3] + d) & 0xffffffff;
+	state[4] = (state[4] + e) & 0xffffffff;
+	state[5] = (state[5] + f) & 0xffffffff;
+	state[6] = (state[6] + g) & 0xffffffff;
+	state[7] = (state[7] + h) & 0xffffffff;
+}
@@ -0,0 +1,19 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "md5.h"	/* for uint32 and PROTO() */
+
+struct SHA256Context {
+	uint32 state[8];
+	uint32 bits[2];
+	unsigned char in[64];
+};
+
+void SHA256Init PROTO((struct SHA256Context *context));
+void SHA256Update PROTO((struct SHA256Context *context, unsigned char const *buf, unsigned len));
+void SHA256Final PROTO((unsigned char digest[32], struct SHA256Context *context));
+void SHA256Transform PROTO((uint32 state[8], unsigned char const in[64]));
+
+typedef struct SHA256Context SHA256_CTX;
+
+#endif /* !SHA256_H */
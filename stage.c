@@ -0,0 +1,170 @@
+/* stage.c -- where the time goes when reading an image (--stages)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Reading an image is a pipeline: the drive is read, checksums are
+ * calculated and the image file is written. The time spent in each
+ * stage is added up (by all threads running the stage), and the
+ * buffer and command queues between the stages are sampled for
+ * occupancy. At the end the time of each stage is divided by the time
+ * its threads had (wall clock time * threads), and the stage that was
+ * busiest is reported as the one limiting the speed: a drive-bound
+ * station needs faster drives, a writer-bound one faster disks and a
+ * cpu-bound one more (or faster) cores.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "md5.h"
+#include "readiso.h"
+
+
+typedef struct stage_queue_type_ {
+  unsigned long samples;
+  double sum;           /* sum of occupancies (0..1) */
+  double max;
+} stage_queue_type;
+
+static int st_active = 0;
+static double st_t0, st_t1;
+static double st_time[STAGES];
+static int st_threads[STAGES] = { 1, 1, 1, 1 };
+static stage_queue_type st_queue[QUEUES];
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t st_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static char *st_names[STAGES] = {
+  "drive", "checksums", "write", "buffer stall"
+};
+static char *st_bound[STAGES] = {
+  "drive-bound", "cpu-bound", "writer-bound", NULL
+};
+static char *st_qnames[QUEUES] = {
+  "buffers", "commands"
+};
+
+
+void stage_enable()
+{
+  st_active=1;
+}
+
+int stage_active()
+{
+  return st_active;
+}
+
+/* set number of threads running 'stage' (default 1) */
+void stage_threads(int stage, int threads)
+{
+  st_threads[stage]=(threads > 0 ? threads : 1);
+}
+
+/* start and end of reading (the time stages are compared to) */
+void stage_begin()
+{
+  memset(st_time,0,sizeof(st_time));
+  memset(st_queue,0,sizeof(st_queue));
+  st_t0=st_t1=timeline_now();
+}
+
+void stage_end()
+{
+  st_t1=timeline_now();
+}
+
+/* returns start time of a stage (0 if stages are not timed) */
+double stage_start()
+{
+  return (st_active ? timeline_now() : 0);
+}
+
+/* add time since 'start' (see stage_start()) to 'stage' */
+void stage_add(int stage, double start)
+{
+  double t;
+
+  if (!st_active || !start) return;
+  t=timeline_now()-start;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&st_lock);
+#endif
+  st_time[stage]+=t;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&st_lock);
+#endif
+}
+
+/* record occupancy of 'queue': 'used' of 'size' entries in use
+   (the caller must serialize calls for the same queue) */
+void stage_sample(int queue, int used, int size)
+{
+  stage_queue_type *q = &st_queue[queue];
+  double o;
+
+  if (!st_active || size <= 0) return;
+  o=(double)used/size;
+  q->samples++;
+  q->sum+=o;
+  if (o > q->max) q->max=o;
+}
+
+
+void stage_report(FILE *f)
+{
+  double wall, busy[STAGES], other;
+  int i, j, order[STAGES], n = 0, seq = 1;
+
+  if (!st_active) return;
+  if ((wall=st_t1-st_t0) <= 0) return;
+
+  fprintf(f,"Stages (%.2f s):\n"
+	  "Stage          threads  time (s)   busy\n",wall);
+  other=wall;
+  for (i=0;i<STAGES;i++) {
+    busy[i]=st_time[i]/(wall*st_threads[i]);
+    if (i == STAGE_STALL && st_time[i] == 0) continue;
+    fprintf(f,"%-14s %7d %9.2f %5.0f%%\n",st_names[i],st_threads[i],
+	    st_time[i],busy[i]*100);
+    if (st_threads[i] > 1) seq=0;
+    other-=st_time[i];
+  }
+  /* with one thread doing everything the rest is host overhead */
+  if (seq && other > 0)
+    fprintf(f,"%-14s %7d %9.2f %5.0f%%\n","other (host)",1,other,
+	    other*100/wall);
+
+  for (i=0;i<QUEUES;i++) {
+    if (st_queue[i].samples == 0) continue;
+    if (n++ == 0) fprintf(f,"Queue           avg full  max full\n");
+    fprintf(f,"%-14s %8.0f%% %8.0f%%\n",st_qnames[i],
+	    st_queue[i].sum*100/st_queue[i].samples,st_queue[i].max*100);
+  }
+
+  /* stages by busy time, busiest (limiting) first */
+  for (i=0,n=0;i<STAGES;i++) {
+    if (!st_bound[i]) continue;
+    for (j=n++;j>0 && busy[order[j-1]] < busy[i];j--) order[j]=order[j-1];
+    order[j]=i;
+  }
+  fprintf(f,"Limiting stage: ");
+  for (i=0;i<n;i++)
+    fprintf(f,"%s%s %.0f%%",(i ? ", " : ""),st_bound[order[i]],
+	    busy[order[i]]*100);
+  fprintf(f,"\n");
+}
@@ -0,0 +1,66 @@
+/* subq.c -- subchannel Q handling
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* CRC-16 (CCITT, x^16 + x^12 + x^5 + 1) used in subchannel Q */
+static unsigned short crc16_table[256];
+static int crc16_table_ok = 0;
+
+static void crc16_init()
+{
+  unsigned short c;
+  int i, j;
+
+  for (i=0;i<256;i++) {
+    c=i<<8;
+    for (j=0;j<8;j++) c=((c&0x8000) ? (c<<1)^0x1021 : (c<<1));
+    crc16_table[i]=c;
+  }
+  crc16_table_ok=1;
+}
+
+unsigned short crc16(const unsigned char *buf, int len)
+{
+  unsigned short crc = 0;
+
+  if (!crc16_table_ok) crc16_init();
+  while (len-- > 0)
+    crc=(crc<<8)^crc16_table[((crc>>8)^*buf++)&0xff];
+  return crc;
+}
+
+
+/* get Q channel (12 bytes) from raw (interleaved) P-W subchannel data */
+void subq_from_raw(const unsigned char *raw, unsigned char *q)
+{
+  int i;
+
+  memset(q,0,12);
+  for (i=0;i<SUBBLOCKSIZE;i++)
+    if (raw[i]&0x40) q[i/8]|=(0x80>>(i%8));
+}
+
+/* returns 0 if CRC of Q frame is ok (CRC is stored inverted) */
+int subq_check(const unsigned char *q)
+{
+  unsigned short crc = crc16(q,10);
+
+  return ((crc^0xffff) != ((q[10]<<8)|q[11]));
+}
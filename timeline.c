@@ -0,0 +1,152 @@
+/* timeline.c -- throughput timeline of drive reads (--timeline)
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* Every read command sent to the drive (READ(10)/(12) and READ CD) is
+ * timed with the monotonic clock. With --timeline a line is written
+ * to a CSV file for each of them: time since the first read, LBA,
+ * blocks, bytes, latency and the speed of that transfer. At the end a
+ * summary of the speeds is printed for TIMELINE_ZONES zones of equal
+ * size on the disc, which shows how the speed changes from the inner
+ * to the outer edge (CLV/CAV behaviour of the drive).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+#define MB (1024.0*1024.0)
+
+typedef struct timeline_zone_type_ {
+  long count;           /* transfers */
+  int64 bytes;
+  double secs;          /* time spent in the transfers */
+  double min, max;      /* MB/s */
+} timeline_zone_type;
+
+static FILE *tl_file = NULL;
+static double tl_t0;
+static int tl_start = 0;
+static int tl_blocks = 0;      /* size of the zoned range (0 = not known) */
+static timeline_zone_type tl_zones[TIMELINE_ZONES];
+static timeline_zone_type tl_total;
+
+
+/* returns time in seconds from a monotonic clock (if available) */
+double timeline_now()
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC,&ts)==0)
+    return ts.tv_sec+ts.tv_nsec/1e9;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec+tv.tv_usec/1e6;
+  }
+}
+
+
+int timeline_open(const char *name)
+{
+  if (!(tl_file=fopen(name,"w"))) return -1;
+  fprintf(tl_file,"time,lba,blocks,bytes,latency_ms,mb_per_s\n");
+  memset(tl_zones,0,sizeof(tl_zones));
+  memset(&tl_total,0,sizeof(tl_total));
+  tl_t0=timeline_now();
+  return 0;
+}
+
+int timeline_active()
+{
+  return (tl_file != NULL);
+}
+
+/* set range of blocks (normally the whole disc) divided into zones */
+void timeline_range(int start, int blocks)
+{
+  tl_start=start;
+  tl_blocks=blocks;
+}
+
+
+static void zone_add(timeline_zone_type *z, int bytes, double secs,
+		     double speed)
+{
+  if (z->count==0 || speed < z->min) z->min=speed;
+  if (z->count==0 || speed > z->max) z->max=speed;
+  z->count++;
+  z->bytes+=bytes;
+  z->secs+=secs;
+}
+
+/* record transfer of 'bytes' bytes ('blocks' blocks requested) starting
+   from 'lba', that took 'secs' seconds and ended at time 'end' */
+void timeline_record(int lba, int blocks, int bytes, double secs, double end)
+{
+  double speed;
+  int z;
+
+  if (!tl_file) return;
+  speed=(secs > 0 ? bytes/MB/secs : 0);
+  fprintf(tl_file,"%.6f,%d,%d,%d,%.3f,%.3f\n",end-tl_t0,lba,blocks,bytes,
+	  secs*1000,speed);
+  if (bytes <= 0 || secs <= 0) return;
+
+  zone_add(&tl_total,bytes,secs,speed);
+  if (tl_blocks > 0 && lba >= tl_start && lba < tl_start+tl_blocks) {
+    z=(int)((int64)(lba-tl_start)*TIMELINE_ZONES/tl_blocks);
+    zone_add(&tl_zones[z],bytes,secs,speed);
+  }
+}
+
+
+/* close the timeline file and print summary */
+void timeline_close()
+{
+  timeline_zone_type *z;
+  int i, first;
+
+  if (!tl_file) return;
+  fclose(tl_file);
+  tl_file=NULL;
+
+  if (tl_total.count == 0) return;
+  fprintf(stderr,"Timeline: %ld reads, %.1f MB in %.2f s, "
+	  "%.2f MB/s (min %.2f, max %.2f)\n",tl_total.count,
+	  tl_total.bytes/MB,tl_total.secs,tl_total.bytes/MB/tl_total.secs,
+	  tl_total.min,tl_total.max);
+  if (tl_blocks <= 0) return;
+
+  fprintf(stderr,"Zone  LBA range              reads   "
+	  "MB/s: min     avg     max\n");
+  for (i=0;i<TIMELINE_ZONES;i++) {
+    z=&tl_zones[i];
+    first=tl_start+(int)((int64)tl_blocks*i/TIMELINE_ZONES);
+    fprintf(stderr,"%3d  %9d - %-9d  %7ld",i+1,first,
+	    tl_start+(int)((int64)tl_blocks*(i+1)/TIMELINE_ZONES)-1,z->count);
+    if (z->count > 0)
+      fprintf(stderr,"  %9.2f %7.2f %7.2f\n",z->min,z->bytes/MB/z->secs,
+	      z->max);
+    else
+      fprintf(stderr,"          -       -       -\n");
+  }
+}
@@ -0,0 +1,232 @@
+/* tracks.c -- reading all tracks of a disc in one pass
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+/* The whole program area is read with one sequential pass, the data is
+ * split to a separate file for each track at the TOC boundaries. Mode 1
+ * data tracks are read with READ(10), audio and Mode 2 (XA) tracks as
+ * 2352 byte sectors with READ CD (like audio.c and raw.c), so the drive
+ * block size is never changed. The mode of each data track is taken
+ * from the header of its first sector (see track_mode()), and a CUE
+ * sheet describing the track files is written at the end.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* make base name for track files by removing the extension (if any) */
+char *track_basename(const char *name)
+{
+  char *base, *p;
+
+  if (!(base=strdup(name))) die("No memory");
+  p=strrchr(base,'.');
+  if (p && p > base && !strchr(p,'/')) *p=0;
+  return base;
+}
+
+static char *track_filename(const char *base, int track, int mode)
+{
+  char *name;
+
+  if (!(name=(char*)malloc(strlen(base)+16))) die("No memory");
+  sprintf(name,"%s-%02d.%s",base,track,
+	  (mode==0 ? "cdda" : (mode==2 ? "bin" : "iso")));
+  return name;
+}
+
+/* read 'n' blocks of a track of sector mode 'mode' (0 = audio) */
+static int read_track(int mode, int lba, int n, unsigned char *buf, int *len)
+{
+  if (mode == 1) return read_10(lba,n,buf,len);
+  return read_cd(lba,n,(mode ? READCD_RAW : READCD_USERDATA),
+		 READCD_SUB_NONE,buf,len);
+}
+
+
+/* read blocks one by one after a failed read, unreadable blocks
+   are filled with zeros. 'badrun' is the number of unreadable blocks
+   in a row, 'good' is set to the offset after the last good block */
+static void read_chunk_retry(int mode, int lba, int n, int bsize,
+			     unsigned char *buf, int *bad, int *badrun,
+			     int *good)
+{
+  int i, len;
+
+  for (i=0;i<n;i++) {
+    len=bsize;
+    if (read_track(mode,lba+i,1,buf+i*bsize,&len) || len<bsize) {
+      memset(buf+i*bsize,0,bsize);
+      (*bad)++;
+      (*badrun)++;
+    } else {
+      *badrun=0;
+      *good=lba+i+1;
+    }
+  }
+}
+
+
+/* read all tracks listed in 'toc' (as returned by read_toc()) into
+   separate files named '<basename>-NN.iso' (Mode 1 data tracks),
+   '<basename>-NN.bin' (Mode 2 data tracks, raw 2352 byte sectors) and
+   '<basename>-NN.cdda' (audio tracks, raw 2352 byte sectors), and write
+   '<basename>.cue'. with AUDIO_ACCURATERIP in 'flags' checksums of
+   audio tracks are written to '<basename>.csv'. returns number of
+   tracks that could not be read completely */
+int rip_all_tracks(unsigned char *toc, const char *name, int md5_mode,
+		   int flags)
+{
+  unsigned char *buffer, *toce;
+  char *base, *cuename, *fname, digest[16], digest_text[33];
+  FILE *cue, *out, *csv = NULL;
+  MD5_CTX md5;
+  audio_crc_type crc;
+  int first_audio = 0, last_audio = 0;
+  int first, last, track, audio, mode, start, stop, lba, n, len;
+  int bsize, blocks, bad, badrun, good, truncated, failed = 0;
+  long total, done = 0;
+  int start_time, cur_time, kbps;
+
+  first=toc[2];
+  last=toc[3];
+  if (last < first) die("invalid TOC");
+
+  base=track_basename(name);
+  if (!(cuename=(char*)malloc(strlen(base)+8))) die("No memory");
+  sprintf(cuename,"%s.cue",base);
+  if (!(cue=fopen(cuename,"w"))) die("cannot open file '%s'",cuename);
+
+  /* (MAXREADBLOCKS data blocks fit in RAWREADBLOCKS raw sectors) */
+  buffer=(unsigned char*)malloc(RAWREADBLOCKS*RAWBLOCKSIZE);
+  if (!buffer) die("No memory");
+
+  for (track=first; track<=last; track++) {
+    if (toc[4+(track-first)*8+1]&DATA_TRACK) continue;
+    if (!first_audio) first_audio=track;
+    last_audio=track;
+  }
+  if ((flags&AUDIO_ACCURATERIP) && first_audio) {
+    sprintf(cuename,"%s.csv",base);
+    if (!(csv=fopen(cuename,"w"))) die("cannot open file '%s'",cuename);
+    audio_crc_csv_header(csv);
+    sprintf(cuename,"%s.cue",base);
+  }
+
+  total=V4(&toc[4+(last-first+1)*8+4])-V4(&toc[4+4]);
+  fprintf(stderr,"Reading %d track(s), %ld blocks...\n",last-first+1,total);
+
+  if (get_block_size() != BLOCKSIZE) {
+    mode_select(BLOCKSIZE,0x00);
+    if (get_block_size() != BLOCKSIZE) warn("cannot set drive block size.");
+  }
+  start_time=(int)time(NULL);
+
+  for (track=first; track<=last; track++) {
+    toce=&toc[4+(track-first)*8];
+    mode=track_mode(toce,RAWBLOCKSIZE,buffer);
+    audio=(mode == 0);
+    start=V4(&toce[4]);
+    stop=V4(&toce[8+4]);
+
+    bsize=(mode==1 ? BLOCKSIZE : RAWBLOCKSIZE);
+    blocks=(mode==1 ? MAXREADBLOCKS : RAWREADBLOCKS);
+
+    fname=track_filename(base,track,mode);
+    if (!(out=fopen(fname,"w"))) die("cannot open output file '%s'",fname);
+    fprintf(cue,"FILE \"%s\" BINARY\n",
+	    (strrchr(fname,'/') ? strrchr(fname,'/')+1 : fname));
+    fprintf(cue,"  TRACK %02d %s\n",track,
+	    (mode==0 ? "AUDIO" : (mode==2 ? "MODE2/2352" : "MODE1/2048")));
+    fprintf(cue,"    INDEX 01 00:00:00\n");
+
+    if (md5_mode) MD5Init(&md5);
+    if (csv && audio)
+      audio_crc_init(&crc,(long)(stop-start)*RAWBLOCKSIZE/4,
+		     track==first_audio,track==last_audio);
+    bad=badrun=truncated=0;
+
+    for (good=lba=start; lba<stop; lba+=n) {
+      n=(stop-lba > blocks ? blocks : stop-lba);
+      len=n*bsize;
+      if (read_track(mode,lba,n,buffer,&len) || len<n*bsize) {
+	read_chunk_retry(mode,lba,n,bsize,buffer,&bad,&badrun,&good);
+      } else {
+	badrun=0;
+	good=lba+n;
+      }
+
+      fwrite(buffer,n*bsize,1,out);
+      if (md5_mode) MD5Update(&md5,buffer,n*bsize);
+      if (csv && audio) audio_crc_update(&crc,buffer,n*bsize);
+
+      if (badrun >= MAX_BAD_RUN) {
+	/* probably end of session or end of readable area, 
+	   drop the unreadable tail of the track */
+	warn("track %d: too many unreadable blocks at LBA=%d, "
+	     "track truncated.",track,good);
+	fflush(out);
+	ftruncate(fileno(out),(off_t)(good-start)*bsize);
+	bad-=lba+n-good;
+	done+=stop-lba;
+	truncated=1;
+	break;
+      }
+
+      done+=n;
+      if (done/512 != (done-n)/512) {
+	cur_time=(int)time(NULL);
+	kbps=((cur_time-start_time)>0 ?
+	      (done*2)/(cur_time-start_time) : 0);
+	fprintf(stderr,"Track %02d: %3ldM of %ldM read. (%d kb/s)         \r",
+		track,done/512,total/512,kbps);
+      }
+    }
+
+    fclose(out);
+    if (bad > 0)
+      fprintf(stderr,"\nTrack %02d: %d unreadable block(s) "
+	      "(filled with zeros).\n",track,bad);
+    if (bad > 0 || truncated) failed++;
+    if (md5_mode && truncated) {
+      fprintf(stderr,"\nMD5 (%s) not available, track truncated.\n",fname);
+    } else if (md5_mode) {
+      MD5Final((unsigned char*)digest,&md5);
+      md2str((unsigned char*)digest,digest_text);
+      fprintf(stderr,"\nMD5 (%s) = %s\n",fname,digest_text);
+    }
+    if (csv && audio) {
+      audio_crc_print(track,&crc);
+      audio_crc_csv_line(csv,track,start,stop-start,&crc);
+    }
+    free(fname);
+  }
+
+  fclose(cue);
+  fprintf(stderr,"\nCUE sheet written to: %s\n",cuename);
+  if (csv) {
+    fclose(csv);
+    fprintf(stderr,"Checksums written to: %s.csv\n",base);
+  }
+  free(cuename);
+  free(base);
+  free(buffer);
+
+  return failed;
+}
@@ -0,0 +1,698 @@
+/* udf.c -- UDF (ECMA-167) filesystem support
+ * $Id$
+ *
+ * Copyright (c) 1997-1999  Timo Kokkonen <tjko@iki.fi>
+ *
+ *
+ * This file may be copied under the terms and conditions
+ * of the GNU General Public License, as published by the Free
+ * Software Foundation (Cambridge, Massachusetts).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "readiso.h"
+
+
+/* UDF structures are little-endian */
+#define LE16(p) ( ((p)[0]&0xff) | (((p)[1]&0xff)<<8) )
+#define LE32(p) ISONUM(p)
+#define LE64(p) ( (int64)(unsigned)LE32(p) | ((int64)LE32((p)+4)<<32) )
+
+/* ICB file types */
+#define UDF_FT_DIR     4
+#define UDF_FT_FILE    5
+
+/* FID file characteristics */
+#define UDF_FID_DIR     0x02
+#define UDF_FID_DELETED 0x04
+#define UDF_FID_PARENT  0x08
+
+typedef struct udf_extent_ {
+  int  block;           /* first block (relative to volume start), -1
+			   if extent is not recorded */
+  int  boff;            /* byte offset in the first block */
+  long len;             /* length in bytes */
+} udf_extent;
+
+typedef struct udf_file_ {
+  int  type;            /* ICB file type */
+  int64 size;           /* information length */
+  int  count, alloc;
+  udf_extent *ext;
+  unsigned char *fe;    /* copy of the file entry block */
+} udf_file;
+
+
+static int udf_read_block(udf_volume_type *udf, int block,
+			  unsigned char *buf)
+{
+  int len = BLOCKSIZE;
+
+  if (block < 0) return -1;
+  if (read_10(udf->start+block,1,buf,&len) || len<BLOCKSIZE) return -1;
+  return 0;
+}
+
+/* check descriptor tag, 'loc' is the expected tag location or -1 */
+static int udf_tag_ok(unsigned char *b, int id, int loc)
+{
+  int i;
+  unsigned char sum = 0;
+
+  for (i=0;i<16;i++) if (i!=4) sum+=b[i];
+  if (sum != b[4]) return 0;
+  if (id >= 0 && LE16(b) != id) return 0;
+  if (loc >= 0 && LE32(b+12) != loc) return 0;
+  return 1;
+}
+
+/* convert OSTA CS0 string to UTF-8 */
+static void udf_cs0(unsigned char *s, int len, char *out, int outlen)
+{
+  int i, c, o = 0;
+
+  out[0]=0;
+  if (len < 2 || (s[0]!=8 && s[0]!=16)) return;
+
+  for (i=1;i<len;) {
+    if (s[0]==16) {
+      if (i+1 >= len) break;
+      c=(s[i]<<8)|s[i+1];
+      i+=2;
+    } else {
+      c=s[i++];
+    }
+    if (c==0) break;
+    if (c < 0x80) {
+      if (o+1 >= outlen) break;
+      out[o++]=c;
+    } else if (c < 0x800) {
+      if (o+2 >= outlen) break;
+      out[o++]=0xc0|(c>>6);
+      out[o++]=0x80|(c&0x3f);
+    } else {
+      if (o+3 >= outlen) break;
+      out[o++]=0xe0|(c>>12);
+      out[o++]=0x80|((c>>6)&0x3f);
+      out[o++]=0x80|(c&0x3f);
+    }
+  }
+  out[o]=0;
+}
+
+/* convert logical block number in given partition map to a block
+   number relative to the volume start */
+static int udf_lbn(udf_volume_type *udf, int map, int lbn)
+{
+  udf_map_type *m;
+  int i, off;
+
+  if (map < 0 || map >= udf->map_count || lbn < 0) return -1;
+  m=&udf->map[map];
+
+  if (m->type==UDF_MAP_PHYSICAL) return udf->part[m->part].start+lbn;
+
+  if (m->type==UDF_MAP_METADATA && m->meta) {
+    for (off=lbn,i=0; i<m->meta->count; i++) {
+      if (off < m->meta->ranges[i].count)
+	return udf->part[m->part].start+m->meta->ranges[i].start+off;
+      off-=m->meta->ranges[i].count;
+    }
+  }
+
+  return -1;
+}
+
+
+static void udf_free_file(udf_file *f)
+{
+  free(f->ext);
+  free(f->fe);
+  memset(f,0,sizeof(udf_file));
+}
+
+static int udf_add_extent(udf_file *f, int block, int boff, long len)
+{
+  udf_extent *e;
+
+  if (f->count >= f->alloc) {
+    int n = (f->alloc ? f->alloc*2 : 16);
+    e=(udf_extent*)realloc(f->ext,n*sizeof(udf_extent));
+    if (!e) return -1;
+    f->ext=e;
+    f->alloc=n;
+  }
+  e=&f->ext[f->count++];
+  e->block=block;
+  e->boff=boff;
+  e->len=len;
+  return 0;
+}
+
+/* read file entry (and allocation extents) of a file, blocks used
+   by these structures are added to 'used' (if not NULL). 'fe' is the
+   file entry block if it has already been read (or NULL) */
+static int udf_read_file(udf_volume_type *udf, int map, int lbn,
+			 udf_file *f, block_map_type *used, unsigned char *fe)
+{
+  unsigned char *b, *ad, aed[BLOCKSIZE];
+  int block, tag, l_ea, l_ad, adtype, adsize, o, partref, etype, pos;
+  int aeds = 0;
+  int64 left;
+  long len;
+
+  memset(f,0,sizeof(udf_file));
+  if (!(f->fe=(unsigned char*)malloc(BLOCKSIZE))) return -1;
+  b=f->fe;
+
+  block=udf_lbn(udf,map,lbn);
+  if (fe && block >= 0) memcpy(b,fe,BLOCKSIZE);
+  else if (udf_read_block(udf,block,b)) goto error;
+  if (!udf_tag_ok(b,-1,lbn)) goto error;
+  if (used) blockmap_add(used,block,1);
+
+  tag=LE16(b);
+  if (tag==UDF_TAG_FE) {
+    l_ea=LE32(b+168);
+    l_ad=LE32(b+172);
+    o=176+l_ea;
+  } else if (tag==UDF_TAG_EFE) {
+    l_ea=LE32(b+208);
+    l_ad=LE32(b+212);
+    o=216+l_ea;
+  } else goto error;
+  if (l_ea < 0 || l_ad < 0 || o+l_ad > BLOCKSIZE) goto error;
+
+  f->type=b[16+11];
+  f->size=LE64(b+56);
+  adtype=LE16(b+16+18)&0x07;
+
+  if (adtype==3) {  /* data embedded in the file entry */
+    if (f->size > l_ad) goto error;
+    if (udf_add_extent(f,block,o,f->size)) goto error;
+    return 0;
+  }
+
+  switch (adtype) {
+  case 0: adsize=8; break;
+  case 1: adsize=16; break;
+  case 2: adsize=20; break;
+  default: goto error;
+  }
+
+  ad=b+o;
+  left=f->size;
+  while (l_ad >= adsize && left > 0) {
+    len=LE32(ad)&0x3fffffff;
+    etype=(LE32(ad)>>30)&0x03;
+    if (len==0) break;
+    if (adtype==0) { pos=LE32(ad+4); partref=map; }
+    else if (adtype==1) { pos=LE32(ad+4); partref=LE16(ad+8); }
+    else { pos=LE32(ad+12); partref=LE16(ad+16); }
+
+    if (etype==3) {  /* continues in allocation extent descriptor */
+      if (++aeds > UDF_MAX_AED) goto error;  /* (a loop in the chain) */
+      block=udf_lbn(udf,partref,pos);
+      if (udf_read_block(udf,block,aed) ||
+	  !udf_tag_ok(aed,UDF_TAG_AED,pos)) goto error;
+      if (used) blockmap_add(used,block,1);
+      l_ad=LE32(aed+20);
+      if (l_ad < 0 || l_ad > BLOCKSIZE-24) goto error;
+      ad=aed+24;
+      continue;
+    }
+
+    if (len > left) len=left;
+    if (etype==0) {
+      block=udf_lbn(udf,partref,pos);
+      if (block < 0) goto error;
+    } else {
+      block=-1;  /* allocated but not recorded, or not allocated */
+    }
+    if (udf_add_extent(f,block,0,len)) goto error;
+    left-=len;
+    ad+=adsize;
+    l_ad-=adsize;
+  }
+
+  return 0;
+
+ error:
+  udf_free_file(f);
+  return -1;
+}
+
+
+/* returns next file identifier descriptor in directory data or NULL,
+   '*pos' is the offset of the next descriptor (start with 0) */
+static unsigned char *udf_next_fid(unsigned char *data, long size, long *pos)
+{
+  unsigned char *d = data+*pos;
+  int lfi, liu;
+
+  if (*pos+38 > size || !udf_tag_ok(d,UDF_TAG_FID,-1)) return NULL;
+  lfi=d[19];
+  liu=LE16(d+36);
+  if (*pos+38+liu+lfi > size) return NULL;
+  *pos+=(38+liu+lfi+3)&~3;
+  return d;
+}
+
+/* walk directory with file entry at 'lbn', 'fe' is the file entry block
+   if it has already been read (or NULL). directory contents and the
+   file entries of all entries in the directory are read with scheduler
+   batches. returns 0, or -1 if the directory cannot be read (with 'used'
+   also if a file or directory below it cannot be read, as the blocks
+   of those would be missing from the map) */
+static int udf_walk_dir(udf_volume_type *udf, file_index_type *idx,
+			block_map_type *used, int map, int lbn,
+			unsigned char *fe, const char *path, int depth)
+{
+  read_sched_type *sched;
+  udf_file dir, file;
+  unsigned char *data, *d, *fes = NULL, *f;
+  char name[768], *fullname;
+  int i, j, n, lfi, liu, chars, fmap, flbn, fi, block, result = 0;
+  long off, pos, next;
+
+  if (depth > UDF_MAX_DEPTH) {
+    warn("directory tree too deep: %s",path);
+    return -1;
+  }
+
+  if (udf_read_file(udf,map,lbn,&dir,used,fe)) {
+    warn("cannot read directory: %s",path);
+    return -1;
+  }
+  if (dir.type != UDF_FT_DIR || dir.size > 64*1024*1024) {
+    udf_free_file(&dir);
+    return -1;
+  }
+  /* recorded extents are read as whole blocks, so only the last one
+     may end in the middle of a block (ECMA-167 4/12) */
+  for (i=0; i<dir.count-1; i++) {
+    if (dir.ext[i].block >= 0 && dir.ext[i].boff == 0 &&
+	dir.ext[i].len % BLOCKSIZE) {
+      warn("bad directory extent: %s",path);
+      udf_free_file(&dir);
+      return -1;
+    }
+  }
+
+  /* read the directory contents */
+  data=(unsigned char*)malloc(dir.size+BLOCKSIZE);
+  fullname=(char*)malloc(strlen(path)+sizeof(name)+2);
+  if (!data || !fullname || !(sched=sched_new(BLOCKSIZE))) die("No memory");
+  for (off=0,i=0; i<dir.count; i++) {
+    udf_extent *e = &dir.ext[i];
+
+    if (e->block < 0) {
+      memset(data+off,0,e->len);
+    } else if (e->boff > 0) {
+      memcpy(data+off,dir.fe+e->boff,e->len);
+    } else {
+      n=(e->len+BLOCKSIZE-1)/BLOCKSIZE;
+      if (used) blockmap_add(used,e->block,n);
+      sched_add(sched,udf->start+e->block,n,data+off);
+    }
+    off+=e->len;
+  }
+  if (sched_run(sched) > 0) {
+    warn("cannot read directory: %s",path);
+    result=-1;
+    goto done;
+  }
+
+  /* go through file identifier descriptors, file entries are read
+     first for UDF_FE_BATCH entries at a time */
+  if (!(fes=(unsigned char*)malloc(UDF_FE_BATCH*BLOCKSIZE))) die("No memory");
+  for (pos=0; ; pos=next) {
+    sched_reset(sched);
+    memset(fes,0,UDF_FE_BATCH*BLOCKSIZE);
+    for (n=0,next=pos; n<UDF_FE_BATCH &&
+	   (d=udf_next_fid(data,dir.size,&next)); n++) {
+      block=udf_lbn(udf,LE16(d+28),LE32(d+24));
+      if (!(d[18] & (UDF_FID_PARENT|UDF_FID_DELETED)) && block >= 0)
+	sched_add(sched,udf->start+block,1,fes+n*BLOCKSIZE);
+    }
+    if (n < 1) break;
+    sched_run(sched);
+
+    for (j=0; j<n && (d=udf_next_fid(data,dir.size,&pos)); j++) {
+      chars=d[18];
+      lfi=d[19];
+      flbn=LE32(d+24);
+      fmap=LE16(d+28);
+      liu=LE16(d+36);
+      if (chars & (UDF_FID_PARENT|UDF_FID_DELETED)) continue;
+      f=fes+j*BLOCKSIZE;
+      if (!udf_tag_ok(f,-1,flbn)) f=NULL;
+
+      udf_cs0(d+38+liu,lfi,name,sizeof(name));
+      sprintf(fullname,"%s%s%s",path,(path[0]?"/":""),name);
+
+      if (chars & UDF_FID_DIR) {
+	if (udf_walk_dir(udf,idx,used,fmap,flbn,f,fullname,depth+1) && used)
+	  result=-1;
+	continue;
+      }
+
+      if (udf_read_file(udf,fmap,flbn,&file,used,f)) {
+	warn("cannot read file entry: %s",fullname);
+	if (used) result=-1;
+	continue;
+      }
+      if (file.type == UDF_FT_FILE) {
+	fi=-1;
+	if (idx && (fi=fileindex_add_file(idx,fullname,file.size)) < 0)
+	  die("No memory");
+	for (off=0,i=0; i<file.count; i++) {
+	  udf_extent *e = &file.ext[i];
+
+	  if (e->block >= 0) {
+	    if (idx && fileindex_add_extent(idx,fi,e->block,e->boff,off,e->len))
+	      die("No memory");
+	    if (used && e->boff==0)
+	      blockmap_add(used,e->block,(e->len+BLOCKSIZE-1)/BLOCKSIZE);
+	  }
+	  off+=e->len;
+	}
+      }
+      udf_free_file(&file);
+    }
+  }
+
+ done:
+  sched_free(sched);
+  free(fes);
+  free(data);
+  free(fullname);
+  udf_free_file(&dir);
+  return result;
+}
+
+
+/* check for UDF volume recognition sequence (NSR descriptor) */
+static int udf_check_vrs(udf_volume_type *udf)
+{
+  unsigned char buf[BLOCKSIZE];
+  int i;
+
+  for (i=16;i<16+ISO_MAX_VD;i++) {
+    if (udf_read_block(udf,i,buf)) return 0;
+    if (!memcmp(buf+1,"NSR02",5) || !memcmp(buf+1,"NSR03",5)) return 1;
+    if (memcmp(buf+1,"BEA01",5) && memcmp(buf+1,"CD001",5) &&
+	memcmp(buf+1,"BOOT2",5) && memcmp(buf+1,"CDW02",5)) return 0;
+  }
+  return 0;
+}
+
+static int udf_find_anchor(udf_volume_type *udf, int block,
+			   unsigned char *buf)
+{
+  if (block < UDF_ANCHOR) return 0;
+  if (udf_read_block(udf,block,buf)) return 0;
+  return udf_tag_ok(buf,UDF_TAG_AVDP,block);
+}
+
+/* read volume descriptor sequence */
+static int udf_read_vds(udf_volume_type *udf, int loc, int len, int *end)
+{
+  unsigned char buf[BLOCKSIZE], *m;
+  int i, j, o, lvd = 0, n, pnum[UDF_MAX_MAPS];
+  int blocks = len/BLOCKSIZE;
+
+  udf->part_count=0;
+  udf->map_count=0;
+  if (loc+blocks > *end) *end=loc+blocks;
+
+  for (i=0;i<blocks;i++) {
+    if (udf_read_block(udf,loc+i,buf) || !udf_tag_ok(buf,-1,loc+i)) break;
+
+    switch (LE16(buf)) {
+
+    case UDF_TAG_PD:
+      if (udf->part_count >= UDF_MAX_PARTS) break;
+      udf->part[udf->part_count].number=LE16(buf+22);
+      udf->part[udf->part_count].start=LE32(buf+188);
+      udf->part[udf->part_count].length=LE32(buf+192);
+      udf->part[udf->part_count].bitmap_len=LE32(buf+56+8)&0x3fffffff;
+      udf->part[udf->part_count].bitmap=LE32(buf+56+12);
+      udf->part_count++;
+      break;
+
+    case UDF_TAG_LVD:
+      if (LE32(buf+212) != BLOCKSIZE) {
+	if (!udf->quiet)
+	  warn("unsupported UDF logical block size: %d",LE32(buf+212));
+	return -1;
+      }
+      udf_cs0(buf+84,buf[84+127],udf->volume_id,sizeof(udf->volume_id));
+      udf->revision=LE16(buf+216+24);
+      udf->fsd_lbn=LE32(buf+248+4);
+      udf->fsd_map=LE16(buf+248+8);
+      if (LE32(buf+432)>0 && LE32(buf+436)+LE32(buf+432)/BLOCKSIZE > *end)
+	*end=LE32(buf+436)+LE32(buf+432)/BLOCKSIZE;
+
+      n=LE32(buf+268);
+      for (o=440,j=0; j<n && j<UDF_MAX_MAPS && o+6<=BLOCKSIZE; j++) {
+	m=buf+o;
+	if (m[0]==1) {
+	  udf->map[j].type=UDF_MAP_PHYSICAL;
+	  pnum[j]=LE16(m+4);
+	} else if (m[0]==2 && !memcmp(m+5,"*UDF Metadata Partition",23)) {
+	  udf->map[j].type=UDF_MAP_METADATA;
+	  pnum[j]=LE16(m+38);
+	  udf->map[j].meta_file=LE32(m+40);
+	} else if (m[0]==2 && !memcmp(m+5,"*UDF Sparable Partition",23)) {
+	  /* read-only access, sparing table can be ignored */
+	  udf->map[j].type=UDF_MAP_PHYSICAL;
+	  pnum[j]=LE16(m+38);
+	} else {
+	  udf->map[j].type=UDF_MAP_VIRTUAL;
+	  pnum[j]=LE16(m+38);
+	}
+	if (m[1] < 6) break;
+	o+=m[1];
+      }
+      udf->map_count=j;
+      lvd=1;
+      break;
+
+    case UDF_TAG_TD:
+      i=blocks;
+      break;
+    }
+  }
+
+  if (!lvd || udf->part_count < 1) return -1;
+
+  /* bind partition maps to partition descriptors */
+  for (j=0;j<udf->map_count;j++) {
+    udf->map[j].part=-1;
+    for (i=0;i<udf->part_count;i++)
+      if (udf->part[i].number==pnum[j]) udf->map[j].part=i;
+    if (udf->map[j].part < 0) return -1;
+    if (udf->map[j].type==UDF_MAP_VIRTUAL && !udf->quiet)
+      warn("UDF virtual partitions are not supported.");
+  }
+
+  return 0;
+}
+
+/* read location of the metadata partition(s) from the metadata files */
+static int udf_read_metadata(udf_volume_type *udf)
+{
+  udf_file f;
+  int i, j, p;
+
+  for (i=0;i<udf->map_count;i++) {
+    if (udf->map[i].type!=UDF_MAP_METADATA) continue;
+    for (p=-1,j=0;j<udf->map_count;j++)
+      if (udf->map[j].type==UDF_MAP_PHYSICAL &&
+	  udf->map[j].part==udf->map[i].part) p=j;
+    if (p < 0 || udf_read_file(udf,p,udf->map[i].meta_file,&f,NULL,NULL))
+      return -1;
+    if (!(udf->map[i].meta=blockmap_new())) {
+      udf_free_file(&f);
+      return -1;
+    }
+    for (j=0;j<f.count;j++) {
+      if (f.ext[j].block < 0) continue;
+      blockmap_add(udf->map[i].meta,
+		   f.ext[j].block-udf->part[udf->map[i].part].start,
+		   (f.ext[j].len+BLOCKSIZE-1)/BLOCKSIZE);
+    }
+    udf_free_file(&f);
+  }
+
+  return 0;
+}
+
+
+/* look for UDF filesystem on the track starting at 'start', returns
+   NULL if no (supported) UDF volume is found (or out of memory). if
+   'quiet' is set, unsupported volumes are not reported (libreadiso.c) */
+udf_volume_type *udf_open(int start, int tracksize, int quiet)
+{
+  udf_volume_type *udf;
+  unsigned char buf[BLOCKSIZE];
+  int i, end, last, cand[4];
+
+  if (!(udf=(udf_volume_type*)malloc(sizeof(udf_volume_type))))
+    return NULL;
+  memset(udf,0,sizeof(udf_volume_type));
+  udf->start=start;
+  udf->quiet=quiet;
+
+  if (!udf_check_vrs(udf)) goto error;
+  if (!udf_find_anchor(udf,UDF_ANCHOR,buf) &&
+      !udf_find_anchor(udf,tracksize-1,buf) &&
+      !udf_find_anchor(udf,tracksize-257,buf)) goto error;
+
+  end=UDF_ANCHOR+1;
+  if (udf_read_vds(udf,LE32(buf+20),LE32(buf+16),&end) &&
+      udf_read_vds(udf,LE32(buf+28),LE32(buf+24),&end)) goto error;
+  if (LE32(buf+28)+LE32(buf+24)/BLOCKSIZE > end)
+    end=LE32(buf+28)+LE32(buf+24)/BLOCKSIZE;
+  if (udf_read_metadata(udf)) goto error;
+
+  /* file set descriptor */
+  if (udf_read_block(udf,udf_lbn(udf,udf->fsd_map,udf->fsd_lbn),buf) ||
+      !udf_tag_ok(buf,UDF_TAG_FSD,udf->fsd_lbn)) goto error;
+  udf->root_lbn=LE32(buf+400+4);
+  udf->root_map=LE16(buf+400+8);
+
+  /* volume size: end of partitions and descriptor sequences, and the
+     last anchor point (at N-1 or N-257) if one can be found after them */
+  for (i=0;i<udf->part_count;i++)
+    if (udf->part[i].start+udf->part[i].length > end)
+      end=udf->part[i].start+udf->part[i].length;
+  cand[0]=tracksize-1;
+  cand[1]=tracksize-257;
+  cand[2]=end+256;
+  cand[3]=end;
+  for (last=-1,i=0;i<4 && last<0;i++)
+    if (cand[i] >= end-1 && cand[i] < tracksize &&
+	udf_find_anchor(udf,cand[i],buf)) last=cand[i];
+  udf->volume_size=(last >= end ? last+1 : end);
+
+  return udf;
+
+ error:
+  udf_close(udf);
+  return NULL;
+}
+
+void udf_close(udf_volume_type *udf)
+{
+  int i;
+
+  if (!udf) return;
+  for (i=0;i<udf->map_count;i++) blockmap_free(udf->map[i].meta);
+  free(udf);
+}
+
+
+void udf_print_info(udf_volume_type *udf)
+{
+  int i;
+
+  printf("UDF image info:\n");
+  printf("Volume id:         %s\n",udf->volume_id);
+  printf("UDF revision:      %x.%02x\n",udf->revision>>8,udf->revision&0xff);
+  for (i=0;i<udf->part_count;i++)
+    printf("Partition %-2d       start=%d length=%d%s\n",
+	   udf->part[i].number,udf->part[i].start,udf->part[i].length,
+	   (udf->part[i].bitmap_len>0?" (space bitmap)":""));
+  printf("Image size:        %02d:%02d:%02d, %d blocks (%lld bytes)\n",
+	 LBA_MIN(udf->volume_size),LBA_SEC(udf->volume_size),
+	 LBA_FRM(udf->volume_size),udf->volume_size,
+	 (int64)udf->volume_size*BLOCKSIZE);
+}
+
+
+/* build index of all files on the UDF volume, returns number of
+   files found or -1 if the root directory cannot be read */
+int udf_build_file_index(udf_volume_type *udf, file_index_type *idx)
+{
+  if (udf_walk_dir(udf,idx,NULL,udf->root_map,udf->root_lbn,NULL,"",0))
+    return -1;
+  fileindex_sort(idx);
+  return idx->file_count;
+}
+
+
+/* add allocated blocks of the volume to 'used'. Partition space bitmaps
+   are used when available, otherwise the directory tree is walked */
+int udf_used_blocks(udf_volume_type *udf, block_map_type *used)
+{
+  unsigned char *bm;
+  udf_partition_type *p;
+  int i, j, b, n, bits, walk = 0, fsd;
+
+  /* everything outside the partitions is volume structures */
+  for (b=0; b<udf->volume_size; b=n) {
+    for (n=udf->volume_size,i=0; i<udf->part_count; i++) {
+      p=&udf->part[i];
+      if (b >= p->start && b < p->start+p->length) {
+	n=p->start+p->length;
+	break;
+      }
+      if (p->start > b && p->start < n) n=p->start;
+    }
+    if (i==udf->part_count) blockmap_add(used,b,n-b);
+  }
+
+  for (i=0;i<udf->part_count;i++) {
+    p=&udf->part[i];
+    n=(p->bitmap_len+BLOCKSIZE-1)/BLOCKSIZE;
+    if (n < 1) { walk=1; continue; }
+    if (!(bm=(unsigned char*)malloc(n*BLOCKSIZE))) die("No memory");
+    for (j=0;j<n;j++) {
+      if (udf_read_block(udf,p->start+p->bitmap+j,bm+j*BLOCKSIZE)) break;
+    }
+    if (j<n || !udf_tag_ok(bm,264,p->bitmap) ||
+	LE32(bm+20) > n*BLOCKSIZE-24) {
+      free(bm);
+      walk=1;
+      continue;
+    }
+    blockmap_add(used,p->start+p->bitmap,n);
+
+    /* a set bit in the bitmap means that block is free (only the bytes
+       of the bitmap that were read are looked at) */
+    bits=LE32(bm+16);
+    if (bits > LE32(bm+20)*8) bits=LE32(bm+20)*8;
+    if (bits > (n*BLOCKSIZE-24)*8) bits=(n*BLOCKSIZE-24)*8;
+    for (j=0; j<bits && j<p->length; j++) {
+      if (!(bm[24+j/8] & (1<<(j&7)))) blockmap_add(used,p->start+j,1);
+    }
+    free(bm);
+  }
+
+  if (walk) {
+    fsd=udf_lbn(udf,udf->fsd_map,udf->fsd_lbn);
+    if (fsd >= 0) blockmap_add(used,fsd,2);  /* FSD and terminator */
+    for (i=0;i<udf->map_count;i++) {
+      if (!udf->map[i].meta) continue;
+      blockmap_add(used,udf->part[udf->map[i].part].start+
+		   udf->map[i].meta_file,1);
+      for (j=0;j<udf->map[i].meta->count;j++)
+	blockmap_add(used,udf->part[udf->map[i].part].start+
+		     udf->map[i].meta->ranges[j].start,
+		     udf->map[i].meta->ranges[j].count);
+    }
+    if (udf_walk_dir(udf,NULL,used,udf->root_map,udf->root_lbn,NULL,"",0))
+      return -1;
+  }
+
+  blockmap_normalize(used,0);
+  return 0;
+}